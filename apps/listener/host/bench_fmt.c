@@ -0,0 +1,225 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Host micro benchmark of the listener's json frame record, the
+ * lstnr_fmt builder of main.c against the mprintf rendering it replaced.
+ * mprintf ran a vsnprintf per fragment and handed each one to the mbuf
+ * and the console, here both are one append to a buffer. The record is
+ * that of a two receiver listener with rxdiag on and a 127 byte frame.
+ * Values are rounded by lstnr_fmt and truncated by mprintf, so the two
+ * records may differ in the last digit. Absolute numbers are the host's,
+ * the ratio is what to watch.
+ *
+ *   make bench_fmt && ./bench_fmt [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+#include "lstnr_fmt.h"
+
+#define N_INSTANCES (2)
+#define DLEN        (127)
+
+struct frame {
+    uint32_t utime;
+    uint64_t ts[N_INSTANCES];
+    float rssi[N_INSTANCES];
+    float fppl[N_INSTANCES];
+    float pd[N_INSTANCES - 1];
+    uint8_t d[DLEN];
+};
+
+static char g_out[2048];
+static int g_out_len;
+
+static void
+out_write(const char *buf, int len)
+{
+    if (g_out_len + len < (int)sizeof(g_out)) {
+        memcpy(g_out + g_out_len, buf, len);
+        g_out_len += len;
+    }
+}
+
+/* The listener's mprintf before lstnr_fmt.c, the mbuf append and the
+ * console write replaced by out_write */
+static int
+mprintf(const char *fmt, ...)
+{
+    static char output_buffer[1024];
+    va_list args;
+    int num_chars;
+
+    va_start(args, fmt);
+    num_chars = vsnprintf(output_buffer, sizeof(output_buffer)-10, fmt, args);
+    out_write(output_buffer, num_chars);
+    va_end(args);
+    return num_chars;
+}
+
+static int
+mprintf_record(const struct frame *fr)
+{
+    g_out_len = 0;
+    mprintf("{\"utime\":%lu", (unsigned long)fr->utime);
+    mprintf(",\"ts\":[");
+    for(int j=0;j<N_INSTANCES;j++) {
+        mprintf("%s%llu", (j==0)?"":",", (unsigned long long)fr->ts[j]);
+    }
+    mprintf("]");
+    mprintf(",\"rssi\":[");
+    for(int j=0;j<N_INSTANCES;j++) {
+        float rssi = fr->rssi[j];
+        mprintf("%s%d.%01d", (j==0)?"":",",
+               (int)rssi, abs((int)(10*(rssi-(int)rssi))));
+    }
+    mprintf("],\"fppl\":[");
+    for(int j=0;j<N_INSTANCES;j++) {
+        float fppl = fr->fppl[j];
+        mprintf("%s%d.%01d", (j==0)?"":",",
+               (int)fppl, abs((int)(10*(fppl-(int)fppl))));
+    }
+    mprintf("]");
+    mprintf(",\"pd\":[");
+    for(int j=0;j<N_INSTANCES-1;j++) {
+        mprintf((fr->pd[j] < 0)?"%s-%d.%03d":"%s%d.%03d",
+                (j==0)?"":",",
+                abs((int)fr->pd[j]), abs((int)(1000*(fr->pd[j]-(int)fr->pd[j]))));
+    }
+    mprintf("],\"dlen\":%d", DLEN);
+    mprintf(",\"d\":\"");
+    for (int i=0;i<DLEN;i++) {
+        mprintf("%02x", fr->d[i]);
+    }
+    mprintf("\"");
+    mprintf("}");
+    return g_out_len;
+}
+
+static void
+fmt_flush(struct lstnr_fmt *f, const char *buf, int len)
+{
+    out_write(buf, len);
+}
+
+/* The same record as main.c builds it */
+static int
+fmt_record(const struct frame *fr)
+{
+    static char output_buffer[1024];
+    struct lstnr_fmt f;
+    int j;
+
+    g_out_len = 0;
+    lstnr_fmt_init(&f, output_buffer, sizeof(output_buffer), fmt_flush, NULL);
+    lstnr_fmt_str(&f, "{\"utime\":");
+    lstnr_fmt_uint(&f, fr->utime);
+    lstnr_fmt_str(&f, ",\"ts\":[");
+    for (j = 0; j < N_INSTANCES; j++) {
+        if (j) {
+            lstnr_fmt_char(&f, ',');
+        }
+        lstnr_fmt_uint(&f, fr->ts[j]);
+    }
+    lstnr_fmt_char(&f, ']');
+    lstnr_fmt_str(&f, ",\"rssi\":[");
+    for (j = 0; j < N_INSTANCES; j++) {
+        if (j) {
+            lstnr_fmt_char(&f, ',');
+        }
+        lstnr_fmt_float(&f, fr->rssi[j], 1);
+    }
+    lstnr_fmt_str(&f, "],\"fppl\":[");
+    for (j = 0; j < N_INSTANCES; j++) {
+        if (j) {
+            lstnr_fmt_char(&f, ',');
+        }
+        lstnr_fmt_float(&f, fr->fppl[j], 1);
+    }
+    lstnr_fmt_char(&f, ']');
+    lstnr_fmt_str(&f, ",\"pd\":[");
+    for (j = 0; j < N_INSTANCES - 1; j++) {
+        if (j) {
+            lstnr_fmt_char(&f, ',');
+        }
+        lstnr_fmt_float(&f, fr->pd[j], 3);
+    }
+    lstnr_fmt_str(&f, "],\"dlen\":");
+    lstnr_fmt_uint(&f, DLEN);
+    lstnr_fmt_str(&f, ",\"d\":\"");
+    lstnr_fmt_hex(&f, fr->d, DLEN);
+    lstnr_fmt_char(&f, '"');
+    lstnr_fmt_char(&f, '}');
+    lstnr_fmt_finish(&f);
+    return g_out_len;
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char **argv)
+{
+    static struct frame fr = {
+        .utime = 32240936,
+        .ts = {959949481290ULL, 959949481357ULL},
+        .rssi = {-84.06f, -85.72f},
+        .fppl = {-85.31f, -86.94f},
+        .pd = {-1.267f},
+    };
+    long n = (argc > 1) ? atol(argv[1]) : 200000;
+    volatile int sink = 0;
+    double t0, t_fmt, t_printf;
+    long i;
+
+    for (i = 0; i < DLEN; i++) {
+        fr.d[i] = i * 37;
+    }
+
+    printf("lstnr_fmt: %.*s\n", fmt_record(&fr), g_out);
+    printf("mprintf:   %.*s\n", mprintf_record(&fr), g_out);
+
+    t0 = now_ns();
+    for (i = 0; i < n; i++) {
+        sink += fmt_record(&fr);
+    }
+    t_fmt = (now_ns() - t0) / n;
+
+    t0 = now_ns();
+    for (i = 0; i < n; i++) {
+        sink += mprintf_record(&fr);
+    }
+    t_printf = (now_ns() - t0) / n;
+
+    printf("lstnr_fmt %8.1f ns/record %10.0f records/s\n", t_fmt, 1e9 / t_fmt);
+    printf("mprintf   %8.1f ns/record %10.0f records/s\n", t_printf, 1e9 / t_printf);
+    printf("speedup   %8.1fx\n", t_printf / t_fmt);
+    return (sink == 0);
+}
@@ -0,0 +1,124 @@
+#!/usr/bin/env python
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+# Turn the binary output of the listener (lstnr/verbose with 0x2000 set)
+# into a pcap file. Records arrive slip framed on the serial console or
+# several to a datagram over udp and are written out behind a pcap header of
+# link type IEEE802_15_4_TAP.
+#
+#   ./lstnr_pcap.py /dev/ttyACM0 -b 1000000 -o capture.pcap
+#   ./lstnr_pcap.py -u 8787 -o - | wireshark -k -i -
+#
+import sys, argparse
+import struct
+import socket
+
+SLIP_END = 0xC0
+SLIP_ESC = 0xDB
+SLIP_ESC_END = 0xDC
+SLIP_ESC_ESC = 0xDD
+SLIP_ESC_LF = 0xDE
+SLIP_ESC_CR = 0xDF
+SLIP_UNESC = {SLIP_ESC_END: SLIP_END, SLIP_ESC_ESC: SLIP_ESC,
+              SLIP_ESC_LF: 0x0A, SLIP_ESC_CR: 0x0D}
+
+LINKTYPE_IEEE802_15_4_TAP = 283
+PCAP_HEADER = struct.pack('<IHHiIII', 0xa1b2c3d4, 2, 4, 0, 0, 65535,
+                          LINKTYPE_IEEE802_15_4_TAP)
+REC = struct.Struct('<IIII')
+
+def slip_frames(read):
+    frame = bytearray()
+    esc = False
+    while True:
+        data = read()
+        if not data:
+            return
+        for c in data:
+            if c == SLIP_END:
+                if frame:
+                    yield bytes(frame)
+                frame = bytearray()
+                esc = False
+            elif esc:
+                frame.append(SLIP_UNESC.get(c, c))
+                esc = False
+            elif c == SLIP_ESC:
+                esc = True
+            else:
+                frame.append(c)
+
+def udp_frames(port):
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    s.bind(('', port))
+    while True:
+        d = s.recv(65535)
+        off = 0
+        while off + REC.size <= len(d):
+            incl_len = REC.unpack_from(d, off)[2]
+            yield d[off:off + REC.size + incl_len]
+            off += REC.size + incl_len
+        if off < len(d):
+            yield d[off:]
+
+def valid(rec):
+    if len(rec) < REC.size:
+        return False
+    _, _, incl_len, _ = REC.unpack_from(rec)
+    return incl_len == len(rec) - REC.size
+
+def main():
+    parser = argparse.ArgumentParser(description='Listener binary output to pcap')
+    parser.add_argument('infile', nargs='?', help='serial port or raw capture')
+    parser.add_argument('-b', '--baud', type=int, default=1000000)
+    parser.add_argument('-u', '--udp', type=int, help='listen on this udp port instead')
+    parser.add_argument('-o', '--out', default='-', help='pcap file, - for stdout')
+    args = parser.parse_args()
+
+    if args.udp:
+        frames = udp_frames(args.udp)
+    elif args.infile and args.infile.startswith('/dev/'):
+        import serial
+        ser = serial.Serial(args.infile, args.baud)
+        frames = slip_frames(lambda: ser.read(max(1, ser.in_waiting)))
+    elif args.infile:
+        f = open(args.infile, 'rb')
+        frames = slip_frames(lambda: f.read(4096))
+    else:
+        parser.error('need a serial port, a file or --udp')
+
+    out = sys.stdout.buffer if args.out == '-' else open(args.out, 'wb')
+    out.write(PCAP_HEADER)
+    bad = 0
+    try:
+        for rec in frames:
+            # Console text between frames shows up as short garbage
+            if not valid(rec):
+                bad += 1
+                continue
+            out.write(rec)
+            out.flush()
+    except KeyboardInterrupt:
+        pass
+    if bad:
+        print("{} bad records".format(bad), file=sys.stderr)
+
+if __name__ == '__main__':
+    main()
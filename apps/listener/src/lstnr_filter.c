@@ -0,0 +1,178 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Capture filter, evaluated in the rx callback before a frame takes an
+ * mbuf. Set as lstnr/filter, rules separated by '|', each a ',' separated
+ * list of terms:
+ *
+ *   fc=<hex>[/<mask>]    frame control
+ *   pan=<hex>[/<mask>]   destination pan id
+ *   dst=<hex>[/<mask>]   short destination address
+ *   src=<hex>[/<mask>]   short source address
+ *   code=<hex>[/<mask>]  uwb-core frame code following the addresses
+ *   rssi=<dBm>           minimum rssi
+ *
+ * e.g. "code=6003,rssi=-95|src=1234". Fields are taken at the offsets of
+ * the short address, pan id compressed header all uwb-core frames use. A
+ * frame too short for a field doesn't match it.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <uwb/uwb.h>
+#include "lstnr_filter.h"
+
+static const struct {
+    const char *key;
+    uint8_t offset;
+} g_fields[LSTNR_FILTER_FIELDS] = {
+    {"fc", 0},
+    {"pan", 3},
+    {"dst", 5},
+    {"src", 7},
+    {"code", 9},
+};
+
+/* Parse one key=value term of a rule */
+static int
+compile_term(const char *s, int len, struct lstnr_filter_rule *r)
+{
+    char term[24];
+    char *val, *end;
+    uint32_t v, mask = 0xffff;
+    long rssi;
+
+    if (len <= 0 || len >= sizeof(term)) {
+        return -1;
+    }
+    memcpy(term, s, len);
+    term[len] = 0;
+    val = strchr(term, '=');
+    if (!val) {
+        return -1;
+    }
+    *val++ = 0;
+
+    if (!strcmp(term, "rssi")) {
+        rssi = strtol(val, &end, 10);
+        if (end == val || *end || rssi < -200 || rssi > 100) {
+            return -1;
+        }
+        r->min_rssi = rssi;
+        return 0;
+    }
+    for (int i = 0; i < LSTNR_FILTER_FIELDS; i++) {
+        if (strcmp(term, g_fields[i].key)) {
+            continue;
+        }
+        v = strtoul(val, &end, 16);
+        if (end != val && *end == '/') {
+            val = end + 1;
+            mask = strtoul(val, &end, 16);
+        }
+        if (end == val || *end || v > 0xffff || mask > 0xffff) {
+            return -1;
+        }
+        r->fields |= 1 << i;
+        r->mask[i] = mask;
+        r->val[i] = v & mask;
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * Compile a filter string, see above, into flt. An empty string gives a
+ * filter passing everything.
+ *
+ * @return 0 on success, -1 if s is malformed or has too many rules, flt
+ *         is then left alone
+ */
+int
+lstnr_filter_compile(const char *s, struct lstnr_filter *flt)
+{
+    struct lstnr_filter tmp = {0};
+    struct lstnr_filter_rule *r;
+    const char *end;
+
+    while (*s) {
+        if (tmp.num_rules == LSTNR_FILTER_RULES) {
+            return -1;
+        }
+        r = &tmp.rules[tmp.num_rules++];
+        r->min_rssi = INT16_MIN;
+        while (*s && *s != '|') {
+            end = s + strcspn(s, ",|");
+            if (compile_term(s, end - s, r)) {
+                return -1;
+            }
+            s = (*end == ',') ? end + 1 : end;
+        }
+        if (r->min_rssi != INT16_MIN) {
+            tmp.uses_rssi = true;
+        }
+        if (*s == '|') {
+            s++;
+        }
+    }
+    *flt = tmp;
+    return 0;
+}
+
+static bool
+rule_match(const struct lstnr_filter_rule *r, const uint8_t *buf, int len,
+           float rssi)
+{
+    for (int i = 0; i < LSTNR_FILTER_FIELDS; i++) {
+        int off = g_fields[i].offset;
+        if (!(r->fields & (1 << i))) {
+            continue;
+        }
+        if (len < off + 2 ||
+            ((buf[off] | (buf[off + 1] << 8)) & r->mask[i]) != r->val[i]) {
+            return false;
+        }
+    }
+    return r->min_rssi == INT16_MIN || rssi >= r->min_rssi;
+}
+
+/**
+ * Check a received frame against the filter. The rssi is only computed,
+ * from inst->rxdiag, if a rule asks for it.
+ */
+bool
+lstnr_filter_match(const struct lstnr_filter *flt, const uint8_t *buf,
+                   int len, struct uwb_dev *inst)
+{
+    float rssi = 0;
+
+    if (flt->num_rules == 0) {
+        return true;
+    }
+    if (flt->uses_rssi) {
+        rssi = uwb_calc_rssi(inst, inst->rxdiag);
+    }
+    for (int i = 0; i < flt->num_rules; i++) {
+        if (rule_match(&flt->rules[i], buf, len, rssi)) {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,58 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _LSTNR_FILTER_H_
+#define _LSTNR_FILTER_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LSTNR_FILTER_RULES  (4)
+#define LSTNR_FILTER_FIELDS (5)     /* fc, pan, dst, src, code */
+
+struct uwb_dev;
+
+/* A rule matches when all the fields it uses match, a frame passes when
+ * any rule matches or there are no rules */
+struct lstnr_filter_rule {
+    uint8_t fields;                         /**< Bit per field used */
+    uint16_t val[LSTNR_FILTER_FIELDS];      /**< Already masked */
+    uint16_t mask[LSTNR_FILTER_FIELDS];
+    int16_t min_rssi;                       /**< dBm, INT16_MIN if unused */
+};
+
+struct lstnr_filter {
+    uint8_t num_rules;
+    bool uses_rssi;
+    struct lstnr_filter_rule rules[LSTNR_FILTER_RULES];
+};
+
+int lstnr_filter_compile(const char *s, struct lstnr_filter *flt);
+bool lstnr_filter_match(const struct lstnr_filter *flt, const uint8_t *buf,
+                        int len, struct uwb_dev *inst);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LSTNR_FILTER_H_ */
@@ -0,0 +1,201 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Integer only text formatting for the listener's json output. A record
+ * is built in one buffer with table driven digit conversion instead of
+ * a vsnprintf per field.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "lstnr_fmt.h"
+
+static const char g_hex[] = "0123456789abcdef";
+
+static const char g_digits2[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint32_t g_pow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+void
+lstnr_fmt_init(struct lstnr_fmt *f, char *buf, int size,
+               lstnr_fmt_flush_fn *flush, void *arg)
+{
+    f->buf = buf;
+    f->len = 0;
+    f->size = size;
+    f->flush = flush;
+    f->arg = arg;
+}
+
+/* Hand what has been collected so far to flush */
+void
+lstnr_fmt_finish(struct lstnr_fmt *f)
+{
+    if (f->len) {
+        f->flush(f, f->buf, f->len);
+        f->len = 0;
+    }
+}
+
+/* Room for n more bytes, n must not exceed the buffer size */
+static char *
+fmt_reserve(struct lstnr_fmt *f, int n)
+{
+    char *p;
+
+    if (f->len + n > f->size) {
+        lstnr_fmt_finish(f);
+    }
+    p = f->buf + f->len;
+    f->len += n;
+    return p;
+}
+
+void
+lstnr_fmt_str(struct lstnr_fmt *f, const char *s)
+{
+    int n = strlen(s);
+
+    while (n > f->size) {
+        lstnr_fmt_finish(f);
+        f->flush(f, s, f->size);
+        s += f->size;
+        n -= f->size;
+    }
+    memcpy(fmt_reserve(f, n), s, n);
+}
+
+void
+lstnr_fmt_char(struct lstnr_fmt *f, char c)
+{
+    *fmt_reserve(f, 1) = c;
+}
+
+/* Write v with at least min_digits digits, zero padded */
+static void
+fmt_uint_pad(struct lstnr_fmt *f, uint64_t v, int min_digits)
+{
+    char tmp[20];
+    char *t = tmp + sizeof(tmp);
+    int n;
+
+    while (v >= 100) {
+        uint32_t i = (v % 100) * 2;
+        v /= 100;
+        *--t = g_digits2[i + 1];
+        *--t = g_digits2[i];
+    }
+    if (v >= 10) {
+        *--t = g_digits2[v * 2 + 1];
+        *--t = g_digits2[v * 2];
+    } else {
+        *--t = '0' + v;
+    }
+    while (t > tmp && tmp + sizeof(tmp) - t < min_digits) {
+        *--t = '0';
+    }
+
+    n = tmp + sizeof(tmp) - t;
+    memcpy(fmt_reserve(f, n), t, n);
+}
+
+void
+lstnr_fmt_uint(struct lstnr_fmt *f, uint64_t v)
+{
+    fmt_uint_pad(f, v, 1);
+}
+
+void
+lstnr_fmt_int(struct lstnr_fmt *f, int64_t v)
+{
+    if (v < 0) {
+        lstnr_fmt_char(f, '-');
+        fmt_uint_pad(f, -(uint64_t)v, 1);
+    } else {
+        fmt_uint_pad(f, v, 1);
+    }
+}
+
+/**
+ * Write v/10^decimals as a decimal number, i.e. v=-1234, decimals=3
+ * gives -1.234
+ */
+void
+lstnr_fmt_fixed(struct lstnr_fmt *f, int32_t v, int decimals)
+{
+    uint32_t u = (v < 0) ? -(uint32_t)v : v;
+    uint32_t div = g_pow10[decimals];
+
+    if (v < 0) {
+        lstnr_fmt_char(f, '-');
+    }
+    fmt_uint_pad(f, u / div, 1);
+    if (decimals) {
+        lstnr_fmt_char(f, '.');
+        fmt_uint_pad(f, u % div, decimals);
+    }
+}
+
+/**
+ * Write v rounded to decimals, at most 6, places. Values beyond
+ * +-2^31/10^decimals are clamped.
+ */
+void
+lstnr_fmt_float(struct lstnr_fmt *f, float v, int decimals)
+{
+    uint32_t div = g_pow10[decimals];
+    float a = fabsf(v) * div + 0.5f;
+    uint32_t u = (a < 2147483647.0f) ? (uint32_t)a : 2147483647;
+
+    if (v < 0 && u) {
+        lstnr_fmt_char(f, '-');
+    }
+    fmt_uint_pad(f, u / div, 1);
+    if (decimals) {
+        lstnr_fmt_char(f, '.');
+        fmt_uint_pad(f, u % div, decimals);
+    }
+}
+
+/* Write data as two lower case hex digits per byte */
+void
+lstnr_fmt_hex(struct lstnr_fmt *f, const uint8_t *data, int len)
+{
+    while (len) {
+        int n = (len * 2 > f->size) ? f->size / 2 : len;
+        char *p = fmt_reserve(f, n * 2);
+        for (int i = 0; i < n; i++) {
+            *p++ = g_hex[data[i] >> 4];
+            *p++ = g_hex[data[i] & 0xf];
+        }
+        data += n;
+        len -= n;
+    }
+}
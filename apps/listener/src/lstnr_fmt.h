@@ -0,0 +1,58 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _LSTNR_FMT_H_
+#define _LSTNR_FMT_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct lstnr_fmt;
+typedef void lstnr_fmt_flush_fn(struct lstnr_fmt *f, const char *buf, int len);
+
+/* Record builder, text is collected in buf and handed to flush when buf
+ * is full and at lstnr_fmt_finish, i.e. once per record unless it is
+ * larger than buf */
+struct lstnr_fmt {
+    char *buf;
+    int len;
+    int size;
+    lstnr_fmt_flush_fn *flush;
+    void *arg;
+};
+
+void lstnr_fmt_init(struct lstnr_fmt *f, char *buf, int size,
+                    lstnr_fmt_flush_fn *flush, void *arg);
+void lstnr_fmt_finish(struct lstnr_fmt *f);
+void lstnr_fmt_str(struct lstnr_fmt *f, const char *s);
+void lstnr_fmt_char(struct lstnr_fmt *f, char c);
+void lstnr_fmt_uint(struct lstnr_fmt *f, uint64_t v);
+void lstnr_fmt_int(struct lstnr_fmt *f, int64_t v);
+void lstnr_fmt_fixed(struct lstnr_fmt *f, int32_t v, int decimals);
+void lstnr_fmt_float(struct lstnr_fmt *f, float v, int decimals);
+void lstnr_fmt_hex(struct lstnr_fmt *f, const uint8_t *data, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _LSTNR_FMT_H_ */
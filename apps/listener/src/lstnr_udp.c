@@ -0,0 +1,220 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Udp output of the listener. Finished records are collected into one
+ * datagram for lstnr/udp_tx_addr:udp_tx_port, which is sent once
+ * another record would take it past LSTNR_UDP_MTU bytes or its first
+ * record is LSTNR_UDP_FLUSH_MS old. A record longer than LSTNR_UDP_MTU
+ * goes out on its own. The socket is opened once at init. Only called
+ * from the default eventq, the rx queue event and the flush callout.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <os/mynewt.h>
+
+#if MYNEWT_VAL(ETH_0)
+#include <console/console.h>
+#include <stats/stats.h>
+#include <mn_socket/mn_socket.h>
+#include "lstnr_udp.h"
+
+#define UDP_MTU         MYNEWT_VAL(LSTNR_UDP_MTU)
+#define UDP_FLUSH_TICKS ((MYNEWT_VAL(LSTNR_UDP_FLUSH_MS) * OS_TICKS_PER_SEC + 999) / 1000)
+
+STATS_SECT_START(lstnr_udp_stats)
+    STATS_SECT_ENTRY(tx)
+    STATS_SECT_ENTRY(tx_err)
+    STATS_SECT_ENTRY(tx_full)
+    STATS_SECT_ENTRY(tx_timeout)
+    STATS_SECT_ENTRY(rec)
+    STATS_SECT_ENTRY(rec_drop)
+    STATS_SECT_ENTRY(rec_last)
+    STATS_SECT_ENTRY(rec_max)
+STATS_SECT_END
+
+STATS_NAME_START(lstnr_udp_stats)
+    STATS_NAME(lstnr_udp_stats, tx)
+    STATS_NAME(lstnr_udp_stats, tx_err)
+    STATS_NAME(lstnr_udp_stats, tx_full)
+    STATS_NAME(lstnr_udp_stats, tx_timeout)
+    STATS_NAME(lstnr_udp_stats, rec)
+    STATS_NAME(lstnr_udp_stats, rec_drop)
+    STATS_NAME(lstnr_udp_stats, rec_last)
+    STATS_NAME(lstnr_udp_stats, rec_max)
+STATS_NAME_END(lstnr_udp_stats)
+
+static STATS_SECT_DECL(lstnr_udp_stats) g_udp_stats;
+
+#define UDP_STATS_SET(_f, _v)                   \
+    do {                                        \
+        STATS_CLEAR(g_udp_stats, _f);           \
+        STATS_INCN(g_udp_stats, _f, (_v));      \
+    } while (0)
+
+static struct mn_socket *g_udp_socket = NULL;
+static struct mn_sockaddr_in g_udp_dest;
+static struct os_mbuf *g_udp_om = NULL;     /* Datagram being collected */
+static uint16_t g_udp_nrec;                 /* Records in it */
+static uint16_t g_udp_nrec_max;
+static struct os_callout g_udp_callout;
+
+static void
+udp_readable(void *arg, int err)
+{
+    /* Print any incoming data to console */
+    struct os_mbuf *m = NULL;
+    struct os_mbuf *n;
+    struct mn_sockaddr_in6 from;
+
+    if (mn_recvfrom(g_udp_socket, &m, (struct mn_sockaddr*)&from) != 0) {
+        return;
+    }
+    for (n = m; n; n = SLIST_NEXT(n, om_next)) {
+        console_write((const char*)n->om_data, n->om_len);
+    }
+    os_mbuf_free_chain(m);
+}
+
+static void
+udp_writable(void *arg, int err)
+{
+    // Do nothing
+}
+
+static const union mn_socket_cb g_udp_cbs = {
+    .socket.readable = udp_readable,
+    .socket.writable = udp_writable
+};
+
+static void
+udp_timeout_cb(struct os_event *ev)
+{
+    if (g_udp_om) {
+        STATS_INC(g_udp_stats, tx_timeout);
+    }
+    lstnr_udp_flush();
+}
+
+/**
+ * Send the datagram being collected, if any.
+ */
+void
+lstnr_udp_flush(void)
+{
+    struct os_mbuf *om = g_udp_om;
+
+    os_callout_stop(&g_udp_callout);
+    if (!om) {
+        return;
+    }
+    g_udp_om = NULL;
+    UDP_STATS_SET(rec_last, g_udp_nrec);
+    if (g_udp_nrec > g_udp_nrec_max) {
+        g_udp_nrec_max = g_udp_nrec;
+        UDP_STATS_SET(rec_max, g_udp_nrec_max);
+    }
+    g_udp_nrec = 0;
+
+    if (!g_udp_socket || g_udp_dest.msin_addr.s_addr == 0 ||
+        mn_sendto(g_udp_socket, om, (struct mn_sockaddr *)&g_udp_dest) != 0) {
+        STATS_INC(g_udp_stats, tx_err);
+        os_mbuf_free_chain(om);
+        return;
+    }
+    STATS_INC(g_udp_stats, tx);
+}
+
+/**
+ * Add a finished record to the datagram being collected. Takes ownership
+ * of rec.
+ *
+ * @param rec Record, a chain with a packet header
+ */
+void
+lstnr_udp_send(struct os_mbuf *rec)
+{
+    int len = OS_MBUF_PKTLEN(rec);
+    int off;
+
+    if (g_udp_om && OS_MBUF_PKTLEN(g_udp_om) + len > UDP_MTU) {
+        STATS_INC(g_udp_stats, tx_full);
+        lstnr_udp_flush();
+    }
+
+    if (!g_udp_om) {
+        /* The first record becomes the datagram */
+        g_udp_om = rec;
+        g_udp_nrec = 1;
+        os_callout_reset(&g_udp_callout, UDP_FLUSH_TICKS);
+    } else {
+        off = OS_MBUF_PKTLEN(g_udp_om);
+        if (os_mbuf_appendfrom(g_udp_om, rec, 0, len) != 0) {
+            /* Take the partial record back out again */
+            os_mbuf_adj(g_udp_om, off - OS_MBUF_PKTLEN(g_udp_om));
+            os_mbuf_free_chain(rec);
+            STATS_INC(g_udp_stats, rec_drop);
+            return;
+        }
+        os_mbuf_free_chain(rec);
+        g_udp_nrec++;
+    }
+    STATS_INC(g_udp_stats, rec);
+
+    if (OS_MBUF_PKTLEN(g_udp_om) >= UDP_MTU) {
+        STATS_INC(g_udp_stats, tx_full);
+        lstnr_udp_flush();
+    }
+}
+
+/**
+ * Set where datagrams go, 0.0.0.0 drops them.
+ *
+ * @param addr Ipv4 address, network byte order
+ * @param port Port, host byte order
+ */
+void
+lstnr_udp_set_dest(uint32_t addr, uint16_t port)
+{
+    memset(&g_udp_dest, 0, sizeof(g_udp_dest));
+    g_udp_dest.msin_len = sizeof(g_udp_dest);
+    g_udp_dest.msin_family = MN_AF_INET;
+    g_udp_dest.msin_port = htons(port);
+    g_udp_dest.msin_addr.s_addr = addr;
+}
+
+void
+lstnr_udp_init(void)
+{
+    int rc;
+
+    rc = stats_init_and_reg(
+        STATS_HDR(g_udp_stats), STATS_SIZE_INIT_PARMS(g_udp_stats,
+        STATS_SIZE_32), STATS_NAME_INIT_PARMS(lstnr_udp_stats), "lstnr_udp");
+    assert(rc == 0);
+
+    os_callout_init(&g_udp_callout, os_eventq_dflt_get(), udp_timeout_cb, NULL);
+
+    rc = mn_socket(&g_udp_socket, MN_PF_INET, MN_SOCK_DGRAM, 0);
+    assert(rc == 0);
+    mn_socket_set_cbs(g_udp_socket, NULL, &g_udp_cbs);
+}
+
+#endif
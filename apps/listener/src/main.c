@@ -36,6 +36,9 @@
 
 #include "console/console.h"
 #include <config/config.h>
+#include "lstnr_fmt.h"
+#include "lstnr_filter.h"
+#include "lstnr_udp.h"
 
 #if MYNEWT_VAL(ETH_0)
 #include <lwip/tcpip.h>
@@ -45,43 +48,6 @@
 
 uint32_t udp_tx_addr;
 uint16_t udp_tx_port;
-static struct mn_socket *net_udp_socket = 0;
-static struct mn_sockaddr_in net_sin;
-static struct mn_sockaddr_in *net_sinp;
-
-static void net_test_readable(void *arg, int err)
-{
-    /* Print any incoming data to console */
-    int rc = 0;
-    struct os_mbuf *m = 0;
-    struct mn_sockaddr_in6 from;
-
-    rc = mn_recvfrom(net_udp_socket, &m, (struct mn_sockaddr*)&from);
-    assert(rc == 0);
-    if (m) {
-        uint8_t buf[32];
-        int off = 0;
-        int len = os_mbuf_len(m);
-        int to_read;
-        while (off < len) {
-            to_read = (len-off < sizeof(buf))? len-off : sizeof(buf);
-            os_mbuf_copydata(m, off, len, buf);
-            console_write((const char*)buf, to_read);
-            off += to_read;
-        }
-        os_mbuf_free_chain(m);
-    }
-}
-
-static void net_test_writable(void *arg, int err)
-{
-    // Do nothing
-}
-
-static const union mn_socket_cb net_test_cbs = {
-    .socket.readable = net_test_readable,
-    .socket.writable = net_test_writable
-};
 
 static int
 lwip_nif_up(const char *name)
@@ -138,10 +104,14 @@ static struct lstnr_config {
     uint16_t verbose;
 } local_conf = {0};
 
+/* Capture filter compiled from lstnr/filter, see lstnr_filter.c */
+static struct lstnr_filter g_filter;
+
 #define VERBOSE_CARRIER_INTEGRATOR (0x0001)
 #define VERBOSE_RX_DIAG            (0x0002)
 #define VERBOSE_CIR                (0x0004)
 #define VERBOSE_NOT_TO_CONSOLE     (0x1000)
+#define VERBOSE_PCAP               (0x2000)
 
 static char *lstnr_get(int argc, char **argv, char *val, int val_len_max);
 static int lstnr_set(int argc, char **argv, char *val);
@@ -152,6 +122,7 @@ static int lstnr_export(void (*export_func)(char *name, char *val),
 static struct lstnr_config_s {
     char acc_samples[8];
     char verbose[8];
+    char filter[96];
 #if MYNEWT_VAL(ETH_0)
     char udp_tx_addr[16];
     char udp_tx_port[8];
@@ -159,6 +130,7 @@ static struct lstnr_config_s {
 } lstnr_config = {
     .acc_samples = MYNEWT_VAL(CIR_NUM_SAMPLES),
     .verbose = "0x0",
+    .filter = "",
 #if MYNEWT_VAL(ETH_0)
     .udp_tx_addr="192.168.10.255",
     .udp_tx_port="8787"
@@ -179,6 +151,7 @@ lstnr_get(int argc, char **argv, char *val, int val_len_max)
     if (argc == 1) {
         if (!strcmp(argv[0], "acc_samples"))  return lstnr_config.acc_samples;
         if (!strcmp(argv[0], "verbose"))  return lstnr_config.verbose;
+        if (!strcmp(argv[0], "filter"))  return lstnr_config.filter;
 #if MYNEWT_VAL(ETH_0)
         if (!strcmp(argv[0], "udp_tx_addr"))  return lstnr_config.udp_tx_addr;
         if (!strcmp(argv[0], "udp_tx_port"))  return lstnr_config.udp_tx_port;
@@ -197,6 +170,9 @@ lstnr_set(int argc, char **argv, char *val)
         if (!strcmp(argv[0], "verbose")) {
             return CONF_VALUE_SET(val, CONF_STRING, lstnr_config.verbose);
         }
+        if (!strcmp(argv[0], "filter")) {
+            return CONF_VALUE_SET(val, CONF_STRING, lstnr_config.filter);
+        }
 #if MYNEWT_VAL(ETH_0)
         if (!strcmp(argv[0], "udp_tx_addr")) {
             return CONF_VALUE_SET(val, CONF_STRING, lstnr_config.udp_tx_addr);
@@ -222,6 +198,16 @@ lstnr_commit(void)
     conf_value_from_str(lstnr_config.verbose, CONF_INT16,
                         (void*)&(local_conf.verbose), 0);
 
+    struct lstnr_filter flt;
+    if (lstnr_filter_compile(lstnr_config.filter, &flt)) {
+        console_printf("Invalid filter %s\n", lstnr_config.filter);
+    } else {
+        os_sr_t sr;
+        OS_ENTER_CRITICAL(sr);
+        g_filter = flt;
+        OS_EXIT_CRITICAL(sr);
+    }
+
 #if MYNEWT_VAL(ETH_0)
     if (mn_inet_pton(MN_AF_INET, lstnr_config.udp_tx_addr, &udp_tx_addr) != 1) {
         console_printf("Invalid udp address %s\n", lstnr_config.udp_tx_addr);
@@ -229,13 +215,7 @@ lstnr_commit(void)
     }
     conf_value_from_str(lstnr_config.udp_tx_port, CONF_INT16,
                         (void*)&(udp_tx_port), 0);
-
-    memset(&net_sin, 0, sizeof(net_sin));
-    net_sin.msin_len = sizeof(net_sin);
-    net_sin.msin_family = MN_AF_INET;
-    net_sin.msin_port = htons(udp_tx_port);
-    net_sin.msin_addr.s_addr = udp_tx_addr;
-    net_sinp = &net_sin;
+    lstnr_udp_set_dest(udp_tx_addr, udp_tx_port);
 #endif
 
     uwb_config_updated();
@@ -248,6 +228,7 @@ lstnr_export(void (*export_func)(char *name, char *val),
 {
     export_func("lstnr/acc_samples", lstnr_config.acc_samples);
     export_func("lstnr/verbose", lstnr_config.verbose);
+    export_func("lstnr/filter", lstnr_config.filter);
 #if MYNEWT_VAL(ETH_0)
     export_func("lstnr/udp_tx_addr", lstnr_config.udp_tx_addr);
     export_func("lstnr/udp_tx_port", lstnr_config.udp_tx_port);
@@ -256,19 +237,34 @@ lstnr_export(void (*export_func)(char *name, char *val),
 }
 
 
+#ifdef MYNEWT_VAL_PDOA_SPI_NUM_INSTANCES
+#define N_RX_INSTANCES MYNEWT_VAL(PDOA_SPI_NUM_INSTANCES)
+#else
+#define N_RX_INSTANCES N_DW_INSTANCES
+#endif
+
+/* Fixed point copy of what the output needs from a receiver's rxdiag,
+ * decoded once in the rx callback */
+#define DIAG_NONE (INT16_MIN)
+struct lstnr_diag {
+    int16_t rssi;           /**< dBm*10, DIAG_NONE if out of range */
+    int16_t fppl;           /**< First path power level, dBm*10 */
+    int16_t pdoa;           /**< Single receiver pdoa, mrad, DIAG_NONE if nan */
+};
+
 /* Incoming messages mempool and queue */
 struct uwb_msg_hdr {
     uint32_t utime;
     uint16_t dlen;
-    uint16_t diag_offset;
+    uint16_t diag_offset;   /**< Raw rxdiag, only kept for pcap output */
+    uint16_t diag_len;
     uint16_t cir_offset;
     int32_t  carrier_integrator;
+    uint64_t ts[N_RX_INSTANCES];
 #ifdef MYNEWT_VAL_PDOA_SPI_NUM_INSTANCES
-    uint64_t ts[MYNEWT_VAL(PDOA_SPI_NUM_INSTANCES)];
     struct _dw1000_dev_rxdiag_t diag[MYNEWT_VAL(PDOA_SPI_NUM_INSTANCES)];
-#else
-    uint64_t ts[N_DW_INSTANCES];
 #endif
+    struct lstnr_diag dd[N_RX_INSTANCES];
 #ifdef MYNEWT_VAL_PDOA_SPI_NUM_INSTANCES
     float    pd[MYNEWT_VAL(PDOA_SPI_NUM_INSTANCES)-1];
 #else
@@ -276,15 +272,6 @@ struct uwb_msg_hdr {
 #endif
 };
 
-#ifndef MYNEWT_VAL_PDOA_SPI_NUM_INSTANCES
-static struct {
-    union {
-        struct uwb_dev_rxdiag diag;
-        uint8_t diag_storage[MYNEWT_VAL(UWB_DEV_RXDIAG_MAXLEN)];
-    };
-} tmp_diag[N_DW_INSTANCES];
-#endif
-
 #define MBUF_PKTHDR_OVERHEAD    sizeof(struct os_mbuf_pkthdr) + sizeof(struct uwb_msg_hdr)
 #define MBUF_MEMBLOCK_OVERHEAD  sizeof(struct os_mbuf) + MBUF_PKTHDR_OVERHEAD
 
@@ -315,25 +302,24 @@ create_mbuf_pool(void)
     assert(rc == 0);
 }
 
-static char output_buffer[512];
-static int
-mprintf(struct os_mbuf *m, const char *fmt, ...)
+/* Json records are built here and written out once per record, see
+ * lstnr_fmt.c */
+static char output_buffer[1024];
+
+/* Write a finished record, or a buffer full of one, to the console and
+ * the udp datagram. The datagram is dropped if it can't be extended. */
+static void
+json_flush(struct lstnr_fmt *f, const char *buf, int len)
 {
-    int rc = 0;
-    va_list args;
-    int num_chars;
+    struct os_mbuf **m = (struct os_mbuf **)f->arg;
 
-    va_start(args, fmt);
-    num_chars = vsnprintf(output_buffer, sizeof(output_buffer)-10, fmt, args);
-    if (m) {
-        rc = os_mbuf_append(m, output_buffer, num_chars);
-        assert(rc==0);
+    if (*m && os_mbuf_append(*m, buf, len)) {
+        os_mbuf_free_chain(*m);
+        *m = NULL;
     }
     if ((local_conf.verbose&VERBOSE_NOT_TO_CONSOLE)==0) {
-        console_write(output_buffer, num_chars);
+        console_write(buf, len);
     }
-    va_end(args);
-    return num_chars;
 }
 
 #if MYNEWT_VAL(CIR_ENABLED)
@@ -345,7 +331,335 @@ static struct cir_dw3000_instance tmp_cir;
 #endif
 #endif
 static uint8_t print_buffer[1024];
-static uint8_t diag_buffer[1024];
+
+/* Binary output, VERBOSE_PCAP. Every frame becomes a pcap record of link
+ * type IEEE802_15_4_TAP, sent as is over udp and slip framed on the
+ * console. The tap header ahead of the frame carries the listener data
+ * as tlvs, types from 0x8000 are our own. scripts/lstnr_pcap.py adds the
+ * pcap file header. */
+#define PCAP_TLV_FCS_TYPE   (0)         /* uint8_t, 1 for a 16 bit fcs */
+#define PCAP_TLV_RSS        (1)         /* float, dBm, first receiver */
+#define PCAP_TLV_TS         (0x8001)    /* uint64_t[n], uwb timestamps */
+#define PCAP_TLV_RXDIAG     (0x8002)    /* n raw struct uwb_dev_rxdiag */
+#define PCAP_TLV_CI         (0x8003)    /* int32_t, carrier integrator */
+#define PCAP_TLV_PD         (0x8004)    /* float[], phase differences */
+#define PCAP_TLV_CIR        (0x8005)    /* n struct pcap_cir + samples */
+
+#define SLIP_END            (0xC0)
+#define SLIP_ESC            (0xDB)
+#define SLIP_ESC_END        (0xDC)
+#define SLIP_ESC_ESC        (0xDD)
+#define SLIP_ESC_LF         (0xDE)      /* 0x0A, the console adds \r before it */
+#define SLIP_ESC_CR         (0xDF)      /* 0x0D */
+
+struct pcap_rec {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+} __attribute__((packed));
+
+struct pcap_tap {
+    uint8_t version;
+    uint8_t reserved;
+    uint16_t length;            /**< Header and tlvs */
+} __attribute__((packed));
+
+struct pcap_cir {
+    int32_t offset;
+    float fp_idx;
+    float rcphase;
+    float angle;
+    int64_t raw_ts;
+    uint16_t num_samples;       /**< int16_t real, imag pairs following */
+    uint16_t reserved;
+} __attribute__((packed));
+
+/* Tlv header, the value of len bytes is appended after it */
+static int
+pcap_tlv_start(struct os_mbuf *m, uint16_t type, uint16_t len)
+{
+    uint16_t tl[2] = {type, len};
+    return os_mbuf_append(m, tl, sizeof(tl));
+}
+
+/* Pad the last tlv to a multiple of 4, records start aligned */
+static int
+pcap_tlv_end(struct os_mbuf *m)
+{
+    static const uint8_t pad[3] = {0};
+    int n = -OS_MBUF_PKTLEN(m) & 3;
+    return (n) ? os_mbuf_append(m, pad, n) : 0;
+}
+
+static int
+pcap_tlv(struct os_mbuf *m, uint16_t type, const void *val, uint16_t len)
+{
+    if (pcap_tlv_start(m, type, len) || os_mbuf_append(m, val, len)) {
+        return OS_ENOMEM;
+    }
+    return pcap_tlv_end(m);
+}
+
+/**
+ * Build the pcap record of a received frame in m
+ *
+ * @return 0 on success, OS_ENOMEM if m could not be extended
+ */
+static int
+pcap_record(struct os_mbuf *m, struct os_mbuf *om, struct uwb_msg_hdr *hdr,
+            int n_instances)
+{
+    struct pcap_rec rec = {
+        .ts_sec = hdr->utime / 1000000,
+        .ts_usec = hdr->utime % 1000000,
+    };
+    struct pcap_tap tap = {0};
+    uint8_t fcs_type = 1;
+    float pd[sizeof(hdr->pd)/sizeof(hdr->pd[0]) + 1];
+    int n_pd = 0;
+    int rc = 0;
+
+    rc |= os_mbuf_append(m, &rec, sizeof(rec));
+    rc |= os_mbuf_append(m, &tap, sizeof(tap));
+    rc |= pcap_tlv(m, PCAP_TLV_FCS_TYPE, &fcs_type, sizeof(fcs_type));
+    rc |= pcap_tlv(m, PCAP_TLV_TS, hdr->ts, n_instances * sizeof(hdr->ts[0]));
+
+    if ((local_conf.verbose&VERBOSE_RX_DIAG)) {
+#ifdef MYNEWT_VAL_PDOA_SPI_NUM_INSTANCES
+        rc |= pcap_tlv(m, PCAP_TLV_RXDIAG, hdr->diag, n_instances * sizeof(hdr->diag[0]));
+#else
+        rc |= pcap_tlv_start(m, PCAP_TLV_RXDIAG, hdr->diag_len);
+        rc |= os_mbuf_appendfrom(m, om, hdr->diag_offset, hdr->diag_len);
+        rc |= pcap_tlv_end(m);
+#endif
+        if (hdr->dd[0].rssi != DIAG_NONE) {
+            float rss = hdr->dd[0].rssi / 10.0f;
+            rc |= pcap_tlv(m, PCAP_TLV_RSS, &rss, sizeof(rss));
+        }
+    }
+    if (hdr->dd[0].pdoa != DIAG_NONE) {
+        pd[n_pd++] = hdr->dd[0].pdoa / 1000.0f;
+    }
+    if (hdr->carrier_integrator) {
+        rc |= pcap_tlv(m, PCAP_TLV_CI, &hdr->carrier_integrator,
+                       sizeof(hdr->carrier_integrator));
+    }
+    for(int j=0;j<n_instances-1;j++) {
+        pd[n_pd++] = hdr->pd[j];
+    }
+    if (n_pd) {
+        rc |= pcap_tlv(m, PCAP_TLV_PD, pd, n_pd * sizeof(pd[0]));
+    }
+#if MYNEWT_VAL(CIR_ENABLED)
+    if (local_conf.verbose&VERBOSE_CIR) {
+        int n = local_conf.acc_samples_to_load;
+        rc |= pcap_tlv_start(m, PCAP_TLV_CIR,
+                             n_instances * (sizeof(struct pcap_cir) + n * 2 * sizeof(int16_t)));
+        for(int j=0;j<n_instances;j++) {
+            os_mbuf_copydata(om, hdr->cir_offset + j*sizeof(tmp_cir), sizeof(tmp_cir), &tmp_cir);
+            struct pcap_cir c = {
+                .offset = tmp_cir.offset,
+                .fp_idx = tmp_cir.fp_idx,
+                .rcphase = tmp_cir.rcphase,
+                .angle = tmp_cir.angle,
+                .raw_ts = tmp_cir.raw_ts,
+                .num_samples = n,
+            };
+            rc |= os_mbuf_append(m, &c, sizeof(c));
+            for (int i=0;i<n;i++) {
+                int16_t iq[2] = {tmp_cir.cir.array[i].real, tmp_cir.cir.array[i].imag};
+                rc |= os_mbuf_append(m, iq, sizeof(iq));
+            }
+        }
+        rc |= pcap_tlv_end(m);
+    }
+#endif
+    tap.length = OS_MBUF_PKTLEN(m) - sizeof(rec);
+    rc |= os_mbuf_copyinto(m, sizeof(rec), &tap, sizeof(tap));
+
+    rc |= os_mbuf_appendfrom(m, om, 0, hdr->dlen);
+    rec.incl_len = rec.orig_len = OS_MBUF_PKTLEN(m) - sizeof(rec);
+    rc |= os_mbuf_copyinto(m, 0, &rec, sizeof(rec));
+    return (rc) ? OS_ENOMEM : 0;
+}
+
+/* Write m to the console as one slip frame. \n and \r are escaped as
+ * well, so the console can't turn \n into \r\n inside a frame. */
+static void
+slip_write_mbuf(struct os_mbuf *m)
+{
+    uint8_t buf[64];
+    int n = 0;
+
+    buf[n++] = SLIP_END;
+    for (; m; m = SLIST_NEXT(m, om_next)) {
+        for (int i=0;i<m->om_len;i++) {
+            uint8_t c = m->om_data[i];
+            if (n > sizeof(buf) - 2) {
+                console_write((const char*)buf, n);
+                n = 0;
+            }
+            switch (c) {
+            case SLIP_END:
+                buf[n++] = SLIP_ESC;
+                buf[n++] = SLIP_ESC_END;
+                break;
+            case SLIP_ESC:
+                buf[n++] = SLIP_ESC;
+                buf[n++] = SLIP_ESC_ESC;
+                break;
+            case '\n':
+                buf[n++] = SLIP_ESC;
+                buf[n++] = SLIP_ESC_LF;
+                break;
+            case '\r':
+                buf[n++] = SLIP_ESC;
+                buf[n++] = SLIP_ESC_CR;
+                break;
+            default:
+                buf[n++] = c;
+            }
+        }
+    }
+    if (n > sizeof(buf) - 1) {
+        console_write((const char*)buf, n);
+        n = 0;
+    }
+    buf[n++] = SLIP_END;
+    console_write((const char*)buf, n);
+}
+/* Fixed point value of a struct lstnr_diag, or null */
+static void
+json_diag(struct lstnr_fmt *f, int16_t v, int decimals)
+{
+    if (v == DIAG_NONE) {
+        lstnr_fmt_str(f, "null");
+    } else {
+        lstnr_fmt_fixed(f, v, decimals);
+    }
+}
+
+/* Phase difference, json can't handle Nan, but it can handle null */
+static void
+json_pd(struct lstnr_fmt *f, float v)
+{
+    if (isnan(v)) {
+        lstnr_fmt_str(f, "null");
+    } else {
+        lstnr_fmt_float(f, v, 3);
+    }
+}
+
+/* Render the json record of a received frame, its data in print_buffer */
+static void
+json_record(struct lstnr_fmt *f, struct os_mbuf *om, struct uwb_msg_hdr *hdr,
+            int n_instances)
+{
+    struct uwb_dev *udev = uwb_dev_idx_lookup(0);
+    int rc;
+
+    lstnr_fmt_str(f, "{\"utime\":");
+    lstnr_fmt_uint(f, hdr->utime);
+
+    lstnr_fmt_str(f, ",\"ts\":[");
+    for(int j=0;j<n_instances;j++) {
+        if (j) {
+            lstnr_fmt_char(f, ',');
+        }
+        lstnr_fmt_uint(f, hdr->ts[j]);
+    }
+    lstnr_fmt_char(f, ']');
+
+    if ((local_conf.verbose&VERBOSE_RX_DIAG)) {
+        lstnr_fmt_str(f, ",\"rssi\":[");
+        for(int j=0;j<n_instances;j++) {
+            if (j) {
+                lstnr_fmt_char(f, ',');
+            }
+            json_diag(f, hdr->dd[j].rssi, 1);
+        }
+        lstnr_fmt_str(f, "],\"fppl\":[");
+        for(int j=0;j<n_instances;j++) {
+            if (j) {
+                lstnr_fmt_char(f, ',');
+            }
+            json_diag(f, hdr->dd[j].fppl, 1);
+        }
+        lstnr_fmt_char(f, ']');
+    }
+    if (hdr->carrier_integrator && (local_conf.verbose&VERBOSE_CARRIER_INTEGRATOR)) {
+        float ccor = uwb_calc_clock_offset_ratio(udev, hdr->carrier_integrator, UWB_CR_CARRIER_INTEGRATOR);
+        lstnr_fmt_str(f, ",\"ccor\":");
+        lstnr_fmt_float(f, ccor*1000000.0f, 3);
+        lstnr_fmt_str(f, "e-6");
+    }
+    lstnr_fmt_str(f, ",\"pd\":[");
+    int n_pd = 0;
+    if (udev->capabilities.single_receiver_pdoa) {
+        json_diag(f, hdr->dd[0].pdoa, 3);
+        n_pd++;
+    }
+    for(int j=0;j<n_instances-1;j++) {
+        if (n_pd++) {
+            lstnr_fmt_char(f, ',');
+        }
+        json_pd(f, hdr->pd[j]);
+    }
+
+    lstnr_fmt_str(f, "],\"dlen\":");
+    lstnr_fmt_uint(f, hdr->dlen);
+    lstnr_fmt_str(f, ",\"d\":\"");
+    lstnr_fmt_hex(f, print_buffer, (hdr->dlen < sizeof(print_buffer)) ? hdr->dlen : sizeof(print_buffer));
+    lstnr_fmt_char(f, '"');
+#if MYNEWT_VAL(CIR_ENABLED)
+    if (local_conf.verbose&VERBOSE_CIR) {
+        lstnr_fmt_str(f, ",\"cir\":[");
+        for(int j=0;j<n_instances;j++) {
+#if MYNEWT_VAL(DW1000_DEVICE_0)
+            rc = os_mbuf_copydata(om, hdr->cir_offset + j*sizeof(struct cir_dw1000_instance), sizeof(struct cir_dw1000_instance), &tmp_cir);
+            struct cir_dw1000_instance* cirp = &tmp_cir;
+#endif
+#if MYNEWT_VAL(DW3000_DEVICE_0)
+            rc = os_mbuf_copydata(om, hdr->cir_offset + j*sizeof(struct cir_dw3000_instance), sizeof(struct cir_dw3000_instance), &tmp_cir);
+            struct cir_dw3000_instance* cirp = &tmp_cir;
+#endif
+            lstnr_fmt_str(f, (j==0) ? "{\"o\":" : ",{\"o\":");
+            lstnr_fmt_int(f, cirp->offset);
+            lstnr_fmt_str(f, ",\"fp_idx\":");
+            lstnr_fmt_float(f, cirp->fp_idx, 3);
+            lstnr_fmt_str(f, ",\"rcphase\":");
+            lstnr_fmt_float(f, cirp->rcphase, 3);
+            lstnr_fmt_str(f, ",\"angle\":");
+            lstnr_fmt_float(f, cirp->angle, 3);
+            lstnr_fmt_str(f, ",\"rts\":");
+            lstnr_fmt_int(f, cirp->raw_ts);
+            if (local_conf.acc_samples_to_load) {
+                lstnr_fmt_str(f, ",\"real\":[");
+                for (int i=0;i<local_conf.acc_samples_to_load;i++) {
+                    if (i) {
+                        lstnr_fmt_char(f, ',');
+                    }
+                    lstnr_fmt_int(f, (int)cirp->cir.array[i].real);
+                }
+                lstnr_fmt_str(f, "],\"imag\":[");
+                for (int i=0;i<local_conf.acc_samples_to_load;i++) {
+                    if (i) {
+                        lstnr_fmt_char(f, ',');
+                    }
+                    lstnr_fmt_int(f, (int)cirp->cir.array[i].imag);
+                }
+                lstnr_fmt_char(f, ']');
+            }
+            lstnr_fmt_char(f, '}');
+        }
+        lstnr_fmt_char(f, ']');
+    }
+#endif  // CIR_ENABLED
+    lstnr_fmt_char(f, '}');
+    (void)rc;
+}
+
 static void
 process_rx_data_queue(struct os_event *ev)
 {
@@ -354,8 +668,7 @@ process_rx_data_queue(struct os_event *ev)
     struct os_mbuf *om = 0;
     struct uwb_msg_hdr *hdr;
     int payload_len;
-    struct uwb_dev *udev = uwb_dev_idx_lookup(0);
-    uint64_t ts;
+    struct lstnr_fmt f;
 #ifdef MYNEWT_VAL_PDOA_SPI_NUM_INSTANCES
     int n_instances = MYNEWT_VAL(PDOA_SPI_NUM_INSTANCES);
 #else
@@ -380,171 +693,32 @@ process_rx_data_queue(struct os_event *ev)
             goto end_msg;
         }
 
-        mprintf(m,"{\"utime\":%lu", hdr->utime);
-
-        mprintf(m,",\"ts\":[");
-        for(int j=0;j<n_instances;j++) {
-            ts = hdr->ts[j];
-            mprintf(m,"%s%llu", (j==0)?"":",", ts);
-        }
-        mprintf(m,"]");
-
-#ifndef MYNEWT_VAL_PDOA_SPI_NUM_INSTANCES
-        rc = os_mbuf_copydata(om, hdr->dlen + hdr->diag_offset, sizeof(struct uwb_dev_rxdiag), &tmp_diag);
-        struct uwb_dev_rxdiag *diag = (struct uwb_dev_rxdiag *)&tmp_diag;
-        int offset = 0;
-        for(int j=0;j<n_instances;j++) {
-            rc = os_mbuf_copydata(om, hdr->dlen + hdr->diag_offset + offset, diag->rxd_len, &tmp_diag[j]);
-            offset += diag->rxd_len;
-        }
-#endif
-
-        if ((local_conf.verbose&VERBOSE_RX_DIAG)) {
-            mprintf(m,",\"rssi\":[");
-            for(int j=0;j<n_instances;j++) {
-#ifdef MYNEWT_VAL_PDOA_SPI_NUM_INSTANCES
-                struct uwb_dev_rxdiag *diag = &hdr->diag[j].diag;
-#else
-                rc = os_mbuf_copydata(om, hdr->dlen + hdr->diag_offset + j*MYNEWT_VAL(UWB_DEV_RXDIAG_MAXLEN), sizeof(struct uwb_dev_rxdiag), diag_buffer);
-                struct uwb_dev_rxdiag *diag = (struct uwb_dev_rxdiag *)diag_buffer;
-                rc = os_mbuf_copydata(om, hdr->dlen + hdr->diag_offset + j*diag->rxd_len, diag->rxd_len, diag_buffer);
-#endif
-
-                float rssi = uwb_calc_rssi(udev, diag);
-                if (rssi > -200 && rssi < 100) {
-                    mprintf(m,"%s%d.%01d", (j==0)?"":",",
-                           (int)rssi, abs((int)(10*(rssi-(int)rssi))));
-                } else {
-                    mprintf(m,"%snull", (j==0)?"":",");
-                }
-            }
-            mprintf(m,"],\"fppl\":[");
-            for(int j=0;j<n_instances;j++) {
-#ifdef MYNEWT_VAL_PDOA_SPI_NUM_INSTANCES
-                struct uwb_dev_rxdiag *diag = &hdr->diag[j].diag;
-#else
-                rc = os_mbuf_copydata(om, hdr->dlen + hdr->diag_offset + j*MYNEWT_VAL(UWB_DEV_RXDIAG_MAXLEN), sizeof(struct uwb_dev_rxdiag), diag_buffer);
-                struct uwb_dev_rxdiag *diag = (struct uwb_dev_rxdiag *)diag_buffer;
-                rc = os_mbuf_copydata(om, hdr->dlen + hdr->diag_offset + j*diag->rxd_len, diag->rxd_len, diag_buffer);
-#endif
-                float fppl = uwb_calc_fppl(udev, diag);
-                if (fppl > -200 && fppl < 100) {
-                    mprintf(m,"%s%d.%01d", (j==0)?"":",",
-                           (int)fppl, abs((int)(10*(fppl-(int)fppl))));
-                } else {
-                    mprintf(m,"%snull", (j==0)?"":",");
-                }
-            }
-            mprintf(m,"]");
-        }
-        if (hdr->carrier_integrator && (local_conf.verbose&VERBOSE_CARRIER_INTEGRATOR)) {
-            float ccor = uwb_calc_clock_offset_ratio(udev, hdr->carrier_integrator, UWB_CR_CARRIER_INTEGRATOR);
-
-            int ppm = (int)(ccor*1000000.0f);
-            mprintf(m,",\"ccor\":%d.%03de-6",
-                   ppm,
-                   (int)roundf(fabsf(ccor-ppm/1000000.0f)*1000000000.0f)
-                );
-        }
-        mprintf(m,",\"pd\":[");
-        if (udev->capabilities.single_receiver_pdoa) {
-            int j=0;
-#ifdef MYNEWT_VAL_PDOA_SPI_NUM_INSTANCES
-                struct uwb_dev_rxdiag *diag = &hdr->diag[j].diag;
-#else
-                rc = os_mbuf_copydata(om, hdr->dlen + hdr->diag_offset + j*MYNEWT_VAL(UWB_DEV_RXDIAG_MAXLEN), sizeof(struct uwb_dev_rxdiag), diag_buffer);
-                struct uwb_dev_rxdiag *diag = (struct uwb_dev_rxdiag *)diag_buffer;
-                rc = os_mbuf_copydata(om, hdr->dlen + hdr->diag_offset + j*diag->rxd_len, diag->rxd_len, diag_buffer);
-#endif
-
-            float pdoa = uwb_calc_pdoa(udev, diag);
-            if (isnan(pdoa)) {
-                /* Json can't handle Nan, but it can handle null */
-                mprintf(m,"%snull", (j==0)?"":",");
-            } else {
-                mprintf(m,(pdoa < 0)?"%s-%d.%03d":"%s%d.%03d",
-                        (j==0)?"":",",
-                        abs((int)pdoa), abs((int)(1000*(pdoa-(int)pdoa))));
+        if (local_conf.verbose&VERBOSE_PCAP) {
+            if (pcap_record(m, om, hdr, n_instances)) {
+                os_mbuf_free_chain(m);
+                goto end_msg;
             }
-        }
-
-        for(int j=0;j<n_instances-1;j++) {
-            if (isnan(hdr->pd[j])) {
-                /* Json can't handle Nan, but it can handle null */
-                mprintf(m,"%snull", (j==0)?"":",");
-            } else {
-                mprintf(m,(hdr->pd[j] < 0)?"%s-%d.%03d":"%s%d.%03d",
-                        (j==0)?"":",",
-                        abs((int)hdr->pd[j]), abs((int)(1000*(hdr->pd[j]-(int)hdr->pd[j]))));
+            if ((local_conf.verbose&VERBOSE_NOT_TO_CONSOLE)==0) {
+                slip_write_mbuf(m);
             }
+            goto send_msg;
         }
 
-        mprintf(m,"],\"dlen\":%d", hdr->dlen);
-        mprintf(m,",\"d\":\"");
-        for (int i=0;i<sizeof(print_buffer) && i<hdr->dlen;i++)
-        {
-            mprintf(m,"%02x", print_buffer[i]);
-        }
-        mprintf(m,"\"");
-#if MYNEWT_VAL(CIR_ENABLED)
-        if (local_conf.verbose&VERBOSE_CIR) {
-            mprintf(m,",\"cir\":[");
-            for(int j=0;j<n_instances;j++) {
-#if MYNEWT_VAL(DW1000_DEVICE_0)
-                rc = os_mbuf_copydata(om, hdr->dlen + j*sizeof(struct cir_dw1000_instance), sizeof(struct cir_dw1000_instance), &tmp_cir);
-                struct cir_dw1000_instance* cirp = &tmp_cir;
-#endif
-#if MYNEWT_VAL(DW3000_DEVICE_0)
-                rc = os_mbuf_copydata(om, hdr->dlen + j*sizeof(struct cir_dw3000_instance), sizeof(struct cir_dw3000_instance), &tmp_cir);
-                struct cir_dw3000_instance* cirp = &tmp_cir;
-#endif
-                if (cirp->cir_inst.status.valid > 0 || 1) {
-                    //float idx = ((float) hdr->diag[j].fp_idx)/64.0f;
-                    float idx = cirp->fp_idx;
-                    float ph = cirp->rcphase;
-                    float an = cirp->angle;
-                    mprintf(m,"%s{\"o\":%d,\"fp_idx\":%d.%03d,\"rcphase\":%d.%03d,\"angle\":%d.%03d,\"rts\":%lld",
-                           (j==0)?"":",", cirp->offset, (int)idx, (int)(1000*(idx-(int)idx)),
-                           (int)ph, (int)fabsf((1000*(ph-(int)ph))),
-                           (int)an, (int)fabsf((1000*(an-(int)an))),
-                           cirp->raw_ts
-                        );
-                    // mprintf(m,",\"fp_amp\":[%d,%d,%d]", hdr->diag[j].fp_amp, hdr->diag[j].fp_amp2, hdr->diag[j].fp_amp3);
-                    // mprintf(m,",\"cir_pwr\":%d", hdr->diag[j].cir_pwr);
-                    // mprintf(m,",\"rx_std\":%d", hdr->diag[j].rx_std);
-                    if (local_conf.acc_samples_to_load) {
-                        mprintf(m,",\"real\":[");
-                        for (int i=0;i<local_conf.acc_samples_to_load;i++) {
-                            mprintf(m,"%s%d", (i==0)? "":",", (int)cirp->cir.array[i].real);
-                        }
-                        mprintf(m,"],\"imag\":[");
-                        for (int i=0;i<local_conf.acc_samples_to_load;i++) {
-                            mprintf(m,"%s%d", (i==0)? "":",", (int)cirp->cir.array[i].imag);
-                        }
-                        mprintf(m,"]");
-                    }
-                    mprintf(m,"}");
-                }
-            }
-            mprintf(m,"]");
-        }
-#endif  // CIR_ENABLED
-        mprintf(m,"}");
+        lstnr_fmt_init(&f, output_buffer, sizeof(output_buffer), json_flush, &m);
+        json_record(&f, om, hdr, n_instances);
+        lstnr_fmt_finish(&f);
         if ((local_conf.verbose&VERBOSE_NOT_TO_CONSOLE)==0) {
             console_out('\n');
         }
-#if MYNEWT_VAL(ETH_0)
-        /* Setup UDP broadcast socket */
-        if (!net_udp_socket) {
-            rc = mn_socket(&net_udp_socket, MN_PF_INET, MN_SOCK_DGRAM, 0);
-            mn_socket_set_cbs(net_udp_socket, NULL, &net_test_cbs);
+        /* Records share datagrams, one per line */
+        if (m && os_mbuf_append(m, "\n", 1)) {
+            os_mbuf_free_chain(m);
+            m = NULL;
         }
+    send_msg:
+#if MYNEWT_VAL(ETH_0)
         if (m) {
-            rc = mn_sendto(net_udp_socket, m, (struct mn_sockaddr *)net_sinp);
-            if (rc != 0) {
-                printf("sendto: %d\n", rc);
-                os_mbuf_free_chain(m);
-            }
+            lstnr_udp_send(m);
         }
 #else
         os_mbuf_free_chain(m);
@@ -556,6 +730,32 @@ process_rx_data_queue(struct os_event *ev)
     hal_gpio_init_out(LED_BLINK_PIN, 1);
 }
 
+static int16_t
+diag_fixed(float v, float scale, float lo, float hi)
+{
+    if (!(v > lo && v < hi)) {
+        return DIAG_NONE;
+    }
+    return (int16_t)lroundf(v * scale);
+}
+
+/* Compute what the output needs from diag while it is at hand */
+static void
+diag_decode(struct lstnr_diag *d, struct uwb_dev *udev,
+            struct uwb_dev_rxdiag *diag, bool first)
+{
+    d->rssi = DIAG_NONE;
+    d->fppl = DIAG_NONE;
+    d->pdoa = DIAG_NONE;
+    if ((local_conf.verbose&VERBOSE_RX_DIAG)) {
+        d->rssi = diag_fixed(uwb_calc_rssi(udev, diag), 10, -200, 100);
+        d->fppl = diag_fixed(uwb_calc_fppl(udev, diag), 10, -200, 100);
+    }
+    if (first && udev->capabilities.single_receiver_pdoa) {
+        d->pdoa = diag_fixed(uwb_calc_pdoa(udev, diag), 1000, -32.0f, 32.0f);
+    }
+}
+
 static bool
 rx_complete_cb(struct uwb_dev * inst, struct uwb_mac_interface * cbs)
 {
@@ -598,6 +798,10 @@ rx_complete_cb(struct uwb_dev * inst, struct uwb_mac_interface * cbs)
     }
 #endif
 
+    if (!lstnr_filter_match(&g_filter, inst->rxbuf, inst->frame_len, inst)) {
+        return true;
+    }
+
     om = os_mbuf_get_pkthdr(&g_mbuf_pool, sizeof(struct uwb_msg_hdr));
     if (!om) {
         /* Not enough memory to handle incoming packet, drop it */
@@ -623,23 +827,29 @@ rx_complete_cb(struct uwb_dev * inst, struct uwb_mac_interface * cbs)
         struct pdoa_cir_data *pdata = hal_bsp_get_pdoa_cir_data(i);
         memcpy(&hdr->diag[i], &pdata->rxdiag, sizeof(hdr->diag[i]));
         hdr->ts[i] = pdata->ts;
+        diag_decode(&hdr->dd[i], uwb_dev_idx_lookup(0), &hdr->diag[i].diag, i == 0);
     }
 #else
     for(int i=0;i<N_DW_INSTANCES;i++) {
         struct uwb_dev * udev = uwb_dev_idx_lookup(i);
 
-        rc = os_mbuf_copyinto(om, offset, udev->rxdiag, udev->rxdiag->rxd_len);
-        if (rc != 0) {
-            os_mbuf_free_chain(om);
-            return true;
+        /* The raw diagnostics are only output in pcap records */
+        if (local_conf.verbose&VERBOSE_PCAP) {
+            rc = os_mbuf_copyinto(om, offset, udev->rxdiag, udev->rxdiag->rxd_len);
+            if (rc != 0) {
+                os_mbuf_free_chain(om);
+                return true;
+            }
+            offset += udev->rxdiag->rxd_len;
         }
-        offset += udev->rxdiag->rxd_len;
+        diag_decode(&hdr->dd[i], udev, udev->rxdiag, i == 0);
 
         if (!udev->status.lde_error) {
             hdr->ts[i] = udev->rxtimestamp;
         }
     }
 #endif
+    hdr->diag_len = offset - hdr->diag_offset;
 
 #if MYNEWT_VAL(CIR_ENABLED)
     hdr->cir_offset = offset;
@@ -701,7 +911,7 @@ rx_complete_cb(struct uwb_dev * inst, struct uwb_mac_interface * cbs)
 #endif
 
 #endif // MYNEWT_VAL_PDOA_SPI_NUM_INSTANCES
-            rc = os_mbuf_copyinto(om, hdr->dlen + i*sizeof(*src),
+            rc = os_mbuf_copyinto(om, hdr->cir_offset + i*sizeof(*src),
                                   src, sizeof(*src));
             assert(rc == 0);
         }
@@ -757,7 +967,8 @@ uwb_config_update(struct os_event * ev)
 #if N_DW_INSTANCES > 1
         uwb_set_rxauto_disable(inst, MYNEWT_VAL(CIR_ENABLED));
 #endif
-        inst->config.rxdiag_enable = (local_conf.verbose&VERBOSE_RX_DIAG) != 0;
+        inst->config.rxdiag_enable = (local_conf.verbose&VERBOSE_RX_DIAG) != 0 ||
+            g_filter.uses_rssi;
         uwb_start_rx(inst);
     }
 }
@@ -817,11 +1028,13 @@ int main(int argc, char **argv){
     /* Bring up network device with dhcp */
     rc = lwip_nif_up("st1");
     assert(rc==0);
+    lstnr_udp_init();
 #endif
 
     for(int i=0;i<N_DW_INSTANCES;i++) {
         udev[i] = uwb_dev_idx_lookup(i);
-        udev[i]->config.rxdiag_enable = (local_conf.verbose&VERBOSE_RX_DIAG) != 0;
+        udev[i]->config.rxdiag_enable = (local_conf.verbose&VERBOSE_RX_DIAG) != 0 ||
+            g_filter.uses_rssi;
         udev[i]->config.bias_correction_enable = 0;
         udev[i]->config.LDE_enable = 1;
         udev[i]->config.LDO_enable = 0;
@@ -54,6 +54,9 @@
 #include <uwb_rng/uwb_rng.h>
 #endif
 #include <rtdoa/rtdoa.h>
+#if MYNEWT_VAL(UWB_PAN_ENABLED)
+#include <uwb_pan/uwb_pan.h>
+#endif
 
 #include <rtdoa_backhaul/rtdoa_backhaul.h>
 #include "sensor/sensor.h"
@@ -63,7 +66,39 @@
 #include "sensor/pressure.h"
 static struct dpl_callout sensor_callout;
 #if MYNEWT_VAL(IMU_RATE)
+#include <stats/stats.h>
+STATS_SECT_START(imu_stats)
+    STATS_SECT_ENTRY(rate_mhz)
+    STATS_SECT_ENTRY(sent)
+    STATS_SECT_ENTRY(skipped)
+STATS_SECT_END
+
+STATS_NAME_START(imu_stats)
+    STATS_NAME(imu_stats, rate_mhz)
+    STATS_NAME(imu_stats, sent)
+    STATS_NAME(imu_stats, skipped)
+STATS_NAME_END(imu_stats)
+
+static STATS_SECT_DECL(imu_stats) g_imu_stats;
+
+#define IMU_RATE_MAX_MHZ (MYNEWT_VAL(IMU_RATE)*1000)
+#define IMU_RATE_MIN_MHZ (MYNEWT_VAL(IMU_RATE_MIN)*1000)
+
+#if MYNEWT_VAL(IMU_RATE_MIN) < 1 || MYNEWT_VAL(IMU_RATE_MIN) > MYNEWT_VAL(IMU_RATE)
+#error "IMU_RATE_MIN must be between 1 and IMU_RATE"
+#endif
+
+static uint32_t imu_rate_mhz = IMU_RATE_MAX_MHZ;
 static int imu_reset_ticks = DPL_TICKS_PER_SEC/MYNEWT_VAL(IMU_RATE);
+static int imu_last_queued = 0;
+static uint32_t imu_last_drained = 0;
+
+#if MYNEWT_VAL(IMU_OVERSAMPLE) > 1 && !MYNEWT_VAL(RTDOABH_IMU_MEAN)
+#error "IMU_OVERSAMPLE needs RTDOABH_IMU_MEAN"
+#endif
+/* Accel and gyro are sampled IMU_OVERSAMPLE times per report */
+#define IMU_SAMPLE_TICKS() ((imu_reset_ticks > MYNEWT_VAL(IMU_OVERSAMPLE)) ? \
+                            imu_reset_ticks/MYNEWT_VAL(IMU_OVERSAMPLE) : 1)
 #endif
 static float g_battery_voltage = 5.1;
 static void low_battery_mode();
@@ -73,6 +108,86 @@ static void low_battery_mode();
 #define DIAGMSG(s,u)
 #endif
 
+/* Over the air backhaul window, in fractions of a slot. It follows the
+ * 3/4 slot rtdoa listen so the uplink never overlaps the anchors. */
+#define BH_WINDOW_START (0.80f)
+#define BH_WINDOW_LEN   (0.15f)
+
+#if MYNEWT_VAL(RTDOA_TAG_BH_RELAY) && !MYNEWT_VAL(RTDOA_TAG_BH_UPLINK)
+#error "RTDOA_TAG_BH_RELAY needs RTDOA_TAG_BH_UPLINK"
+#endif
+
+#if MYNEWT_VAL(RTDOA_TAG_BH_RELAY) || \
+    (MYNEWT_VAL(RTDOA_TAG_BH_COLLECT) && !MYNEWT_VAL(RTDOA_TAG_BH_UPLINK))
+/* Backhaul listen windows are armed from the slot callback and end on
+ * their own, frames received are queued by the backhaul. */
+static void
+bh_listen_done_cb(struct os_event *ev)
+{
+    hal_gpio_write(LED_BLINK_PIN,0);
+}
+
+static struct os_event bh_listen_ev = {
+    .ev_cb = bh_listen_done_cb,
+};
+
+static void
+bh_listen(tdma_instance_t *tdma, uint16_t idx)
+{
+    struct uwb_ccp_instance * ccp = tdma->ccp;
+
+    if (rtdoa_backhaul_listen_async(tdma->dev_inst,
+            tdma_rx_slot_start(tdma, idx + BH_WINDOW_START),
+            BH_WINDOW_LEN*ccp->period/tdma->nslots, &bh_listen_ev) == 0) {
+        hal_gpio_write(LED_BLINK_PIN,1);
+    }
+}
+#endif
+
+#if MYNEWT_VAL(IMU_RATE)
+/**
+ * AIMD control of the imu rate from the backhaul queue. The rate drops
+ * by a quarter for every sample the queue is above IMU_QUEUE_HIGH, and
+ * goes up by IMU_RATE_STEP for every sample the queue drained at least
+ * as many packages as were put on it.
+ *
+ * @return true if this sample should be sent
+ */
+static bool
+imu_rate_update(void)
+{
+    int queued = rtdoa_backhaul_queue_size();
+    uint32_t drained = rtdoa_backhaul_queue_drained();
+    int added = queued - imu_last_queued + (int)(drained - imu_last_drained);
+    bool send = true;
+
+    if (queued > MYNEWT_VAL(IMU_QUEUE_HIGH)) {
+        imu_rate_mhz -= imu_rate_mhz/4;
+        if (imu_rate_mhz < IMU_RATE_MIN_MHZ) {
+            imu_rate_mhz = IMU_RATE_MIN_MHZ;
+        }
+        send = false;
+    } else if ((int)(drained - imu_last_drained) >= added) {
+        imu_rate_mhz += MYNEWT_VAL(IMU_RATE_STEP)*1000;
+        if (imu_rate_mhz > IMU_RATE_MAX_MHZ) {
+            imu_rate_mhz = IMU_RATE_MAX_MHZ;
+        }
+    }
+    imu_last_queued = queued;
+    imu_last_drained = drained;
+
+    imu_reset_ticks = (DPL_TICKS_PER_SEC*1000ULL)/imu_rate_mhz;
+    STATS_CLEAR(g_imu_stats, rate_mhz);
+    STATS_INCN(g_imu_stats, rate_mhz, imu_rate_mhz);
+    if (send) {
+        STATS_INC(g_imu_stats, sent);
+    } else {
+        STATS_INC(g_imu_stats, skipped);
+    }
+    return send;
+}
+#endif
+
 /**
  * @fn Event callback function for sensor events
 */
@@ -91,9 +206,19 @@ sensor_timer_ev_cb(struct dpl_event *ev)
                                     SENSOR_TYPE_PRESSURE,
                                     SENSOR_TYPE_NONE};
     uint64_t local_ts = uwb_read_systime(uwb_dev_idx_lookup(0));
+#if MYNEWT_VAL(IMU_RATE) && MYNEWT_VAL(IMU_OVERSAMPLE) > 1
+    static int sample_n = 0;
+    bool report = (++sample_n >= MYNEWT_VAL(IMU_OVERSAMPLE));
+
+    if (report) {
+        sample_n = 0;
+    }
+#else
+    bool report = true;
+#endif
 
     /* Only include pressure and compass at max 20hz */
-    if (os_cputime_get32() - last_mp_update > os_cputime_usecs_to_ticks(50000)) {
+    if (report && os_cputime_get32() - last_mp_update > os_cputime_usecs_to_ticks(50000)) {
         last_mp_update = os_cputime_get32();
     } else {
         sensor_types[2] = SENSOR_TYPE_NONE;
@@ -110,6 +235,9 @@ sensor_timer_ev_cb(struct dpl_event *ev)
 
         i++;
     }
+    if (!report) {
+        goto early_exit;
+    }
 
     /* Only include battery information once a second */
     if (os_cputime_get32() - last_batt_update > os_cputime_usecs_to_ticks(1000000)) {
@@ -145,9 +273,15 @@ sensor_timer_ev_cb(struct dpl_event *ev)
         }
     }
 
+#if MYNEWT_VAL(IMU_RATE)
+    if (!imu_rate_update()) {
+        goto early_exit;
+    }
+#else
     if (rtdoa_backhaul_queue_size()>2) {
         goto early_exit;
     }
+#endif
 
     // Translate our timestamp into the UWB network-master's timeframe
     struct uwb_ccp_instance *ccp = (struct uwb_ccp_instance*)uwb_mac_find_cb_inst_ptr(uwb_dev_idx_lookup(0), UWBEXT_CCP);
@@ -159,7 +293,7 @@ sensor_timer_ev_cb(struct dpl_event *ev)
     }
 early_exit:
 #if MYNEWT_VAL(IMU_RATE)
-    dpl_callout_reset(&sensor_callout, imu_reset_ticks);
+    dpl_callout_reset(&sensor_callout, IMU_SAMPLE_TICKS());
 #endif
     return;
 }
@@ -232,7 +366,30 @@ rtdoa_slot_timer_cb(struct dpl_event *ev)
     }
     uint64_t measurement_ts = uwb_wcs_local_to_master64(ccp->wcs, dx_time);
     rtdoa_backhaul_set_ts(measurement_ts>>16);
-    rtdoa_backhaul_send(inst, rtdoa, 0); //tdma_tx_slot_start(inst, idx+2)
+#if MYNEWT_VAL(RTDOA_TAG_BH_UPLINK)
+    /* Tags share the rtdoa slots for uplink, slot_id from the pan
+     * picks which ones are ours */
+    uint64_t tx_time = 0;
+    bool own_slot = (inst->slot_id != 0xffff &&
+        idx%MYNEWT_VAL(RTDOA_TAG_BH_NUM_TAGS) == inst->slot_id%MYNEWT_VAL(RTDOA_TAG_BH_NUM_TAGS));
+    if (own_slot) {
+        tx_time = tdma_tx_slot_start(tdma, idx + BH_WINDOW_START) & 0xFFFFFFFFFE00UL;
+    }
+    /* As a relay our result goes out together with the queued frames */
+    rtdoa_backhaul_send(inst, rtdoa, tx_time);
+#if MYNEWT_VAL(RTDOA_TAG_BH_RELAY)
+    /* Pick up what the other tags and relays send in their slots */
+    if (!own_slot) {
+        bh_listen(tdma, idx);
+    }
+#endif
+#else
+    rtdoa_backhaul_send(inst, rtdoa, 0);
+#endif
+#if MYNEWT_VAL(RTDOA_TAG_BH_COLLECT) && !MYNEWT_VAL(RTDOA_TAG_BH_UPLINK)
+    /* Collect results from tags sending in the tail of the slot */
+    bh_listen(tdma, idx);
+#endif
     //printf("idx%de\n", idx);
 }
 
@@ -267,12 +424,32 @@ nmgr_slot_timer_cb(struct dpl_event * ev)
 }
 
 
+#if MYNEWT_VAL(RTDOA_TAG_BH_UPLINK)
+static void
+pan_complete_cb(struct dpl_event * ev)
+{
+    assert(ev != NULL);
+    assert(dpl_event_get_arg(ev) != NULL);
+    struct uwb_pan_instance *pan = (struct uwb_pan_instance*) dpl_event_get_arg(ev);
+
+    if (pan->dev_inst->slot_id != 0xffff) {
+        printf("{\"slot_id\":%d,\"addr\":\"%X\"}\n", pan->dev_inst->slot_id,
+               pan->dev_inst->my_short_address);
+    }
+}
+#endif
+
 static void
 tdma_allocate_slots(tdma_instance_t * tdma)
 {
     uint16_t i;
     /* Pan for anchors is in slot 1 */
     struct uwb_dev * inst = tdma->dev_inst;
+#if MYNEWT_VAL(RTDOA_TAG_BH_UPLINK)
+    struct uwb_pan_instance *pan = (struct uwb_pan_instance*)uwb_mac_find_cb_inst_ptr(inst, UWBEXT_PAN);
+    assert(pan);
+    tdma_assign_slot(tdma, uwb_pan_slot_timer_cb, 1, (void*)pan);
+#endif
     nmgr_uwb_instance_t *nmgruwb = (nmgr_uwb_instance_t*)uwb_mac_find_cb_inst_ptr(inst, UWBEXT_NMGR_UWB);
     assert(nmgruwb);
     struct rtdoa_instance * rtdoa = (struct rtdoa_instance*)uwb_mac_find_cb_inst_ptr(inst, UWBEXT_RTDOA);
@@ -358,6 +535,13 @@ main(int argc, char **argv)
     uwbcfg_register(&uwb_cb);
     conf_load();
 
+#if MYNEWT_VAL(IMU_RATE)
+    rc = stats_init_and_reg(
+        STATS_HDR(g_imu_stats), STATS_SIZE_INIT_PARMS(g_imu_stats,
+        STATS_SIZE_32), STATS_NAME_INIT_PARMS(imu_stats), "imu");
+    assert(rc == 0);
+#endif
+
     struct uwb_dev *udev = uwb_dev_idx_lookup(0);
 
     udev->config.rxauto_enable = 1;
@@ -367,7 +551,12 @@ main(int argc, char **argv)
     udev->config.dblbuffon_enabled = 0;
     uwb_set_dblrxbuff(udev, false);
 
+#if MYNEWT_VAL(RTDOA_TAG_BH_UPLINK)
+    /* Assigned by the panmaster */
+    udev->slot_id = 0xffff;
+#else
     udev->slot_id = 0;
+#endif
 
     ble_init(udev->my_long_address);
 
@@ -384,7 +573,18 @@ main(int argc, char **argv)
 
     tdma_allocate_slots(tdma);
     uwb_ccp_start(ccp, CCP_ROLE_SLAVE);
+#if MYNEWT_VAL(RTDOA_TAG_BH_UPLINK)
+    struct uwb_pan_instance *pan = (struct uwb_pan_instance*)uwb_mac_find_cb_inst_ptr(udev, UWBEXT_PAN);
+    uwb_pan_set_postprocess(pan, pan_complete_cb);
+    uwb_pan_start(pan, UWB_PAN_ROLE_RELAY, NETWORK_ROLE_TAG);
+#if MYNEWT_VAL(RTDOA_TAG_BH_RELAY)
+    rtdoa_backhaul_set_role(udev, RTDOABH_ROLE_RELAY);
+#else
+    rtdoa_backhaul_set_role(udev, RTDOABH_ROLE_PRODUCER);
+#endif
+#else
     rtdoa_backhaul_set_role(udev, RTDOABH_ROLE_BRIDGE);
+#endif
 
     init_timer();
 
@@ -0,0 +1,67 @@
+#!/usr/bin/env python
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+# Build a replay capture for apps/rtdoabh_replay from the json output of
+# apps/listener. Keeps the backhaul frames (codes 0x6003 to 0x6007)
+# as received, fcs included, each preceded by its length as 2 bytes
+# little endian.
+#
+#   ./mkcapture.py listener.log capture.bin
+#
+import sys, argparse
+import struct
+import json
+
+FCNTL_IEEE_RTDOABH = 0x88C1
+CODES = range(0x6003, 0x6008)
+HEAD = struct.Struct('<HBHHHH')
+
+def frames(lines):
+    for line in lines:
+        try:
+            j = json.loads(line)
+            d = bytes.fromhex(j['d'])
+        except (ValueError, KeyError, TypeError):
+            continue
+        if len(d) != j.get('dlen', -1):
+            # Truncated by the listener
+            continue
+        if len(d) < HEAD.size:
+            continue
+        fctrl, _, _, _, _, code = HEAD.unpack_from(d)
+        if fctrl == FCNTL_IEEE_RTDOABH and code in CODES:
+            yield d
+
+def main():
+    parser = argparse.ArgumentParser(description='Listener json to replay capture')
+    parser.add_argument('infile', help='listener output, - for stdin')
+    parser.add_argument('outfile', help='capture to write')
+    args = parser.parse_args()
+
+    fin = sys.stdin if args.infile == '-' else open(args.infile)
+    n = 0
+    with open(args.outfile, 'wb') as fout:
+        for d in frames(fin):
+            fout.write(struct.pack('<H', len(d)))
+            fout.write(d)
+            n += 1
+    print("{} frames".format(n), file=sys.stderr)
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,225 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Replays a capture of backhaul frames through the bridge receive path
+ * without a radio, on sim. A task standing in for the radio injects the
+ * frames at REPLAY_RATE with rtdoa_backhaul_inject while the main task
+ * runs the backhaul as on a bridge, timing every event that takes
+ * packages off the queue. Prints a json summary when done. With
+ * REPLAY_UDP the bridge output goes over udp to a socket of this app,
+ * which checks the datagrams, see replay_udp.c.
+ */
+
+#include <assert.h>
+#include <string.h>
+#include <stdio.h>
+#include "sysinit/sysinit.h"
+#include "os/os.h"
+#ifdef ARCH_sim
+#include "mcu/mcu_sim.h"
+#endif
+
+#include <rtdoa_backhaul/rtdoa_backhaul.h>
+#if MYNEWT_VAL(REPLAY_UDP)
+#include "replay_udp.h"
+#endif
+
+#define REPLAY_STACK_SIZE   (1024)
+/* Largest frame the radio receives, including fcs */
+#define REPLAY_MAX_FRAME    (1023)
+/* Time for the last datagram to be flushed and received */
+#define REPLAY_UDP_WAIT_TICKS \
+    ((2 * MYNEWT_VAL(RTDOABH_UDP_FLUSH_MS) + 100) * OS_TICKS_PER_SEC / 1000)
+
+static struct os_task g_replay_task;
+static os_stack_t g_replay_stack[REPLAY_STACK_SIZE];
+static struct os_event g_summary_ev;
+
+static struct {
+    uint32_t frames;            /**< Frames read from the capture */
+    uint32_t skipped;           /**< Not backhaul frames, OS_EINVAL */
+    uint32_t drops;             /**< Dropped for lack of buffers */
+    int queue_hwm;              /**< Highest rtdoa_backhaul_queue_size */
+    int64_t start_us;
+    int64_t end_us;
+    uint32_t pkts;              /**< Packages taken off the queue */
+    int64_t busy_us;            /**< Time spent in events doing so */
+    uint32_t max_us;            /**< Longest per package share of an event */
+} g_replay;
+
+/**
+ * Read the next frame of the capture.
+ *
+ * @return Frame length, 0 at the end of the file, -1 if truncated
+ */
+static int
+read_frame(FILE *f, uint8_t *buf)
+{
+    uint8_t l[2];
+    int len;
+
+    if (fread(l, 1, sizeof(l), f) != sizeof(l)) {
+        return 0;
+    }
+    len = l[0] | (l[1] << 8);
+    if (len > REPLAY_MAX_FRAME || fread(buf, 1, len, f) != (size_t)len) {
+        return -1;
+    }
+    return len;
+}
+
+static void
+inject(const uint8_t *buf, int len)
+{
+    int rc, q;
+
+#if MYNEWT_VAL(REPLAY_RATE) == 0
+    while (rtdoa_backhaul_queue_size() > MYNEWT_VAL(RTDOABH_NUM_MBUFS) / 2) {
+        os_time_delay(1);
+    }
+#endif
+    rc = rtdoa_backhaul_inject(buf, len);
+    if (rc == OS_EINVAL) {
+        g_replay.skipped++;
+    } else if (rc) {
+        g_replay.drops++;
+    }
+    q = rtdoa_backhaul_queue_size();
+    if (q > g_replay.queue_hwm) {
+        g_replay.queue_hwm = q;
+    }
+}
+
+static void
+replay_task(void *arg)
+{
+    static uint8_t buf[REPLAY_MAX_FRAME];
+    uint64_t sent = 0;
+    os_time_t t0;
+    FILE *f;
+    int len;
+
+    f = fopen(MYNEWT_VAL(REPLAY_FILE), "rb");
+    if (!f) {
+        printf("{\"replay\":\"can't open %s\"}\n", MYNEWT_VAL(REPLAY_FILE));
+        return;
+    }
+
+    g_replay.start_us = os_get_uptime_usec();
+    t0 = os_time_get();
+    for (int loop = 0; loop < MYNEWT_VAL(REPLAY_LOOPS); loop++) {
+        rewind(f);
+        while ((len = read_frame(f, buf)) > 0) {
+#if MYNEWT_VAL(REPLAY_RATE)
+            /* Sleep until the frame is due, frames due in the same tick
+             * go back to back as a burst would */
+            while (sent * OS_TICKS_PER_SEC >=
+                   (uint64_t)(os_time_get() - t0 + 1) * MYNEWT_VAL(REPLAY_RATE)) {
+                os_time_delay(1);
+            }
+#endif
+            inject(buf, len);
+            g_replay.frames++;
+            sent++;
+        }
+        if (len < 0) {
+            printf("{\"replay\":\"truncated frame after %lu\"}\n",
+                   (unsigned long)g_replay.frames);
+            break;
+        }
+    }
+    fclose(f);
+
+    while (rtdoa_backhaul_queue_size()) {
+        os_time_delay(1);
+    }
+    g_replay.end_us = os_get_uptime_usec();
+#if MYNEWT_VAL(REPLAY_UDP)
+    os_time_delay(REPLAY_UDP_WAIT_TICKS);
+#endif
+    os_eventq_put(os_eventq_dflt_get(), &g_summary_ev);
+
+    while (1) {
+        os_time_delay(OS_TICKS_PER_SEC);
+    }
+}
+
+static void
+summary_cb(struct os_event *ev)
+{
+    uint32_t us = g_replay.end_us - g_replay.start_us;
+    uint32_t rate = (us) ? (uint64_t)g_replay.pkts * 1000000 / us : 0;
+    uint32_t mean = (g_replay.pkts) ? g_replay.busy_us / g_replay.pkts : 0;
+
+    printf("{\"replay\":{\"frames\":%lu,\"pkts\":%lu,\"usecs\":%lu,"
+           "\"pkts_per_sec\":%lu,\"drops\":%lu,\"skipped\":%lu,"
+           "\"queue_hwm\":%d,\"us_per_pkt\":%lu,\"us_per_pkt_max\":%lu}}\n",
+           (unsigned long)g_replay.frames, (unsigned long)g_replay.pkts,
+           (unsigned long)us, (unsigned long)rate,
+           (unsigned long)g_replay.drops, (unsigned long)g_replay.skipped,
+           g_replay.queue_hwm, (unsigned long)mean,
+           (unsigned long)g_replay.max_us);
+#if MYNEWT_VAL(REPLAY_UDP)
+    replay_udp_summary(g_replay.end_us);
+#endif
+}
+
+int
+main(int argc, char **argv)
+{
+    struct os_eventq *evq;
+    struct os_event *ev;
+    uint32_t drained, n;
+    int64_t t;
+    uint32_t dt;
+
+#ifdef ARCH_sim
+    mcu_sim_parse_args(argc, argv);
+#endif
+    sysinit();
+
+#if MYNEWT_VAL(REPLAY_UDP)
+    replay_udp_init();
+#endif
+    rtdoa_backhaul_set_role(NULL, RTDOABH_ROLE_BRIDGE);
+    g_summary_ev.ev_cb = summary_cb;
+    os_task_init(&g_replay_task, "replay", replay_task, NULL,
+                 MYNEWT_VAL(REPLAY_TASK_PRIO), OS_WAIT_FOREVER,
+                 g_replay_stack, REPLAY_STACK_SIZE);
+
+    evq = os_eventq_dflt_get();
+    while (1) {
+        ev = os_eventq_get(evq);
+        drained = rtdoa_backhaul_queue_drained();
+        t = os_get_uptime_usec();
+        ev->ev_cb(ev);
+        dt = os_get_uptime_usec() - t;
+        n = rtdoa_backhaul_queue_drained() - drained;
+        if (n) {
+            g_replay.pkts += n;
+            g_replay.busy_us += dt;
+            if (dt / n > g_replay.max_us) {
+                g_replay.max_us = dt / n;
+            }
+        }
+    }
+    assert(0);
+    return 0;
+}
@@ -0,0 +1,186 @@
+/**
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Receiving end of the bridge's udp output, for REPLAY_UDP. A socket on
+ * 127.0.0.1:RTDOABH_UDP_PORT takes the datagrams the bridge sends and
+ * checks that each one holds whole records only: json lines starting
+ * with '{', or SLIP frames between END bytes with RTDOABH_BINARY_OUTPUT.
+ * A datagram must also have had less than RTDOABH_UDP_BATCH bytes before
+ * its last record was added, or it should have gone out earlier. The
+ * arrival of the last datagram is compared with when the queue was
+ * empty, it must come within RTDOABH_UDP_FLUSH_MS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include "os/os.h"
+#include <mn_socket/mn_socket.h>
+#include <rtdoa_backhaul/rtdoa_backhaul.h>
+
+#include "replay_udp.h"
+
+/* Largest datagram that is checked, bigger ones count as over */
+#define UDP_RX_MAX      (MYNEWT_VAL(RTDOABH_UDP_BATCH) + MYNEWT_VAL(RTDOABH_JSON_BUF_SIZE) + 1024)
+/* Leeway on top of the flush timeout for the callout and the receive */
+#define UDP_LATE_US     (2 * 1000000 / OS_TICKS_PER_SEC + 1000)
+
+static struct mn_socket *g_rx_socket;
+
+static struct {
+    uint32_t datagrams;
+    uint32_t records;
+    uint32_t bytes;
+    uint32_t max_len;
+    uint32_t split;         /**< Didn't start or end on a record boundary */
+    uint32_t over;          /**< Full before the last record was added */
+    int64_t last_us;        /**< When the last datagram arrived */
+} g_rx;
+
+/**
+ * Count the records in a datagram.
+ *
+ * @param last Set to where the last record starts
+ * @return Number of records, -1 if the datagram doesn't hold whole records
+ */
+static int
+count_records(const uint8_t *buf, int len, int *last)
+{
+    int n = 0, i;
+
+#if MYNEWT_VAL(RTDOABH_BINARY_OUTPUT)
+    /* END type dlen payload crc END, escaped inside so END only at the edges */
+    for (i = 0; i < len; i++) {
+        if (buf[i] != RTDOABH_SLIP_END) {
+            continue;
+        }
+        if (n % 2 == 0) {
+            *last = i;
+        }
+        n++;
+    }
+    if (n == 0 || n % 2 || buf[0] != RTDOABH_SLIP_END || buf[len - 1] != RTDOABH_SLIP_END) {
+        return -1;
+    }
+    return n / 2;
+#else
+    /* One line per record, continuation lines of a loose record are indented */
+    if (buf[0] != '{' || buf[len - 1] != '\n') {
+        return -1;
+    }
+    for (i = 0; i < len; i++) {
+        if ((i == 0 || buf[i - 1] == '\n') && buf[i] == '{') {
+            *last = i;
+            n++;
+        }
+    }
+    return n;
+#endif
+}
+
+static void
+udp_rx_readable(void *arg, int err)
+{
+    static uint8_t buf[UDP_RX_MAX];
+    struct mn_sockaddr_in from;
+    struct os_mbuf *om = NULL;
+    int len, n, last = 0;
+
+    while (mn_recvfrom(g_rx_socket, &om, (struct mn_sockaddr *)&from) == 0 && om) {
+        g_rx.last_us = os_get_uptime_usec();
+        len = OS_MBUF_PKTLEN(om);
+        g_rx.datagrams++;
+        g_rx.bytes += len;
+        if (len > g_rx.max_len) {
+            g_rx.max_len = len;
+        }
+        if (len > sizeof(buf)) {
+            g_rx.over++;
+        } else {
+            os_mbuf_copydata(om, 0, len, buf);
+            n = count_records(buf, len, &last);
+            if (n < 0) {
+                g_rx.split++;
+            } else {
+                g_rx.records += n;
+                if (last >= MYNEWT_VAL(RTDOABH_UDP_BATCH)) {
+                    g_rx.over++;
+                }
+            }
+        }
+        os_mbuf_free_chain(om);
+        om = NULL;
+    }
+}
+
+static void
+udp_rx_writable(void *arg, int err)
+{
+}
+
+static const union mn_socket_cb g_rx_cbs = {
+    .socket.readable = udp_rx_readable,
+    .socket.writable = udp_rx_writable
+};
+
+void
+replay_udp_init(void)
+{
+    struct mn_sockaddr_in sin;
+    int rc;
+
+    memset(&sin, 0, sizeof(sin));
+    sin.msin_len = sizeof(sin);
+    sin.msin_family = MN_AF_INET;
+    sin.msin_port = htons(atoi(MYNEWT_VAL(RTDOABH_UDP_PORT)));
+    rc = mn_inet_pton(MN_AF_INET, "127.0.0.1", &sin.msin_addr);
+    assert(rc == 1);
+
+    rc = mn_socket(&g_rx_socket, MN_PF_INET, MN_SOCK_DGRAM, 0);
+    assert(rc == 0);
+    mn_socket_set_cbs(g_rx_socket, NULL, &g_rx_cbs);
+    rc = mn_bind(g_rx_socket, (struct mn_sockaddr *)&sin);
+    assert(rc == 0);
+}
+
+/**
+ * Print what was received.
+ *
+ * @param drained_us When the backhaul queue was empty for the last time
+ * @return true if every check passed
+ */
+bool
+replay_udp_summary(int64_t drained_us)
+{
+    int64_t flush_us = (g_rx.last_us > drained_us) ? g_rx.last_us - drained_us : 0;
+    bool ok;
+
+    ok = g_rx.datagrams && !g_rx.split && !g_rx.over &&
+        flush_us <= MYNEWT_VAL(RTDOABH_UDP_FLUSH_MS) * 1000 + UDP_LATE_US;
+    printf("{\"replay_udp\":{\"datagrams\":%lu,\"records\":%lu,\"bytes\":%lu,"
+           "\"max_len\":%lu,\"split\":%lu,\"over\":%lu,\"flush_us\":%lu,"
+           "\"ok\":%s}}\n",
+           (unsigned long)g_rx.datagrams, (unsigned long)g_rx.records,
+           (unsigned long)g_rx.bytes, (unsigned long)g_rx.max_len,
+           (unsigned long)g_rx.split, (unsigned long)g_rx.over,
+           (unsigned long)flush_us, ok ? "true" : "false");
+    return ok;
+}
@@ -0,0 +1,195 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Host micro benchmark of rtdoabh_decode.hpp. The input is a synthetic
+ * set of packages encoded by the package itself, see bench_input.c.
+ * Each case is timed the way Google Benchmark does it, repeated until it
+ * has run for at least the minimum time, and reported as ns per packet
+ * and packets/s:
+ *
+ *   single   one packet per call into a cleared Batch
+ *   batch    all packets of the set per call, as a host reading a
+ *            capture or a serial buffer would
+ *
+ * The compressed and SLIP sets are checked to decode to the same Batch
+ * as the plain one first.
+ *
+ *   make bench_decode && ./bench_decode [min_seconds]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "bench_input.h"
+#include "rtdoabh_decode.hpp"
+
+#define NUM_PKGS    (1024)
+
+extern "C" uint16_t
+crc16_ccitt(uint16_t initial_crc, const void *buf, int len)
+{
+    return rtdoabh::crc16_ccitt(initial_crc, (const uint8_t *)buf, len);
+}
+
+/* One encoded packet per entry, all in one buffer */
+struct Frames {
+    std::vector<uint8_t> buf;
+    std::vector<size_t> off;
+    std::vector<size_t> len;
+
+    Frames(enum bench_enc enc)
+    {
+        uint8_t tmp[512];
+
+        for (int k = 0; k < NUM_PKGS; k++) {
+            int n = bench_input(k, enc, tmp, sizeof(tmp));
+            if (n < 0) {
+                std::abort();
+            }
+            off.push_back(buf.size());
+            len.push_back(n);
+            buf.insert(buf.end(), tmp, tmp + n);
+        }
+    }
+    size_t size() const { return off.size(); }
+    const uint8_t *at(size_t i) const { return buf.data() + off[i]; }
+};
+
+static bool
+same(const rtdoabh::Batch &a, const rtdoabh::Batch &b)
+{
+    return a.src_address == b.src_address && a.seq_num == b.seq_num &&
+        a.ts == b.ts && a.sensors_valid == b.sensors_valid &&
+        a.battery_voltage == b.battery_voltage && a.pressure == b.pressure &&
+        a.compass == b.compass && a.acceleration == b.acceleration &&
+        a.gyro == b.gyro && a.ref_anchor_addr == b.ref_anchor_addr &&
+        a.range_begin == b.range_begin && a.num_ranges == b.num_ranges &&
+        a.anchor_addr == b.anchor_addr && a.diff_dist_mm == b.diff_dist_mm &&
+        a.rssi == b.rssi && a.quality == b.quality;
+}
+
+static double g_min_time = 0.5;
+static volatile size_t g_sink;
+
+/**
+ * Run fn, which decodes pkts packets per call, until g_min_time has
+ * passed and print the rate.
+ */
+template <typename F>
+static void
+run(const char *name, size_t pkts, F fn)
+{
+    typedef std::chrono::steady_clock clock;
+    size_t iters = 1, i;
+    double t;
+
+    for (;;) {
+        clock::time_point t0 = clock::now();
+        for (i = 0; i < iters; i++) {
+            g_sink += fn();
+        }
+        t = std::chrono::duration<double>(clock::now() - t0).count();
+        if (t >= g_min_time) {
+            break;
+        }
+        /* Aim past the minimum at the next attempt, as Google Benchmark does */
+        iters = (t < g_min_time / 100) ? iters * 100 :
+            (size_t)(iters * g_min_time * 1.4 / t) + 1;
+    }
+    t = t * 1e9 / (iters * pkts);
+    printf("%-20s %8.1f ns/packet %12.0f packets/s\n", name, t, 1e9 / t);
+}
+
+int
+main(int argc, char **argv)
+{
+    Frames plain(BENCH_PLAIN), zip(BENCH_ZIP), slip(BENCH_SLIP);
+    rtdoabh::Batch b, ref;
+    rtdoabh::SlipDecoder check_slip;
+    size_t i;
+
+    if (argc > 1) {
+        g_min_time = atof(argv[1]);
+    }
+    printf("%d packages, %zu bytes plain, %zu zip, %zu slip\n", NUM_PKGS,
+           plain.buf.size(), zip.buf.size(), slip.buf.size());
+
+    for (i = 0; i < plain.size(); i++) {
+        rtdoabh::decode_plain(ref, plain.at(i), plain.len[i]);
+    }
+    if (ref.size() != NUM_PKGS || ref.num_ranges[NUM_PKGS - 1] != 4 + (NUM_PKGS - 1) % 8) {
+        printf("decode_plain: mismatch\n");
+        return 1;
+    }
+    for (i = 0; i < zip.size(); i++) {
+        rtdoabh::decode_zip(b, zip.at(i), zip.len[i]);
+    }
+    if (!same(b, ref)) {
+        printf("decode_zip: mismatch\n");
+        return 1;
+    }
+    b.clear();
+    check_slip.feed(slip.buf.data(), slip.buf.size(), b);
+    if (!same(b, ref) || check_slip.bad()) {
+        printf("SlipDecoder: mismatch\n");
+        return 1;
+    }
+
+    b.reserve(NUM_PKGS, ref.range_count());
+    i = 0;
+    run("decode_plain single", 1, [&]() {
+        b.clear();
+        i = (i + 1) % plain.size();
+        return rtdoabh::decode_plain(b, plain.at(i), plain.len[i]);
+    });
+    run("decode_plain batch", plain.size(), [&]() {
+        b.clear();
+        for (size_t j = 0; j < plain.size(); j++) {
+            rtdoabh::decode_plain(b, plain.at(j), plain.len[j]);
+        }
+        return b.size();
+    });
+    run("decode_zip single", 1, [&]() {
+        b.clear();
+        i = (i + 1) % zip.size();
+        return rtdoabh::decode_zip(b, zip.at(i), zip.len[i]);
+    });
+    run("decode_zip batch", zip.size(), [&]() {
+        b.clear();
+        for (size_t j = 0; j < zip.size(); j++) {
+            rtdoabh::decode_zip(b, zip.at(j), zip.len[j]);
+        }
+        return b.size();
+    });
+
+    rtdoabh::SlipDecoder dec;
+    run("SlipDecoder single", 1, [&]() {
+        b.clear();
+        i = (i + 1) % slip.size();
+        return dec.feed(slip.at(i), slip.len[i], b);
+    });
+    run("SlipDecoder batch", slip.size(), [&]() {
+        b.clear();
+        return dec.feed(slip.buf.data(), slip.buf.size(), b);
+    });
+    return (g_sink == 0);
+}
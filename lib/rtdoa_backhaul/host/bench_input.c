@@ -0,0 +1,114 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Input of bench_decode, kept in C since the package headers and
+ * rtdoabh_decode.hpp define the same names. Packages are encoded with
+ * the package's own rtdoabh_zip.c and rtdoabh_slip.c, so the frames are
+ * byte for byte what a tag sends and a bridge writes.
+ */
+
+#include <string.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+#include "bench_input.h"
+
+/* Where rtdoabh_slip.c writes its frames */
+static uint8_t *g_out;
+static int g_out_len;
+static int g_out_size;
+
+void
+rtdoabh_out_write(const void *buf, int len)
+{
+    if (g_out_len + len <= g_out_size) {
+        memcpy(g_out + g_out_len, buf, len);
+    }
+    g_out_len += len;
+}
+
+void
+rtdoabh_out_end(void)
+{
+}
+
+/* A tag with 4 to 11 anchors in view, half of the packages carry imu data */
+static int
+fill_pkg(struct rtdoabh_tag_results_pkg *p, int k)
+{
+    struct rtdoabh_sensor_data *d = &p->sensors;
+    int i, n = 4 + k % 8;
+
+    memset(p, 0, sizeof(*p));
+    p->head.fctrl = FCNTL_IEEE_RTDOABH;
+    p->head.code = DWT_RTDOABH_CODE;
+    p->head.seq_num = k;
+    p->head.src_address = 0x1234 + k % 16;
+    d->ts = 0x123456789aULL + 0x10000ULL * k;
+    d->sensors_valid = UWB_RANGES_ENABLED | BATTERY_LEVELS_ENABLED | PRESSURE_ENABLED;
+    d->battery_voltage = 107;
+    d->pressure = -1234 + k % 100;
+    if (k & 1) {
+        d->sensors_valid |= ACCELEROMETER_ENABLED | GYRO_ENABLED | COMPASS_ENABLED;
+        for (i = 0; i < 3; i++) {
+            d->compass[i] = 100 * i - 321 + k % 7;
+            d->acceleration[i] = 4567 * i - 9810 + k % 13;
+            d->gyro[i] = 17 * i - 23 + k % 5;
+        }
+    }
+    p->ref_anchor_addr = 0x1001;
+    p->num_ranges = n;
+    for (i = 0; i < n; i++) {
+        p->ranges[i].anchor_addr = 0x1002 + i;
+        p->ranges[i].diff_dist_mm = 1234 * i - 4321 + 3 * k;
+        p->ranges[i].rssi = -(800 + 7 * i);
+        p->ranges[i].quality = i & 1;
+    }
+    return offsetof(struct rtdoabh_tag_results_pkg, ranges) + n * sizeof(p->ranges[0]);
+}
+
+int
+bench_input(int k, enum bench_enc enc, uint8_t *buf, int size)
+{
+    struct rtdoabh_tag_results_pkg p;
+    struct rtdoabh_slip s;
+    int len = fill_pkg(&p, k);
+
+    switch (enc) {
+    case BENCH_PLAIN:
+        if (len > size) {
+            return -1;
+        }
+        memcpy(buf, &p, len);
+        return len;
+    case BENCH_ZIP:
+        return rtdoabh_zip_encode(&p, len, buf, size);
+    case BENCH_SLIP:
+        g_out = buf;
+        g_out_len = 0;
+        g_out_size = size;
+        rtdoabh_slip_start(&s, RTDOABH_FRAME_TAG_RESULTS, len);
+        rtdoabh_slip_append(&s, &p, len);
+        rtdoabh_slip_finish(&s);
+        return (g_out_len <= size) ? g_out_len : -1;
+    }
+    return -1;
+}
@@ -0,0 +1,49 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _BENCH_INPUT_H_
+#define _BENCH_INPUT_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum bench_enc {
+    BENCH_PLAIN,    /**< Packed package, as sent without RTDOABH_ZIP */
+    BENCH_ZIP,      /**< Compressed frame */
+    BENCH_SLIP,     /**< Bridge binary output of the plain package */
+};
+
+/**
+ * Encode synthetic package k.
+ *
+ * @return Length written to buf, -1 if it doesn't fit
+ */
+int bench_input(int k, enum bench_enc enc, uint8_t *buf, int size);
+
+/* crc16 of the package's slip output, see shim/crc/crc16.h */
+uint16_t crc16_ccitt(uint16_t initial_crc, const void *buf, int len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _BENCH_INPUT_H_ */
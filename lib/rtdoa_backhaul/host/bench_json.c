@@ -0,0 +1,243 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Host micro benchmark of the json rendering of a result package,
+ * rtdoa_backhaul_format() against the printf based rendering it
+ * replaced, kept below as printf_format() with printf turned into
+ * appends to a buffer. Both render the same fully populated package
+ * with the compact measurement layout. Absolute numbers are the host's,
+ * the ratio is what to watch.
+ *
+ *   make bench_json && ./bench_json [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+
+#define NUM_RANGES  (8)
+
+/* Only called for mbuf backed views, which aren't used here */
+int
+os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst)
+{
+    return -1;
+}
+
+static char g_buf[1024];
+static int g_len;
+
+static void
+bprintf(const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(g_buf + g_len, sizeof(g_buf) - g_len, fmt, ap);
+    va_end(ap);
+    if (n > 0 && n < (int)sizeof(g_buf) - g_len) {
+        g_len += n;
+    }
+}
+
+#define uwb_dwt_usecs_to_usecs(_t) ((double)(_t) * (0x10000UL / 128.0) / 499.2)
+
+/* The printf rendering of rtdoa_backhaul_print() before rtdoabh_json.c */
+static int
+printf_format(struct rtdoabh_tag_results_pkg *p)
+{
+    static uint32_t g_msg_id = 0;
+    struct rtdoabh_sensor_data *d = &p->sensors;
+
+    g_len = 0;
+    bprintf("{\"id\":\"0x%04x\"", p->head.src_address);
+
+    if(d->is_anchor_data) {
+        bprintf(",\"mode\":\"anchor\"");
+    }
+    if (d->ts) {
+        double ts = uwb_dwt_usecs_to_usecs(d->ts);
+        uint64_t ts_s  = (uint64_t)(ts/1000000);
+        uint32_t ts_tms = (ts-ts_s*1000000)/100.0;
+        bprintf(",\"ts\":\"%llu.%04lu\"", (unsigned long long)ts_s, (unsigned long)ts_tms);
+    }
+    bprintf(",\"mid\":%ld", (long)g_msg_id++);
+    if (d->sensors_valid&GPS_LAT_LONG_ENABLED) {
+        bprintf(",\"gps\":[\"%d.%d\"", (int)d->gps_lat,
+           abs((int)((d->gps_lat -(int)d->gps_lat)*1000000)));
+        bprintf(",\"%d.%d\"]", (int)d->gps_long,
+               abs((int)((d->gps_long - (int)d->gps_long)*1000000)));
+    }
+
+    if (d->sensors_valid&BATTERY_LEVELS_ENABLED) {
+        float f = (float)d->battery_voltage*5.0f/128;
+        bprintf(",\"vbat\":\"%d.%02d\"",
+               (int)f, abs((int)(100*(f-(int)f)))
+            );
+        bprintf(",\"usb\":%d", d->has_usb_power);
+    }
+
+    if (d->sensors_valid&ACCELEROMETER_ENABLED) {
+        bprintf(",\"a\":\"[");
+        for (int i=0;i<3;i++) {
+            float f = (float)d->acceleration[i]/1000;
+            bprintf("%s%d.%d",(i==0)?"":",",
+                   (int)f, abs((int)(1000*(f-(int)f))));
+        }
+        bprintf("]\"");
+    }
+    if (d->sensors_valid&GYRO_ENABLED) {
+        bprintf(",\"g\":\"[");
+        for (int i=0;i<3;i++) {
+            float f = (float)d->gyro[i]/10;
+            bprintf("%s%d.%d",(i==0)?"":",",
+                   (int)f, abs((int)(10*(f-(int)f))));
+        }
+        bprintf("]\"");
+    }
+    if (d->sensors_valid&COMPASS_ENABLED) {
+        bprintf(",\"m\":[%d,%d,%d]", d->compass[0], d->compass[1], d->compass[2]);
+    }
+    if (d->sensors_valid&PRESSURE_ENABLED) {
+        bprintf(",\"p\":%ld", (long)(((int32_t)d->pressure)+101300));
+    }
+
+    if (!p->num_ranges) {
+        goto early_close;
+    }
+    bprintf(",\"meas\":{");
+    bprintf("\"ref\":\"%x\",", p->ref_anchor_addr);
+    const char* key[4]={"a","dd","rs","qf"};
+
+    for (int j=0;j<4;j++) {
+        bprintf("\"%s\":[",key[j]);
+        for (int i=0;i<p->num_ranges;i++) {
+            struct rtdoabh_range_data *r = &p->ranges[i];
+            int is_last = (i+1<p->num_ranges);
+            switch (j){
+            case (0): {
+                bprintf("\"%x\"%s", r->anchor_addr, (is_last)?",":"");
+                break;
+            }
+            case 1: {
+                int sign = (r->diff_dist_mm > 0);
+                int ddist_m  = r->diff_dist_mm/1000;
+                int ddist_mm = abs(r->diff_dist_mm - ddist_m*1000);
+                bprintf("%s%d.%03d%s", (sign)?"":"-", abs(ddist_m), ddist_mm, (is_last)?",":"");
+                break;
+            }
+            case 2: {
+                float rssif = (float)r->rssi/10;
+                int rssi_frac = abs((int)(10*(rssif-(int)rssif)));
+                bprintf("%d.%d%s", (int)rssif, rssi_frac, (is_last)?",":"");
+                break;
+            }
+            case 3: {
+                bprintf("%x%s", r->quality, (is_last)?",":"");
+                break;
+            }
+            } /* End switch(j) */
+        }
+        bprintf("]%s", (j==3)?"}":",");
+    }
+early_close:
+    bprintf("}\n");
+    return g_len;
+}
+
+static void
+fill_pkg(struct rtdoabh_tag_results_pkg *p)
+{
+    struct rtdoabh_sensor_data *d = &p->sensors;
+    int i;
+
+    memset(p, 0, sizeof(*p));
+    p->head.fctrl = FCNTL_IEEE_RTDOABH;
+    p->head.code = DWT_RTDOABH_CODE;
+    p->head.src_address = 0x1234;
+    d->ts = 0x123456789aULL;
+    d->sensors_valid = GPS_LAT_LONG_ENABLED | UWB_RANGES_ENABLED | COMPASS_ENABLED |
+        ACCELEROMETER_ENABLED | GYRO_ENABLED | PRESSURE_ENABLED | BATTERY_LEVELS_ENABLED;
+    d->gps_lat = 59.334591f;
+    d->gps_long = 18.063240f;
+    d->battery_voltage = 107;
+    d->pressure = -1234;
+    for (i = 0; i < 3; i++) {
+        d->compass[i] = 100 * i - 321;
+        d->acceleration[i] = 4567 * i - 9810;
+        d->gyro[i] = 17 * i - 23;
+    }
+    p->ref_anchor_addr = 0x1001;
+    p->num_ranges = NUM_RANGES;
+    for (i = 0; i < NUM_RANGES; i++) {
+        p->ranges[i].anchor_addr = 0x1002 + i;
+        p->ranges[i].diff_dist_mm = 1234 * i - 4321;
+        p->ranges[i].rssi = -(800 + 7 * i);
+        p->ranges[i].quality = i & 1;
+    }
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char **argv)
+{
+    static struct rtdoabh_tag_results_pkg pkg;
+    static char buf[1024];
+    long n = (argc > 1) ? atol(argv[1]) : 1000000;
+    volatile int sink = 0;
+    double t0, t_int, t_printf;
+    long i;
+
+    fill_pkg(&pkg);
+
+    printf("format: %.*s", rtdoa_backhaul_format(&pkg, true, buf, sizeof(buf)), buf);
+    printf("printf: %.*s", printf_format(&pkg), g_buf);
+
+    t0 = now_ns();
+    for (i = 0; i < n; i++) {
+        sink += rtdoa_backhaul_format(&pkg, true, buf, sizeof(buf));
+    }
+    t_int = (now_ns() - t0) / n;
+
+    t0 = now_ns();
+    for (i = 0; i < n; i++) {
+        sink += printf_format(&pkg);
+    }
+    t_printf = (now_ns() - t0) / n;
+
+    printf("rtdoa_backhaul_format %8.1f ns/record %10.0f records/s\n", t_int, 1e9 / t_int);
+    printf("printf                %8.1f ns/record %10.0f records/s\n", t_printf, 1e9 / t_printf);
+    printf("speedup               %8.1fx\n", t_printf / t_int);
+    return (sink == 0);
+}
@@ -0,0 +1,178 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Host micro benchmark of the encodings a result can leave a tag or a
+ * bridge in: the packed struct as sent on air, the compressed frame of
+ * rtdoabh_zip.c, the protobuf message of rtdoa_pb.c and the json record
+ * of rtdoabh_json.c. For imu only packages and 4, 8 and 16 ranges it
+ * reports the encoded size and the time per encode. The packed struct
+ * is a copy of the package. The protobuf encoder appends to a single
+ * flat mbuf here, on target it goes through the pool. Every protobuf
+ * message is decoded again and checked against the package first.
+ * Absolute numbers are the host's, the ratios are what to watch.
+ *
+ *   make bench_pb && ./bench_pb [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+#include "rtdoa_pb.h"
+
+#define SENSORS_END     offsetof(struct rtdoabh_tag_results_pkg, ref_anchor_addr)
+#define RANGES_OFF      offsetof(struct rtdoabh_tag_results_pkg, ranges)
+
+static uint8_t g_om_buf[1024];
+static struct os_mbuf g_om = {.om_data = g_om_buf};
+
+/* One flat mbuf, large enough for any message */
+int
+os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len)
+{
+    if (om->om_len + len > sizeof(g_om_buf)) {
+        return -1;
+    }
+    memcpy(om->om_data + om->om_len, data, len);
+    om->om_len += len;
+    return 0;
+}
+
+/* Only called for mbuf backed views, which aren't used here */
+int
+os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst)
+{
+    return -1;
+}
+
+/* A tag with nranges anchors in view, imu data only with none */
+static int
+fill_pkg(struct rtdoabh_tag_results_pkg *p, int nranges)
+{
+    struct rtdoabh_sensor_data *d = &p->sensors;
+    int i;
+
+    memset(p, 0, sizeof(*p));
+    p->head.fctrl = FCNTL_IEEE_RTDOABH;
+    p->head.PANID = 0xDECA;
+    p->head.dst_address = 0xffff;
+    p->head.code = DWT_RTDOABH_CODE;
+    p->head.seq_num = 42;
+    p->head.src_address = 0x1234;
+    d->ts = 0x123456789aULL;
+    d->sensors_valid = BATTERY_LEVELS_ENABLED | PRESSURE_ENABLED;
+    d->battery_voltage = 107;
+    d->pressure = -1234;
+    if (!nranges) {
+        d->sensors_valid |= ACCELEROMETER_ENABLED | GYRO_ENABLED | COMPASS_ENABLED;
+        for (i = 0; i < 3; i++) {
+            d->compass[i] = 100 * i - 321;
+            d->acceleration[i] = 4567 * i - 9810;
+            d->gyro[i] = 17 * i - 23;
+        }
+        return SENSORS_END;
+    }
+    d->sensors_valid |= UWB_RANGES_ENABLED;
+    p->ref_anchor_addr = 0x1001;
+    p->num_ranges = nranges;
+    for (i = 0; i < nranges; i++) {
+        p->ranges[i].anchor_addr = 0x1002 + i;
+        p->ranges[i].diff_dist_mm = 1234 * i - 4321;
+        p->ranges[i].rssi = -(800 + 7 * i);
+        p->ranges[i].quality = i & 1;
+    }
+    return RANGES_OFF + nranges * sizeof(p->ranges[0]);
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const int nranges[] = {0, 4, 8, 16};
+    static struct rtdoabh_tag_results_pkg pkg, dec;
+    static uint8_t buf[1024];
+    long n = (argc > 1) ? atol(argv[1]) : 1000000;
+    volatile int sink = 0;
+    double t0, t_raw, t_zip, t_pb, t_json;
+    int k, dlen, zlen, pblen, jlen;
+    char label[8];
+    long i;
+
+    printf("%-6s %8s %8s %8s %8s   %8s %8s %8s %8s\n", "ranges",
+           "packed", "zip", "pb", "json", "packed", "zip", "pb", "json");
+    printf("%-6s %35s   %35s\n", "", "bytes", "ns/encode");
+    for (k = 0; k < sizeof(nranges) / sizeof(nranges[0]); k++) {
+        dlen = fill_pkg(&pkg, nranges[k]);
+
+        zlen = rtdoabh_zip_encode(&pkg, dlen, buf, sizeof(buf));
+        jlen = rtdoa_backhaul_format(&pkg, true, (char *)buf, sizeof(buf));
+        g_om.om_len = 0;
+        pblen = rtdoa_pb_encode(&g_om, &pkg, dlen);
+        if (pblen != rtdoa_pb_encoded_size(&pkg, dlen) ||
+            rtdoa_pb_decode(&g_om, 0, pblen, &dec) != dlen ||
+            memcmp(&pkg, &dec, dlen) != 0) {
+            printf("protobuf round trip failed for %d ranges\n", nranges[k]);
+            return 1;
+        }
+
+        t0 = now_ns();
+        for (i = 0; i < n; i++) {
+            memcpy(buf, &pkg, dlen);
+            sink += buf[i & 7];
+        }
+        t_raw = (now_ns() - t0) / n;
+
+        t0 = now_ns();
+        for (i = 0; i < n; i++) {
+            sink += rtdoabh_zip_encode(&pkg, dlen, buf, sizeof(buf));
+        }
+        t_zip = (now_ns() - t0) / n;
+
+        t0 = now_ns();
+        for (i = 0; i < n; i++) {
+            g_om.om_len = 0;
+            sink += rtdoa_pb_encode(&g_om, &pkg, dlen);
+        }
+        t_pb = (now_ns() - t0) / n;
+
+        t0 = now_ns();
+        for (i = 0; i < n; i++) {
+            sink += rtdoa_backhaul_format(&pkg, true, (char *)buf, sizeof(buf));
+        }
+        t_json = (now_ns() - t0) / n;
+
+        snprintf(label, sizeof(label), nranges[k] ? "%d" : "imu", nranges[k]);
+        printf("%-6s %8d %8d %8d %8d   %8.1f %8.1f %8.1f %8.1f\n", label,
+               dlen, zlen, pblen, jlen, t_raw, t_zip, t_pb, t_json);
+    }
+    return (sink == 0);
+}
@@ -0,0 +1,144 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Host micro benchmark of rtdoabh_collect_ranges(), the per slot cost of
+ * turning the received frames into ranges at 16 and 32 anchors. One
+ * frame in eight has no source address. The uwb-core maths is replaced
+ * by stand-ins following the DW1000 formulas: a float tdoa from the
+ * timestamps, rssi and first path power from log10f of the diagnostics,
+ * and the piecewise line of sight estimate. They are in this file and
+ * the function under test in its own, so the calls aren't inlined, as
+ * on target. Built with RTDOABH_MAXNUM_RANGES at its limit of 26.
+ *
+ *   make bench_ranges && ./bench_ranges [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+
+#define MAX_ANCHORS     (32)
+
+float
+rtdoa_tdoa_between_frames(struct rtdoa_instance *rtdoa,
+                          rtdoa_frame_t *req_frame, rtdoa_frame_t *resp_frame)
+{
+    /* 15.65 ps dw time units to m */
+    return (int64_t)(resp_frame->rx_timestamp - req_frame->rx_timestamp) * 0.0046917639786f;
+}
+
+float
+uwb_calc_rssi(struct uwb_dev *dev, struct uwb_dev_rxdiag *diag)
+{
+    float pacc = diag->pacc_cnt;
+
+    return 10.0f * log10f(diag->cir_pwr * 131072.0f / (pacc * pacc)) - 121.74f;
+}
+
+float
+uwb_calc_fppl(struct uwb_dev *dev, struct uwb_dev_rxdiag *diag)
+{
+    float pacc = diag->pacc_cnt;
+    float fp = (float)diag->fp_amp * diag->fp_amp + (float)diag->fp_amp2 * diag->fp_amp2 +
+        (float)diag->fp_amp3 * diag->fp_amp3;
+
+    return 10.0f * log10f(fp / (pacc * pacc)) - 121.74f;
+}
+
+float
+uwb_estimate_los(struct uwb_dev *dev, float rssi, float fppl)
+{
+    float d = fabsf(rssi - fppl);
+
+    if (d <= 6.0f) {
+        return 1.0f;
+    }
+    if (d >= 10.0f) {
+        return 0.0f;
+    }
+    return 1.0f - 0.25f * (d - 6.0f);
+}
+
+/* nanchors frames as received in one slot, the first is the reference */
+static void
+fill_slot(struct rtdoa_instance *rtdoa, rtdoa_frame_t *frames, rtdoa_frame_t **ptrs,
+          int nanchors)
+{
+    int i;
+
+    for (i = 0; i < nanchors; i++) {
+        rtdoa_frame_t *f = &frames[i];
+        f->src_address = (i % 8 == 7) ? 0 : 0x1001 + i;
+        f->rx_timestamp = 0x1000000000ULL + 4093 * i;
+        f->diag.fp_amp = 3000 + 37 * i;
+        f->diag.fp_amp2 = 2800 + 29 * i;
+        f->diag.fp_amp3 = 2500 + 41 * i;
+        f->diag.cir_pwr = 9000 + 311 * i;
+        f->diag.pacc_cnt = 1000 + i;
+        ptrs[i] = f;
+    }
+    rtdoa->nframes = nanchors;
+    rtdoa->req_frame = &frames[0];
+    rtdoa->frames = ptrs;
+}
+
+static double
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(int argc, char **argv)
+{
+    static const int nanchors[] = {16, 32};
+    static rtdoa_frame_t frames[MAX_ANCHORS];
+    static rtdoa_frame_t *ptrs[MAX_ANCHORS];
+    static struct rtdoabh_tag_results_pkg pkg;
+    struct rtdoa_instance rtdoa;
+    long n = (argc > 1) ? atol(argv[1]) : 1000000;
+    volatile int sink = 0;
+    int k, nranges;
+    double t;
+    long i;
+
+    printf("%-8s %8s %10s %10s\n", "anchors", "ranges", "ns/slot", "ns/range");
+    for (k = 0; k < sizeof(nanchors) / sizeof(nanchors[0]); k++) {
+        fill_slot(&rtdoa, frames, ptrs, nanchors[k]);
+        nranges = rtdoabh_collect_ranges(NULL, &rtdoa, &pkg);
+
+        t = now_ns();
+        for (i = 0; i < n; i++) {
+            sink += rtdoabh_collect_ranges(NULL, &rtdoa, &pkg);
+        }
+        t = (now_ns() - t) / n;
+        printf("%-8d %8d %10.1f %10.1f\n", nanchors[k], nranges, t, t / nranges);
+    }
+    return (sink == 0);
+}
@@ -0,0 +1,836 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Header only host decoder for rtdoa backhaul results. Decodes plain,
+ * aggregate, compressed and protobuf frames, as received over the air,
+ * and the SLIP framed binary output of a bridge into a columnar Batch,
+ * one vector per field. Needs C++11 and nothing else.
+ *
+ * All reads go through memcpy on byte pointers, so input buffers may
+ * have any alignment. Multi byte fields are little endian on the wire,
+ * the loads below assume a little endian host.
+ *
+ *   rtdoabh::Batch batch;
+ *   rtdoabh::SlipDecoder slip;
+ *   slip.feed(buf, len, batch);
+ */
+
+#ifndef _RTDOABH_DECODE_HPP_
+#define _RTDOABH_DECODE_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace rtdoabh {
+
+/* Frame codes, as in rtdoa_backhaul.h */
+static const uint16_t CODE = 0x6003;
+static const uint16_t AGG_CODE = 0x6004;
+static const uint16_t ZIP_CODE = 0x6005;
+static const uint16_t PB_CODE = 0x6006;
+static const uint16_t RELAY_CODE = 0x6007;
+static const uint8_t ZIP_VERSION = 1;
+
+/* SLIP frame types of the bridge binary output */
+static const uint8_t FRAME_TAG_RESULTS = 0x01;
+static const uint8_t FRAME_TAG_RESULTS_PB = 0x02;
+
+/* sensors_valid bits */
+static const uint16_t GPS_LAT_LONG_ENABLED = 0x0001;
+static const uint16_t COMPASS_ENABLED = 0x0008;
+static const uint16_t ACCELEROMETER_ENABLED = 0x0010;
+static const uint16_t GYRO_ENABLED = 0x0020;
+static const uint16_t PRESSURE_ENABLED = 0x0040;
+static const uint16_t BATTERY_LEVELS_ENABLED = 0x0080;
+
+/* Offsets into the packed rtdoabh_tag_results_pkg */
+static const size_t HEAD_LEN = 11;
+static const size_t SENSORS_LEN = 39;
+static const size_t SENSORS_END = HEAD_LEN + SENSORS_LEN;
+static const size_t RANGES_OFF = SENSORS_END + 3;
+static const size_t RANGE_LEN = 8;
+
+/**
+ * Decoded results in columns. Per result columns have size() entries,
+ * the three axes of compass, acceleration and gyro are interleaved, 3
+ * entries per result. The ranges of result i are range_begin[i] to
+ * range_begin[i] + num_ranges[i] in the per range columns.
+ */
+struct Batch {
+    /* per result */
+    std::vector<uint16_t> src_address;
+    std::vector<uint8_t> seq_num;
+    std::vector<uint64_t> ts;
+    std::vector<uint16_t> sensors_valid;    /**< low 14 bits only */
+    std::vector<uint8_t> has_usb_power;
+    std::vector<uint8_t> is_anchor_data;
+    std::vector<float> gps_lat;
+    std::vector<float> gps_long;
+    std::vector<int8_t> battery_voltage;
+    std::vector<int16_t> pressure;
+    std::vector<int16_t> compass;
+    std::vector<int16_t> acceleration;
+    std::vector<int16_t> gyro;
+    std::vector<uint8_t> has_ranges;        /**< 0 for imu only results */
+    std::vector<uint16_t> ref_anchor_addr;
+    std::vector<uint32_t> range_begin;
+    std::vector<uint8_t> num_ranges;
+
+    /* per range */
+    std::vector<uint16_t> anchor_addr;
+    std::vector<int32_t> diff_dist_mm;
+    std::vector<int16_t> rssi;
+    std::vector<int8_t> quality;
+
+    size_t size() const { return src_address.size(); }
+    size_t range_count() const { return anchor_addr.size(); }
+
+    void reserve(size_t results, size_t ranges)
+    {
+        src_address.reserve(results);
+        seq_num.reserve(results);
+        ts.reserve(results);
+        sensors_valid.reserve(results);
+        has_usb_power.reserve(results);
+        is_anchor_data.reserve(results);
+        gps_lat.reserve(results);
+        gps_long.reserve(results);
+        battery_voltage.reserve(results);
+        pressure.reserve(results);
+        compass.reserve(3 * results);
+        acceleration.reserve(3 * results);
+        gyro.reserve(3 * results);
+        has_ranges.reserve(results);
+        ref_anchor_addr.reserve(results);
+        range_begin.reserve(results);
+        num_ranges.reserve(results);
+        anchor_addr.reserve(ranges);
+        diff_dist_mm.reserve(ranges);
+        rssi.reserve(ranges);
+        quality.reserve(ranges);
+    }
+
+    void clear() { truncate(0, 0); }
+
+    /** Drop results and ranges beyond the given counts */
+    void truncate(size_t results, size_t ranges)
+    {
+        src_address.resize(results);
+        seq_num.resize(results);
+        ts.resize(results);
+        sensors_valid.resize(results);
+        has_usb_power.resize(results);
+        is_anchor_data.resize(results);
+        gps_lat.resize(results);
+        gps_long.resize(results);
+        battery_voltage.resize(results);
+        pressure.resize(results);
+        compass.resize(3 * results);
+        acceleration.resize(3 * results);
+        gyro.resize(3 * results);
+        has_ranges.resize(results);
+        ref_anchor_addr.resize(results);
+        range_begin.resize(results);
+        num_ranges.resize(results);
+        anchor_addr.resize(ranges);
+        diff_dist_mm.resize(ranges);
+        rssi.resize(ranges);
+        quality.resize(ranges);
+    }
+};
+
+namespace detail {
+
+template <typename T>
+inline T
+load(const uint8_t *p)
+{
+    T v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+inline int32_t
+unzigzag(uint64_t v)
+{
+    return (int32_t)((uint32_t)v >> 1) ^ -(int32_t)(v & 1);
+}
+
+/* Sign extend into the rssi:14 and quality:2 bitfields of a range */
+inline int16_t
+rssi14(int32_t v)
+{
+    return (int16_t)(((v & 0x3fff) ^ 0x2000) - 0x2000);
+}
+
+inline int8_t
+quality2(int32_t v)
+{
+    return (int8_t)(((v & 0x3) ^ 0x2) - 0x2);
+}
+
+inline void
+put_xyz(std::vector<int16_t> &col, const int16_t v[3])
+{
+    col.push_back(v[0]);
+    col.push_back(v[1]);
+    col.push_back(v[2]);
+}
+
+/* One result with its sensor fields, pushed column by column */
+struct Sensors {
+    uint16_t src_address;
+    uint8_t seq_num;
+    uint64_t ts;
+    uint16_t flags;
+    float gps_lat;
+    float gps_long;
+    int8_t battery_voltage;
+    int16_t pressure;
+    int16_t compass[3];
+    int16_t acceleration[3];
+    int16_t gyro[3];
+};
+
+inline void
+push_sensors(Batch &b, const Sensors &s, bool has_ranges, uint16_t ref)
+{
+    b.src_address.push_back(s.src_address);
+    b.seq_num.push_back(s.seq_num);
+    b.ts.push_back(s.ts);
+    b.sensors_valid.push_back(s.flags & 0x3fff);
+    b.has_usb_power.push_back((s.flags >> 14) & 1);
+    b.is_anchor_data.push_back((s.flags >> 15) & 1);
+    b.gps_lat.push_back(s.gps_lat);
+    b.gps_long.push_back(s.gps_long);
+    b.battery_voltage.push_back(s.battery_voltage);
+    b.pressure.push_back(s.pressure);
+    put_xyz(b.compass, s.compass);
+    put_xyz(b.acceleration, s.acceleration);
+    put_xyz(b.gyro, s.gyro);
+    b.has_ranges.push_back(has_ranges);
+    b.ref_anchor_addr.push_back(ref);
+    b.range_begin.push_back((uint32_t)b.anchor_addr.size());
+    b.num_ranges.push_back(0);
+}
+
+inline void
+push_range(Batch &b, uint16_t addr, int32_t dd, int16_t rssi, int8_t quality)
+{
+    b.anchor_addr.push_back(addr);
+    b.diff_dist_mm.push_back(dd);
+    b.rssi.push_back(rssi);
+    b.quality.push_back(quality);
+}
+
+/* Close the range list of the last result */
+inline void
+end_ranges(Batch &b)
+{
+    b.num_ranges.back() = b.range_count() - b.range_begin.back();
+}
+
+/* Bounds checked cursor, reads past the end return 0 and set err */
+struct Reader {
+    const uint8_t *p;
+    const uint8_t *end;
+    bool err;
+
+    Reader(const uint8_t *buf, size_t len) : p(buf), end(buf + len), err(false) {}
+
+    size_t left() const { return end - p; }
+
+    uint8_t u8()
+    {
+        if (p >= end) {
+            err = true;
+            return 0;
+        }
+        return *p++;
+    }
+
+    template <typename T>
+    T raw()
+    {
+        if (left() < sizeof(T)) {
+            err = true;
+            p = end;
+            return T();
+        }
+        T v = load<T>(p);
+        p += sizeof(T);
+        return v;
+    }
+
+    uint64_t uvar()
+    {
+        uint64_t v = 0;
+        uint8_t c;
+        int shift = 0;
+
+        do {
+            c = u8();
+            if (shift < 64) {
+                v |= (uint64_t)(c & 0x7f) << shift;
+            }
+            shift += 7;
+        } while ((c & 0x80) && !err);
+        return v;
+    }
+
+    int32_t svar() { return unzigzag(uvar()); }
+
+    void svar3(int16_t v[3])
+    {
+        v[0] = svar();
+        v[1] = svar();
+        v[2] = svar();
+    }
+
+    void skip(size_t n)
+    {
+        if (left() < n) {
+            err = true;
+            p = end;
+            return;
+        }
+        p += n;
+    }
+};
+
+/*
+ * Plain package body, everything after the ieee header. Short bodies
+ * are zero padded, as the bridge does.
+ */
+inline bool
+decode_body(Batch &b, uint16_t src, uint8_t seq, const uint8_t *body, size_t len)
+{
+    uint8_t s[SENSORS_LEN + 3] = {0};
+    Sensors d;
+    size_t i, n;
+
+    std::memcpy(s, body, (len < sizeof(s)) ? len : sizeof(s));
+    d.src_address = src;
+    d.seq_num = seq;
+    d.ts = load<uint64_t>(s);
+    d.flags = load<uint16_t>(s + 8);
+    d.gps_lat = load<float>(s + 10);
+    d.gps_long = load<float>(s + 14);
+    d.battery_voltage = (int8_t)s[18];
+    d.pressure = load<int16_t>(s + 19);
+    std::memcpy(d.compass, s + 21, 6);
+    std::memcpy(d.acceleration, s + 27, 6);
+    std::memcpy(d.gyro, s + 33, 6);
+    push_sensors(b, d, len > SENSORS_LEN, load<uint16_t>(s + SENSORS_LEN));
+
+    n = s[SENSORS_LEN + 2];
+    body += sizeof(s);
+    len = (len > sizeof(s)) ? len - sizeof(s) : 0;
+    if (n > len / RANGE_LEN) {
+        n = len / RANGE_LEN;
+    }
+    for (i = 0; i < n; i++, body += RANGE_LEN) {
+        uint16_t w = load<uint16_t>(body + 6);
+        push_range(b, load<uint16_t>(body), load<int32_t>(body + 2),
+                   rssi14(w), quality2(w >> 14));
+    }
+    end_ranges(b);
+    return true;
+}
+
+inline bool
+skip_pb(Reader &in, int wt)
+{
+    switch (wt) {
+    case 0:
+        in.uvar();
+        break;
+    case 1:
+        in.skip(8);
+        break;
+    case 2:
+        in.skip(in.uvar());
+        break;
+    case 5:
+        in.skip(4);
+        break;
+    default:
+        in.err = true;
+    }
+    return !in.err;
+}
+
+/* Packed or unpacked repeated sint32, extra elements are dropped */
+inline void
+pb_xyz(Reader &in, int wt, int16_t v[3], int &idx)
+{
+    const uint8_t *end;
+
+    if (wt == 0) {
+        end = in.p;
+    } else if (wt == 2) {
+        uint64_t n = in.uvar();
+        if (n > in.left()) {
+            in.err = true;
+            return;
+        }
+        end = in.p + n;
+    } else {
+        skip_pb(in, wt);
+        return;
+    }
+    do {
+        int32_t s = in.svar();
+        if (idx < 3) {
+            v[idx++] = s;
+        }
+    } while (in.p < end && !in.err);
+}
+
+inline void
+pb_range(Reader &in, Batch &b)
+{
+    uint64_t n = in.uvar();
+    uint16_t addr = 0;
+    int32_t dd = 0, rssi = 0, quality = 0;
+
+    if (n > in.left()) {
+        in.err = true;
+        return;
+    }
+    Reader r(in.p, n);
+    in.p += n;
+    while (r.left() && !r.err) {
+        uint32_t key = r.uvar();
+        if ((key & 7) != 0) {
+            skip_pb(r, key & 7);
+            continue;
+        }
+        uint64_t v = r.uvar();
+        switch (key >> 3) {
+        case 1:
+            addr = v;
+            break;
+        case 2:
+            dd = unzigzag(v);
+            break;
+        case 3:
+            rssi = unzigzag(v);
+            break;
+        case 4:
+            quality = unzigzag(v);
+            break;
+        }
+    }
+    if (r.err) {
+        in.err = true;
+        return;
+    }
+    push_range(b, addr, dd, rssi14(rssi), quality2(quality));
+}
+
+}  /* namespace detail */
+
+/**
+ * Decode a plain package, frame code CODE, with its ieee header. This is
+ * also the payload of a FRAME_TAG_RESULTS SLIP frame.
+ *
+ * @return true if a result was added to b
+ */
+inline bool
+decode_plain(Batch &b, const uint8_t *buf, size_t len)
+{
+    if (len < HEAD_LEN) {
+        return false;
+    }
+    return detail::decode_body(b, detail::load<uint16_t>(buf + 7), buf[2],
+                               buf + HEAD_LEN, len - HEAD_LEN);
+}
+
+/**
+ * Decode a compressed frame, frame code ZIP_CODE, in the format
+ * described in src/rtdoabh_zip.c. Trailing bytes are ignored.
+ *
+ * @return true if a result was added to b, nothing is added to a
+ *         malformed frame or one of an unknown version
+ */
+inline bool
+decode_zip(Batch &b, const uint8_t *buf, size_t len)
+{
+    detail::Reader in(buf, len);
+    detail::Sensors d = detail::Sensors();
+    size_t results = b.size(), ranges = b.range_count();
+    uint16_t ref = 0;
+    uint8_t version;
+    int i, n;
+
+    if (len < HEAD_LEN + 1) {
+        return false;
+    }
+    d.seq_num = buf[2];
+    d.src_address = detail::load<uint16_t>(buf + 7);
+    in.skip(HEAD_LEN);
+    version = in.u8();
+    if ((version & 0x7f) != ZIP_VERSION) {
+        return false;
+    }
+    d.flags = in.u8();
+    d.flags |= in.u8() << 8;
+    d.ts = in.uvar();
+    if (d.flags & GPS_LAT_LONG_ENABLED) {
+        d.gps_lat = in.raw<float>();
+        d.gps_long = in.raw<float>();
+    }
+    if (d.flags & BATTERY_LEVELS_ENABLED) {
+        d.battery_voltage = in.u8();
+    }
+    if (d.flags & PRESSURE_ENABLED) {
+        d.pressure = in.svar();
+    }
+    if (d.flags & COMPASS_ENABLED) {
+        in.svar3(d.compass);
+    }
+    if (d.flags & ACCELEROMETER_ENABLED) {
+        in.svar3(d.acceleration);
+    }
+    if (d.flags & GYRO_ENABLED) {
+        in.svar3(d.gyro);
+    }
+    if (version & 0x80) {
+        ref = in.uvar();
+    }
+    if (in.err) {
+        return false;
+    }
+    detail::push_sensors(b, d, version & 0x80, ref);
+    if (!(version & 0x80)) {
+        return true;
+    }
+
+    n = in.u8();
+    for (i = 0; i < n && !in.err; i++) {
+        uint16_t addr = ref + in.svar();
+        int32_t dd = in.svar();
+        uint32_t rq = in.uvar();
+        detail::push_range(b, addr, dd, detail::rssi14(detail::unzigzag(rq >> 2)),
+                           detail::quality2(rq));
+    }
+    if (in.err) {
+        b.truncate(results, ranges);
+        return false;
+    }
+    detail::end_ranges(b);
+    return true;
+}
+
+/**
+ * Decode a TagResult message of proto/rtdoa_backhaul.proto, the payload
+ * of a FRAME_TAG_RESULTS_PB SLIP frame. Unknown fields are skipped.
+ *
+ * @return true if a result was added to b
+ */
+inline bool
+decode_pb_message(Batch &b, const uint8_t *buf, size_t len)
+{
+    detail::Reader in(buf, len);
+    detail::Sensors d = detail::Sensors();
+    size_t results = b.size(), ranges = b.range_count();
+    bool has_ranges = false;
+    uint16_t ref = 0;
+    int ci = 0, ai = 0, gi = 0;
+
+    /* Ranges land in their columns as they come, the result row once
+     * the whole message is known to be good */
+    while (in.left() && !in.err) {
+        uint32_t key = in.uvar();
+        uint32_t field = key >> 3;
+        int wt = key & 7;
+        bool xyz = (field >= 9 && field <= 11 && (wt == 0 || wt == 2));
+
+        if (!xyz && wt != ((field == 5 || field == 6) ? 5 :
+                           (field == 13) ? 2 : 0)) {
+            detail::skip_pb(in, wt);
+            continue;
+        }
+        switch (field) {
+        case 1:
+            d.src_address = in.uvar();
+            break;
+        case 2:
+            d.seq_num = in.uvar();
+            break;
+        case 3:
+            d.ts = in.uvar();
+            break;
+        case 4:
+            d.flags = in.uvar();
+            break;
+        case 5:
+            d.gps_lat = in.raw<float>();
+            break;
+        case 6:
+            d.gps_long = in.raw<float>();
+            break;
+        case 7:
+            d.battery_voltage = detail::unzigzag(in.uvar());
+            break;
+        case 8:
+            d.pressure = detail::unzigzag(in.uvar());
+            break;
+        case 9:
+            detail::pb_xyz(in, wt, d.compass, ci);
+            break;
+        case 10:
+            detail::pb_xyz(in, wt, d.acceleration, ai);
+            break;
+        case 11:
+            detail::pb_xyz(in, wt, d.gyro, gi);
+            break;
+        case 12:
+            ref = in.uvar();
+            has_ranges = true;
+            break;
+        case 13:
+            has_ranges = true;
+            if (b.range_count() - ranges < 255) {
+                detail::pb_range(in, b);
+            } else {
+                detail::skip_pb(in, wt);
+            }
+            break;
+        default:
+            detail::skip_pb(in, wt);
+            break;
+        }
+    }
+    if (in.err) {
+        b.truncate(results, ranges);
+        return false;
+    }
+
+    detail::push_sensors(b, d, has_ranges, ref);
+    b.range_begin.back() = ranges;
+    detail::end_ranges(b);
+    return true;
+}
+
+/**
+ * Decode a protobuf frame, frame code PB_CODE: the ieee header, the
+ * message length as a varint, then the message.
+ */
+inline bool
+decode_pb(Batch &b, const uint8_t *buf, size_t len)
+{
+    detail::Reader in(buf, len);
+    uint64_t n;
+
+    in.skip(HEAD_LEN);
+    n = in.uvar();
+    if (in.err || n > in.left()) {
+        return false;
+    }
+    return decode_pb_message(b, in.p, n);
+}
+
+/**
+ * Decode an aggregate frame, frame code AGG_CODE. Each record is
+ * len(1) | seq_num(1) | src_address(2, le) | body(len) with body the
+ * plain package after its ieee header. Decoding stops at a record of
+ * impossible length, which is how the trailing fcs is skipped.
+ *
+ * @return Number of results added to b
+ */
+inline int
+decode_agg(Batch &b, const uint8_t *buf, size_t len)
+{
+    const size_t body_min = SENSORS_LEN;
+    const size_t body_max = 255;
+    size_t off = HEAD_LEN;
+    int n = 0;
+
+    while (off + 4 <= len) {
+        size_t rlen = buf[off];
+        if (rlen < body_min || rlen > body_max || off + 4 + rlen > len) {
+            break;
+        }
+        detail::decode_body(b, detail::load<uint16_t>(buf + off + 2), buf[off + 1],
+                            buf + off + 4, rlen);
+        off += 4 + rlen;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Decode a frame as received over the air, dispatching on its code.
+ * Frames forwarded by a relay are decoded as the original frame.
+ *
+ * @return Number of results added to b, -1 for frames that are not
+ *         backhaul results
+ */
+inline int
+decode_frame(Batch &b, const uint8_t *buf, size_t len)
+{
+    if (len < HEAD_LEN) {
+        return -1;
+    }
+    switch (detail::load<uint16_t>(buf + 9)) {
+    case CODE:
+        return decode_plain(b, buf, len);
+    case AGG_CODE:
+        return decode_agg(b, buf, len);
+    case ZIP_CODE:
+        return decode_zip(b, buf, len);
+    case PB_CODE:
+        return decode_pb(b, buf, len);
+    case RELAY_CODE:
+        /* Relay header and hop count in front of the original frame */
+        if (len < HEAD_LEN + 1) {
+            return -1;
+        }
+        return decode_frame(b, buf + HEAD_LEN + 1, len - HEAD_LEN - 1);
+    default:
+        return -1;
+    }
+}
+
+/** crc16-ccitt, polynomial 0x1021, as used by the bridge SLIP output */
+inline uint16_t
+crc16_ccitt(uint16_t crc, const uint8_t *buf, size_t len)
+{
+    static struct table {
+        uint16_t t[256];
+        table()
+        {
+            for (int i = 0; i < 256; i++) {
+                uint16_t c = i << 8;
+                for (int j = 0; j < 8; j++) {
+                    c = (c & 0x8000) ? (c << 1) ^ 0x1021 : c << 1;
+                }
+                t[i] = c;
+            }
+        }
+    } tab;
+
+    while (len--) {
+        crc = (crc << 8) ^ tab.t[(crc >> 8) ^ *buf++];
+    }
+    return crc;
+}
+
+/**
+ * Incremental decoder for the SLIP framed binary output of a bridge,
+ * see the README. Feed it whatever the serial port or socket returns,
+ * frames may be split anywhere.
+ */
+class SlipDecoder {
+public:
+    enum : uint8_t {
+        END = 0xC0,
+        ESC = 0xDB,
+        ESC_END = 0xDC,
+        ESC_ESC = 0xDD,
+        ESC_LF = 0xDE,
+        ESC_CR = 0xDF,
+    };
+
+    SlipDecoder() : m_esc(false), m_bad(0) { m_frame.reserve(512); }
+
+    /**
+     * @return Number of results added to b
+     */
+    size_t feed(const uint8_t *buf, size_t len, Batch &b)
+    {
+        size_t n = b.size();
+        const uint8_t *end = buf + len;
+
+        while (buf < end) {
+            /* Copy plain runs in one go, stop at END or ESC */
+            const uint8_t *p = buf;
+            if (!m_esc) {
+                while (p < end && *p != END && *p != ESC) {
+                    p++;
+                }
+                m_frame.insert(m_frame.end(), buf, p);
+                if (p == end) {
+                    break;
+                }
+            }
+            uint8_t c = *p;
+            buf = p + 1;
+            if (c == END) {
+                if (!m_frame.empty()) {
+                    frame(b);
+                }
+                m_frame.clear();
+                m_esc = false;
+            } else if (m_esc) {
+                m_frame.push_back((c == ESC_END) ? (uint8_t)END :
+                                  (c == ESC_ESC) ? (uint8_t)ESC :
+                                  (c == ESC_LF) ? (uint8_t)0x0A :
+                                  (c == ESC_CR) ? (uint8_t)0x0D : c);
+                m_esc = false;
+            } else {
+                m_esc = true;
+            }
+        }
+        return b.size() - n;
+    }
+
+    /** Frames dropped for a bad length, crc or payload */
+    uint32_t bad() const { return m_bad; }
+
+private:
+    void frame(Batch &b)
+    {
+        const uint8_t *f = m_frame.data();
+        size_t len = m_frame.size();
+        bool ok;
+
+        if (len < 5 || detail::load<uint16_t>(f + 1) != len - 5 ||
+            crc16_ccitt(0, f, len - 2) != detail::load<uint16_t>(f + len - 2)) {
+            m_bad++;
+            return;
+        }
+        switch (f[0]) {
+        case FRAME_TAG_RESULTS:
+            ok = decode_plain(b, f + 3, len - 5);
+            break;
+        case FRAME_TAG_RESULTS_PB:
+            ok = decode_pb_message(b, f + 3, len - 5);
+            break;
+        default:
+            return;
+        }
+        if (!ok) {
+            m_bad++;
+        }
+    }
+
+    std::vector<uint8_t> m_frame;
+    bool m_esc;
+    uint32_t m_bad;
+};
+
+}  /* namespace rtdoabh */
+
+#endif /* _RTDOABH_DECODE_HPP_ */
@@ -0,0 +1,58 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/* Just enough of os/mynewt.h to build the formatting sources of this
+ * package on the host, see ../Makefile. */
+
+#ifndef _SHIM_MYNEWT_H_
+#define _SHIM_MYNEWT_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MYNEWT_VAL(_name) MYNEWT_VAL_ ## _name
+
+#ifndef MYNEWT_VAL_RTDOABH_MAXNUM_RANGES
+#define MYNEWT_VAL_RTDOABH_MAXNUM_RANGES (16)
+#endif
+#ifndef MYNEWT_VAL_RTDOABH_COMPACT_MEAS
+#define MYNEWT_VAL_RTDOABH_COMPACT_MEAS (1)
+#endif
+
+#define OS_EINVAL   (2)
+
+struct os_event;
+
+struct os_mbuf {
+    uint8_t *om_data;
+    uint16_t om_len;
+    struct {
+        struct os_mbuf *sle_next;
+    } om_next;
+};
+
+#define SLIST_NEXT(_elm, _field)    ((_elm)->_field.sle_next)
+/* Mbuf backed package views aren't used on the host */
+#define OS_MBUF_PKTLEN(_om)         (0)
+
+int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst);
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len);
+
+#endif
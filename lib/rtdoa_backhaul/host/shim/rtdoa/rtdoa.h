@@ -0,0 +1,42 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _SHIM_RTDOA_H_
+#define _SHIM_RTDOA_H_
+
+#include <uwb/uwb.h>
+
+/* The fields of uwb-core's frame and instance that rtdoabh_ranges.c
+ * reads, the maths is up to the benchmark */
+typedef struct _rtdoa_frame_t {
+    uint16_t src_address;
+    uint64_t rx_timestamp;
+    struct uwb_dev_rxdiag diag;
+} rtdoa_frame_t;
+
+struct rtdoa_instance {
+    uint16_t nframes;
+    rtdoa_frame_t *req_frame;
+    rtdoa_frame_t **frames;
+};
+
+float rtdoa_tdoa_between_frames(struct rtdoa_instance *rtdoa,
+                                rtdoa_frame_t *req_frame, rtdoa_frame_t *resp_frame);
+
+#endif
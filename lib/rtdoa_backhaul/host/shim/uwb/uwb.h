@@ -0,0 +1,40 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _SHIM_UWB_H_
+#define _SHIM_UWB_H_
+
+#include <stdint.h>
+
+struct uwb_dev;
+struct uwb_dev_status;
+
+struct uwb_dev_rxdiag {
+    uint16_t fp_amp;
+    uint16_t fp_amp2;
+    uint16_t fp_amp3;
+    uint16_t cir_pwr;
+    uint16_t pacc_cnt;
+};
+
+float uwb_calc_rssi(struct uwb_dev *dev, struct uwb_dev_rxdiag *diag);
+float uwb_calc_fppl(struct uwb_dev *dev, struct uwb_dev_rxdiag *diag);
+float uwb_estimate_los(struct uwb_dev *dev, float rssi, float fppl);
+
+#endif
@@ -0,0 +1,34 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _SHIM_UWB_FTYPES_H_
+#define _SHIM_UWB_FTYPES_H_
+
+#include <stdint.h>
+
+struct _ieee_rng_request_frame_t {
+    uint16_t fctrl;
+    uint8_t seq_num;
+    uint16_t PANID;
+    uint16_t dst_address;
+    uint16_t src_address;
+    uint16_t code;
+} __attribute__((packed, aligned(1)));
+
+#endif
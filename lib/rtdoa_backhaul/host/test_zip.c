@@ -0,0 +1,247 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Host test of the compressed format. Runs a set of fixed packages
+ * through rtdoabh_zip_encode() and rtdoabh_zip_decode() and checks they
+ * come back unchanged: imu only, max ranges, anchor addresses on both
+ * sides of the reference and across 0, negative distances and the
+ * limits of every field. Corrupt and cut short frames must be
+ * rejected. With a file argument each package and its compressed frame
+ * are written to it as a line of two hex strings, which
+ * scripts/rtdoabh_zip.py --vectors checks against the python encoder.
+ *
+ *   make test
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+
+#define MAX_RANGES      MYNEWT_VAL(RTDOABH_MAXNUM_RANGES)
+#define SENSORS_END     offsetof(struct rtdoabh_tag_results_pkg, ref_anchor_addr)
+#define RANGES_OFF      offsetof(struct rtdoabh_tag_results_pkg, ranges)
+
+#define ALL_SENSORS (GPS_LAT_LONG_ENABLED | COMPASS_ENABLED | ACCELEROMETER_ENABLED | \
+                     GYRO_ENABLED | PRESSURE_ENABLED | BATTERY_LEVELS_ENABLED)
+
+static int g_failed;
+
+static void
+head_init(struct rtdoabh_tag_results_pkg *p, uint16_t src, uint8_t seq)
+{
+    memset(p, 0, sizeof(*p));
+    p->head.fctrl = FCNTL_IEEE_RTDOABH;
+    p->head.seq_num = seq;
+    p->head.PANID = 0xDECA;
+    p->head.dst_address = 0xffff;
+    p->head.src_address = src;
+    p->head.code = DWT_RTDOABH_CODE;
+}
+
+/* Fill the fields marked valid, the others stay 0 as they don't
+ * survive the round trip */
+static void
+sensors_set(struct rtdoabh_sensor_data *d, int16_t v)
+{
+    int i;
+
+    if (d->sensors_valid & GPS_LAT_LONG_ENABLED) {
+        d->gps_lat = -33.856784f;
+        d->gps_long = 151.215297f;
+    }
+    if (d->sensors_valid & BATTERY_LEVELS_ENABLED) {
+        d->battery_voltage = (int8_t)v;
+    }
+    if (d->sensors_valid & PRESSURE_ENABLED) {
+        d->pressure = v;
+    }
+    for (i = 0; i < 3; i++) {
+        if (d->sensors_valid & COMPASS_ENABLED) {
+            d->compass[i] = v - i;
+        }
+        if (d->sensors_valid & ACCELEROMETER_ENABLED) {
+            d->acceleration[i] = -v + i;
+        }
+        if (d->sensors_valid & GYRO_ENABLED) {
+            d->gyro[i] = v ^ i;
+        }
+    }
+}
+
+/* Imu only, cut before the range block as on air */
+static int
+pkg_imu(struct rtdoabh_tag_results_pkg *p)
+{
+    head_init(p, 0x1234, 7);
+    p->sensors.ts = 0x123456789aULL;
+    p->sensors.sensors_valid = ALL_SENSORS;
+    p->sensors.has_usb_power = 1;
+    sensors_set(&p->sensors, -1234);
+    return SENSORS_END;
+}
+
+/* Every range slot used, anchors below and above the reference,
+ * negative distances and rssi, all four quality values */
+static int
+pkg_max_ranges(struct rtdoabh_tag_results_pkg *p)
+{
+    int i;
+
+    head_init(p, 0xbeef, 255);
+    p->sensors.ts = 0;
+    p->sensors.sensors_valid = UWB_RANGES_ENABLED | PRESSURE_ENABLED | GYRO_ENABLED;
+    sensors_set(&p->sensors, 321);
+    p->ref_anchor_addr = 0x1008;
+    p->num_ranges = MAX_RANGES;
+    for (i = 0; i < MAX_RANGES; i++) {
+        p->ranges[i].anchor_addr = 0x1008 + 3 * (i - MAX_RANGES / 2);
+        p->ranges[i].diff_dist_mm = (i & 1) ? -1000 * i - 7 : 999 * i;
+        p->ranges[i].rssi = -300 - 17 * i;
+        p->ranges[i].quality = (i % 4) - 2;
+    }
+    return RANGES_OFF + MAX_RANGES * sizeof(p->ranges[0]);
+}
+
+/* Limits of every field, anchor addresses that wrap around 0 */
+static int
+pkg_limits(struct rtdoabh_tag_results_pkg *p)
+{
+    head_init(p, 0xffff, 0);
+    p->sensors.ts = UINT64_MAX;
+    p->sensors.sensors_valid = UWB_RANGES_ENABLED | ALL_SENSORS;
+    p->sensors.has_usb_power = 1;
+    p->sensors.is_anchor_data = 1;
+    sensors_set(&p->sensors, INT16_MIN);
+    p->sensors.acceleration[2] = INT16_MAX;
+    p->ref_anchor_addr = 0x0002;
+    p->num_ranges = 4;
+    p->ranges[0].anchor_addr = 0xfffe;
+    p->ranges[0].diff_dist_mm = INT32_MIN;
+    p->ranges[0].rssi = -8192;
+    p->ranges[0].quality = -2;
+    p->ranges[1].anchor_addr = 0x8001;
+    p->ranges[1].diff_dist_mm = INT32_MAX;
+    p->ranges[1].rssi = 8191;
+    p->ranges[1].quality = 1;
+    p->ranges[2].anchor_addr = 0x0002;
+    p->ranges[2].diff_dist_mm = 0;
+    p->ranges[2].rssi = 0;
+    p->ranges[2].quality = 0;
+    p->ranges[3].anchor_addr = 0x0000;
+    p->ranges[3].diff_dist_mm = -1;
+    p->ranges[3].rssi = -1;
+    p->ranges[3].quality = -1;
+    return RANGES_OFF + 4 * sizeof(p->ranges[0]);
+}
+
+/* Range block present but empty */
+static int
+pkg_no_ranges(struct rtdoabh_tag_results_pkg *p)
+{
+    head_init(p, 0x0001, 1);
+    p->sensors.ts = 127;
+    p->sensors.sensors_valid = UWB_RANGES_ENABLED;
+    p->ref_anchor_addr = 0x4321;
+    return RANGES_OFF;
+}
+
+static void
+hex(FILE *f, const void *buf, int len)
+{
+    const uint8_t *p = buf;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        fprintf(f, "%02x", p[i]);
+    }
+}
+
+static void
+check(const char *name, int (*make)(struct rtdoabh_tag_results_pkg *), FILE *vectors)
+{
+    static struct rtdoabh_tag_results_pkg p, q;
+    static uint8_t buf[sizeof(struct rtdoabh_tag_results_pkg) + 16];
+    int dlen = make(&p);
+    int failed = g_failed;
+    int len, qlen, i;
+
+    len = rtdoabh_zip_encode(&p, dlen, buf, sizeof(buf));
+    if (len < 0) {
+        printf("FAIL %s: encode\n", name);
+        g_failed++;
+        return;
+    }
+    qlen = rtdoabh_zip_decode(buf, len, &q);
+    if (qlen != dlen || memcmp(&p, &q, dlen) != 0) {
+        printf("FAIL %s: round trip, %d bytes back for %d\n", name, qlen, dlen);
+        g_failed++;
+        return;
+    }
+    if (rtdoabh_zip_encode(&p, dlen, buf, len - 1) >= 0) {
+        printf("FAIL %s: encode into a short buffer\n", name);
+        g_failed++;
+    }
+    for (i = sizeof(p.head); i < len; i++) {
+        if (rtdoabh_zip_decode(buf, i, &q) >= 0) {
+            printf("FAIL %s: frame cut at %d decoded\n", name, i);
+            g_failed++;
+            break;
+        }
+    }
+    buf[sizeof(p.head)] ^= 0x7f;
+    if (rtdoabh_zip_decode(buf, len, &q) >= 0) {
+        printf("FAIL %s: unknown version decoded\n", name);
+        g_failed++;
+    }
+    buf[sizeof(p.head)] ^= 0x7f;
+
+    if (g_failed == failed) {
+        printf("ok   %-12s %4d -> %3d bytes\n", name, dlen, len);
+    }
+    if (vectors) {
+        hex(vectors, &p, dlen);
+        fputc(' ', vectors);
+        hex(vectors, buf, len);
+        fputc('\n', vectors);
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    FILE *vectors = NULL;
+
+    if (argc > 1 && !(vectors = fopen(argv[1], "w"))) {
+        perror(argv[1]);
+        return 1;
+    }
+    check("imu", pkg_imu, vectors);
+    check("max_ranges", pkg_max_ranges, vectors);
+    check("limits", pkg_limits, vectors);
+    check("no_ranges", pkg_no_ranges, vectors);
+    if (vectors) {
+        fclose(vectors);
+    }
+    return g_failed != 0;
+}
@@ -24,6 +24,22 @@
 
 #define FCNTL_IEEE_RTDOABH 0x88C1
 #define DWT_RTDOABH_CODE         0x6003
+#define DWT_RTDOABH_AGG_CODE     0x6004  /**< Several results in one frame, see RTDOABH_AGGREGATE */
+#define DWT_RTDOABH_ZIP_CODE     0x6005  /**< Compressed result, see RTDOABH_ZIP */
+#define RTDOABH_ZIP_VERSION      1
+#define DWT_RTDOABH_PB_CODE      0x6006  /**< Protobuf result, see RTDOABH_USE_PROTOBUF */
+#define DWT_RTDOABH_RELAY_CODE   0x6007  /**< Frame forwarded by a relay, see RTDOABH_ROLE_RELAY */
+
+/* Binary output, see RTDOABH_BINARY_OUTPUT and scripts/rtdoabh_decode.py */
+#define RTDOABH_SLIP_END          0xC0
+#define RTDOABH_SLIP_ESC          0xDB
+#define RTDOABH_SLIP_ESC_END      0xDC
+#define RTDOABH_SLIP_ESC_ESC      0xDD
+#define RTDOABH_SLIP_ESC_LF       0xDE  /**< 0x0A, the console adds \r before it */
+#define RTDOABH_SLIP_ESC_CR       0xDF  /**< 0x0D */
+
+#define RTDOABH_FRAME_TAG_RESULTS 0x01  /**< Packed rtdoabh_tag_results_pkg */
+#define RTDOABH_FRAME_TAG_RESULTS_PB 0x02  /**< TagResult of proto/rtdoa_backhaul.proto */
 
 struct rtdoabh_sensor_data {
     uint64_t ts;                   /**< timestamp as in master's clock frame (dwt_usecs)*/
@@ -58,6 +74,7 @@ typedef enum _rtdoa_backhaul_role_t{
     RTDOABH_ROLE_INVALID,
     RTDOABH_ROLE_BRIDGE,         // Bridge UWB -> USB / UDP
     RTDOABH_ROLE_PRODUCER,
+    RTDOABH_ROLE_RELAY,          // Forward frames heard towards the bridge
 }rtdoa_backhaul_role_t;
 
 #ifdef __cplusplus
@@ -67,6 +84,7 @@ extern "C" {
 void rtdoa_backhaul_set_a2a(struct uwb_dev * inst);
 void rtdoa_backhaul_set_role(struct uwb_dev * inst, rtdoa_backhaul_role_t role);
 void rtdoa_backhaul_print(struct rtdoabh_tag_results_pkg *p, bool tight);
+int rtdoa_backhaul_format(struct rtdoabh_tag_results_pkg *p, bool tight, char *buf, int size);
 int rtdoa_backhaul_sensor_data_cb(struct sensor* sensor, void *arg, void *data, sensor_type_t type);
 void rtdoa_backhaul_battery_cb(float battery_volt);
 void rtdoa_backhaul_usb_cb(float usb_volt);
@@ -74,9 +92,14 @@ void rtdoa_backhaul_set_ts(uint64_t sensor_time);
 
 struct uwb_dev_status rtdoa_backhaul_send(struct uwb_dev * inst, struct rtdoa_instance *rtdoa, uint64_t dxtime);
 int rtdoa_backhaul_queue_size();
+uint32_t rtdoa_backhaul_queue_drained(void);
 void rtdoa_backhaul_send_imu_only(uint64_t ts);
+int rtdoa_backhaul_relay(struct uwb_dev * inst, uint64_t dx_time);
+int rtdoa_backhaul_inject(const uint8_t *buf, int len);
 struct uwb_dev_status rtdoa_backhaul_local(struct uwb_dev * inst, struct rtdoa_instance *rtdoa);
 struct uwb_dev_status rtdoa_backhaul_listen(struct uwb_dev * inst, uint64_t dx_time, uint16_t timeout_uus);
+int rtdoa_backhaul_listen_async(struct uwb_dev * inst, uint64_t dx_time, uint16_t timeout_uus,
+                                struct os_event *done_ev);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,301 @@
+#!/usr/bin/env python
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+# Decode the SLIP framed binary output of a rtdoa backhaul bridge
+# built with RTDOABH_BINARY_OUTPUT=1 into json lines, one per result.
+#
+#   ./rtdoabh_decode.py /dev/ttyACM0 -b 1000000
+#   ./rtdoabh_decode.py capture.bin
+#
+import sys, argparse
+import struct
+import json
+
+SLIP_END = 0xC0
+SLIP_ESC = 0xDB
+SLIP_ESC_END = 0xDC
+SLIP_ESC_ESC = 0xDD
+SLIP_ESC_LF = 0xDE
+SLIP_ESC_CR = 0xDF
+
+FRAME_TAG_RESULTS = 0x01
+FRAME_TAG_RESULTS_PB = 0x02
+
+GPS_LAT_LONG_ENABLED   = 0x0001
+COMPASS_ENABLED        = 0x0008
+ACCELEROMETER_ENABLED  = 0x0010
+GYRO_ENABLED           = 0x0020
+PRESSURE_ENABLED       = 0x0040
+BATTERY_LEVELS_ENABLED = 0x0080
+
+# struct _ieee_rng_request_frame_t: fctrl, seq_num, PANID, dst, src, code
+HEAD = struct.Struct('<HBHHHH')
+# struct rtdoabh_sensor_data
+SENSORS = struct.Struct('<QHffbh3h3h3h')
+# ref_anchor_addr, num_ranges
+REF = struct.Struct('<HB')
+# struct rtdoabh_range_data, rssi:14 and quality:2 share the last word
+RANGE = struct.Struct('<HiH')
+
+def crc16_ccitt(data, crc=0):
+    for b in bytearray(data):
+        crc ^= b << 8
+        for i in range(8):
+            if crc & 0x8000:
+                crc = ((crc << 1) ^ 0x1021) & 0xffff
+            else:
+                crc = (crc << 1) & 0xffff
+    return crc
+
+def sign_extend(v, bits):
+    if v & (1 << (bits-1)):
+        return v - (1 << bits)
+    return v
+
+def slip_frames(stream):
+    """Yield unescaped frames from a byte stream"""
+    frame = bytearray()
+    esc = False
+    while True:
+        chunk = stream.read(256)
+        if not chunk:
+            break
+        for c in bytearray(chunk):
+            if c == SLIP_END:
+                if frame:
+                    yield bytes(frame)
+                frame = bytearray()
+                esc = False
+            elif esc:
+                frame.append({SLIP_ESC_END: SLIP_END,
+                              SLIP_ESC_ESC: SLIP_ESC,
+                              SLIP_ESC_LF: 0x0A,
+                              SLIP_ESC_CR: 0x0D}.get(c, c))
+                esc = False
+            elif c == SLIP_ESC:
+                esc = True
+            else:
+                frame.append(c)
+
+def decode_frame(frame):
+    """Return (type, payload) or None if the frame is broken"""
+    if len(frame) < 5:
+        return None
+    ftype, dlen = struct.unpack_from('<BH', frame, 0)
+    if dlen != len(frame) - 5:
+        return None
+    crc, = struct.unpack_from('<H', frame, len(frame) - 2)
+    if crc16_ccitt(frame[:-2]) != crc:
+        return None
+    return ftype, frame[3:-2]
+
+def decode_tag_results(p):
+    """Unpack a rtdoabh_tag_results_pkg, short packets are zero padded
+    just like the bridge does"""
+    need = HEAD.size + SENSORS.size + REF.size
+    if len(p) < need:
+        p = p + b'\0'*(need - len(p))
+    fctrl, seq, panid, dst, src, code = HEAD.unpack_from(p, 0)
+    off = HEAD.size
+    (ts, valid, lat, lon, vbat, pres,
+     m0, m1, m2, a0, a1, a2, g0, g1, g2) = SENSORS.unpack_from(p, off)
+    off += SENSORS.size
+    ref, num = REF.unpack_from(p, off)
+    off += REF.size
+
+    d = {'id': '0x%04x' % src, 'seq': seq}
+    if valid & 0x8000:
+        d['mode'] = 'anchor'
+    if ts:
+        d['ts'] = round(ts*40.0/39/1e6, 4)
+    s = valid & 0x3fff
+    if s & GPS_LAT_LONG_ENABLED:
+        d['gps'] = [lat, lon]
+    if s & BATTERY_LEVELS_ENABLED:
+        d['vbat'] = round(vbat*5.0/128, 2)
+        d['usb'] = (valid >> 14) & 1
+    if s & ACCELEROMETER_ENABLED:
+        d['a'] = [a0/1000.0, a1/1000.0, a2/1000.0]
+    if s & GYRO_ENABLED:
+        d['g'] = [g0/10.0, g1/10.0, g2/10.0]
+    if s & COMPASS_ENABLED:
+        d['m'] = [m0, m1, m2]
+    if s & PRESSURE_ENABLED:
+        d['p'] = pres + 101300
+
+    ranges = []
+    for i in range(num):
+        if off + RANGE.size > len(p):
+            break
+        addr, dd, w = RANGE.unpack_from(p, off)
+        off += RANGE.size
+        ranges.append((addr, dd, sign_extend(w & 0x3fff, 14),
+                       sign_extend(w >> 14, 2)))
+    if ranges:
+        d['meas'] = {'ref': '%x' % ref,
+                     'a': ['%x' % r[0] for r in ranges],
+                     'dd': [r[1]/1000.0 for r in ranges],
+                     'rs': [r[2]/10.0 for r in ranges],
+                     'qf': [r[3] for r in ranges]}
+    return d
+
+def pb_fields(p):
+    """Yield (field, wire type, value) of a protobuf message"""
+    off = 0
+    while off < len(p):
+        key, off = pb_varint(p, off)
+        wt = key & 7
+        if wt == 0:
+            v, off = pb_varint(p, off)
+        elif wt == 1:
+            v, off = p[off:off+8], off + 8
+        elif wt == 2:
+            n, off = pb_varint(p, off)
+            v, off = p[off:off+n], off + n
+        elif wt == 5:
+            v, off = p[off:off+4], off + 4
+        else:
+            raise ValueError('wire type %d' % wt)
+        yield key >> 3, wt, v
+
+def pb_varint(p, off):
+    v = 0
+    shift = 0
+    while True:
+        c = p[off]
+        off += 1
+        v |= (c & 0x7f) << shift
+        shift += 7
+        if not c & 0x80:
+            return v, off
+
+def pb_sint(v):
+    return (v >> 1) ^ -(v & 1)
+
+def pb_xyz(wt, v):
+    if wt == 0:
+        return [pb_sint(v)]
+    out = []
+    off = 0
+    while off < len(v):
+        x, off = pb_varint(v, off)
+        out.append(pb_sint(x))
+    return out
+
+def pb_to_pkg(p):
+    """Rebuild the packed rtdoabh_tag_results_pkg from a TagResult
+    message of proto/rtdoa_backhaul.proto"""
+    p = bytearray(p)
+    src = seq = ts = valid = pres = vbat = ref = 0
+    lat = lon = 0.0
+    xyz = {9: [], 10: [], 11: []}
+    ranges = []
+    has_ranges = False
+    for field, wt, v in pb_fields(p):
+        if field == 1 and wt == 0:
+            src = v
+        elif field == 2 and wt == 0:
+            seq = v
+        elif field == 3 and wt == 0:
+            ts = v
+        elif field == 4 and wt == 0:
+            valid = v
+        elif field in (5, 6) and wt == 5:
+            f, = struct.unpack('<f', bytes(v))
+            if field == 5:
+                lat = f
+            else:
+                lon = f
+        elif field == 7 and wt == 0:
+            vbat = pb_sint(v)
+        elif field == 8 and wt == 0:
+            pres = pb_sint(v)
+        elif field in xyz and wt in (0, 2):
+            xyz[field] += pb_xyz(wt, v)
+        elif field == 12 and wt == 0:
+            ref = v
+            has_ranges = True
+        elif field == 13 and wt == 2:
+            has_ranges = True
+            r = [0, 0, 0, 0]
+            for rf, rwt, rv in pb_fields(v):
+                if 1 <= rf <= 4 and rwt == 0:
+                    r[rf-1] = rv if rf == 1 else pb_sint(rv)
+            ranges.append(r)
+    for k in xyz:
+        xyz[k] = (xyz[k] + [0, 0, 0])[:3]
+
+    out = HEAD.pack(0x88C1, seq & 0xff, 0xDECA, 0xffff, src, 0x6003)
+    out += SENSORS.pack(ts, valid & 0xffff, lat, lon, vbat, pres,
+                        *(xyz[9] + xyz[10] + xyz[11]))
+    if has_ranges:
+        out += REF.pack(ref, len(ranges))
+        for addr, dd, rssi, qf in ranges:
+            out += RANGE.pack(addr, dd, (rssi & 0x3fff) | ((qf & 0x3) << 14))
+    return out
+
+class UdpStream(object):
+    """Datagrams from a RTDOABH_UDP bridge, read as one byte stream"""
+    def __init__(self, port):
+        import socket
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.sock.bind(('', port))
+
+    def read(self, n):
+        return self.sock.recv(65535)
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode binary rtdoa backhaul output')
+    parser.add_argument('input', help='serial device, capture file or udp port')
+    parser.add_argument('-b', '--baud', type=int, default=0,
+                        help='open input as serial port at this baudrate')
+    parser.add_argument('-u', '--udp', action='store_true',
+                        help='input is a udp port to listen on')
+    args = parser.parse_args()
+
+    if args.udp:
+        stream = UdpStream(int(args.input))
+    elif args.baud:
+        import serial
+        stream = serial.Serial(args.input, args.baud, timeout=None)
+    else:
+        stream = open(args.input, 'rb')
+
+    n_bad = 0
+    for frame in slip_frames(stream):
+        f = decode_frame(frame)
+        if f is None:
+            n_bad += 1
+            continue
+        ftype, payload = f
+        if ftype == FRAME_TAG_RESULTS:
+            d = decode_tag_results(payload)
+        elif ftype == FRAME_TAG_RESULTS_PB:
+            d = decode_tag_results(pb_to_pkg(payload))
+        else:
+            continue
+        print(json.dumps(d, separators=(',', ':')))
+        sys.stdout.flush()
+
+    if n_bad:
+        sys.stderr.write("%d broken frames\n" % n_bad)
+
+if __name__ == "__main__":
+    main()
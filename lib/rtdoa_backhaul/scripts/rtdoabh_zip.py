@@ -0,0 +1,262 @@
+#!/usr/bin/env python
+#
+# Licensed to the Apache Software Foundation (ASF) under one
+# or more contributor license agreements.  See the NOTICE file
+# distributed with this work for additional information
+# regarding copyright ownership.  The ASF licenses this file
+# to you under the Apache License, Version 2.0 (the
+# "License"); you may not use this file except in compliance
+# with the License.  You may obtain a copy of the License at
+#
+#  http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing,
+# software distributed under the License is distributed on an
+# "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+# KIND, either express or implied.  See the License for the
+# specific language governing permissions and limitations
+# under the License.
+#
+# Host side of the compressed backhaul format (RTDOABH_ZIP, see
+# src/rtdoabh_zip.c). Run on a capture of RTDOABH_BINARY_OUTPUT it
+# compresses every recorded result, checks that it expands back to the
+# same package and reports the size difference.
+#
+#   ./rtdoabh_zip.py capture.bin
+#
+# With --vectors it instead checks a file of "package frame" hex lines,
+# as written by host/test_zip, byte for byte against this encoder.
+#
+import sys, argparse
+import struct
+
+from rtdoabh_decode import (slip_frames, decode_frame, FRAME_TAG_RESULTS,
+                            HEAD, SENSORS, REF, RANGE,
+                            GPS_LAT_LONG_ENABLED, COMPASS_ENABLED,
+                            ACCELEROMETER_ENABLED, GYRO_ENABLED,
+                            PRESSURE_ENABLED, BATTERY_LEVELS_ENABLED)
+
+ZIP_VERSION = 1
+DWT_RTDOABH_CODE = 0x6003
+DWT_RTDOABH_ZIP_CODE = 0x6005
+
+SENSORS_END = HEAD.size + SENSORS.size
+RANGES_OFF = SENSORS_END + REF.size
+
+def zigzag(v):
+    return ((v << 1) ^ (v >> 31)) & 0xffffffff
+
+def unzigzag(v):
+    return (v >> 1) ^ -(v & 1)
+
+def put_uvar(out, v):
+    while v >= 0x80:
+        out.append((v & 0x7f) | 0x80)
+        v >>= 7
+    out.append(v)
+
+def get_uvar(p, off):
+    v = 0
+    shift = 0
+    while True:
+        c = p[off]
+        off += 1
+        v |= (c & 0x7f) << shift
+        shift += 7
+        if not c & 0x80:
+            return v, off
+
+def sign16(v):
+    v &= 0xffff
+    return v - 0x10000 if v & 0x8000 else v
+
+def sign_extend(v, bits):
+    if v & (1 << (bits-1)):
+        return v - (1 << bits)
+    return v
+
+def encode(p):
+    """Compress a plain rtdoabh_tag_results_pkg"""
+    p = bytes(p)
+    plain_len = len(p)
+    if len(p) < RANGES_OFF:
+        p = p + b'\0'*(RANGES_OFF - len(p))
+    head = list(HEAD.unpack_from(p, 0))
+    head[5] = DWT_RTDOABH_ZIP_CODE
+    (ts, flags, lat, lon, vbat, pres,
+     m0, m1, m2, a0, a1, a2, g0, g1, g2) = SENSORS.unpack_from(p, HEAD.size)
+    has_ranges = plain_len >= RANGES_OFF
+
+    out = bytearray(HEAD.pack(*head))
+    out.append(ZIP_VERSION | (0x80 if has_ranges else 0))
+    out += struct.pack('<H', flags)
+    put_uvar(out, ts)
+    if flags & GPS_LAT_LONG_ENABLED:
+        out += p[HEAD.size + 10:HEAD.size + 18]
+    if flags & BATTERY_LEVELS_ENABLED:
+        out += struct.pack('<b', vbat)
+    if flags & PRESSURE_ENABLED:
+        put_uvar(out, zigzag(pres))
+    for bit, xyz in ((COMPASS_ENABLED, (m0, m1, m2)),
+                     (ACCELEROMETER_ENABLED, (a0, a1, a2)),
+                     (GYRO_ENABLED, (g0, g1, g2))):
+        if flags & bit:
+            for v in xyz:
+                put_uvar(out, zigzag(v))
+
+    if has_ranges:
+        ref, num = REF.unpack_from(p, SENSORS_END)
+        num = min(num, (plain_len - RANGES_OFF) // RANGE.size)
+        put_uvar(out, ref)
+        out.append(num)
+        for i in range(num):
+            addr, dd, w = RANGE.unpack_from(p, RANGES_OFF + i*RANGE.size)
+            put_uvar(out, zigzag(sign16(addr - ref)))
+            put_uvar(out, zigzag(dd))
+            put_uvar(out, (zigzag(sign_extend(w & 0x3fff, 14)) << 2) | (w >> 14))
+    return bytes(out)
+
+def decode(z):
+    """Expand a compressed frame back into a plain package"""
+    z = bytearray(z)
+    head = list(HEAD.unpack_from(bytes(z), 0))
+    head[5] = DWT_RTDOABH_CODE
+    off = HEAD.size
+    version = z[off]
+    if version & 0x7f != ZIP_VERSION:
+        raise ValueError('unknown version %d' % (version & 0x7f))
+    flags, = struct.unpack_from('<H', bytes(z), off + 1)
+    off += 3
+    ts, off = get_uvar(z, off)
+    lat = lon = 0.0
+    vbat = pres = 0
+    xyz = {COMPASS_ENABLED: [0, 0, 0], ACCELEROMETER_ENABLED: [0, 0, 0],
+           GYRO_ENABLED: [0, 0, 0]}
+    if flags & GPS_LAT_LONG_ENABLED:
+        lat, lon = struct.unpack_from('<ff', bytes(z), off)
+        off += 8
+    if flags & BATTERY_LEVELS_ENABLED:
+        vbat, = struct.unpack_from('<b', bytes(z), off)
+        off += 1
+    if flags & PRESSURE_ENABLED:
+        v, off = get_uvar(z, off)
+        pres = unzigzag(v)
+    for bit in (COMPASS_ENABLED, ACCELEROMETER_ENABLED, GYRO_ENABLED):
+        if flags & bit:
+            for i in range(3):
+                v, off = get_uvar(z, off)
+                xyz[bit][i] = unzigzag(v)
+
+    out = bytearray(HEAD.pack(*head))
+    out += SENSORS.pack(ts, flags, lat, lon, vbat, pres,
+                        *(xyz[COMPASS_ENABLED] + xyz[ACCELEROMETER_ENABLED] +
+                          xyz[GYRO_ENABLED]))
+    if not version & 0x80:
+        return bytes(out)
+
+    ref, off = get_uvar(z, off)
+    num = z[off]
+    off += 1
+    out += REF.pack(ref, num)
+    for i in range(num):
+        da, off = get_uvar(z, off)
+        dd, off = get_uvar(z, off)
+        rq, off = get_uvar(z, off)
+        rssi = unzigzag(rq >> 2)
+        out += RANGE.pack((ref + unzigzag(da)) & 0xffff, unzigzag(dd),
+                          (rssi & 0x3fff) | ((rq & 0x3) << 14))
+    return bytes(out)
+
+def canonical(p):
+    """What a package looks like after a round trip: unused sensor fields
+    cleared and cut after the last range"""
+    p = bytes(p)
+    if len(p) < SENSORS_END:
+        p = p + b'\0'*(SENSORS_END - len(p))
+    f = list(SENSORS.unpack_from(p, HEAD.size))
+    flags = f[1]
+    if not flags & GPS_LAT_LONG_ENABLED:
+        f[2] = f[3] = 0.0
+    if not flags & BATTERY_LEVELS_ENABLED:
+        f[4] = 0
+    if not flags & PRESSURE_ENABLED:
+        f[5] = 0
+    for bit, i in ((COMPASS_ENABLED, 6), (ACCELEROMETER_ENABLED, 9),
+                   (GYRO_ENABLED, 12)):
+        if not flags & bit:
+            f[i:i+3] = [0, 0, 0]
+    head = list(HEAD.unpack_from(p, 0))
+    out = HEAD.pack(*head) + SENSORS.pack(*f)
+    if len(p) >= RANGES_OFF:
+        ref, num = REF.unpack_from(p, SENSORS_END)
+        num = min(num, (len(p) - RANGES_OFF) // RANGE.size)
+        out += REF.pack(ref, num) + p[RANGES_OFF:RANGES_OFF + num*RANGE.size]
+    return out
+
+def check_vectors(path):
+    """Compare with frames compressed by rtdoabh_zip_encode"""
+    n = n_bad = 0
+    with open(path) as f:
+        for line in f:
+            if not line.strip():
+                continue
+            p, z = (bytes(bytearray.fromhex(x)) for x in line.split())
+            if encode(p) != z:
+                print('encode differs for %s' % p.hex())
+                n_bad += 1
+            elif decode(z) != canonical(p):
+                print('decode differs for %s' % z.hex())
+                n_bad += 1
+            n += 1
+    print('%d of %d vectors match' % (n - n_bad, n))
+    if n_bad or not n:
+        sys.exit(1)
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Report compressed sizes for a binary backhaul capture')
+    parser.add_argument('input', nargs='?', help='capture of RTDOABH_BINARY_OUTPUT')
+    parser.add_argument('--vectors', help='check test vectors of host/test_zip')
+    args = parser.parse_args()
+    if args.vectors:
+        check_vectors(args.vectors)
+        return
+    if not args.input:
+        parser.error('input is required')
+
+    n = n_bad = plain = zipped = 0
+    by_ranges = {}
+    with open(args.input, 'rb') as stream:
+        for frame in slip_frames(stream):
+            f = decode_frame(frame)
+            if f is None or f[0] != FRAME_TAG_RESULTS:
+                continue
+            p = canonical(f[1])
+            z = encode(p)
+            if decode(z) != p:
+                n_bad += 1
+            nr = REF.unpack_from(p, SENSORS_END)[1] if len(p) >= RANGES_OFF else -1
+            s = by_ranges.setdefault(nr, [0, 0, 0])
+            s[0] += 1
+            s[1] += len(p)
+            s[2] += len(z)
+            n += 1
+            plain += len(p)
+            zipped += len(z)
+
+    if not n:
+        print('no results in capture')
+        return
+    print('%-8s %8s %10s %10s %7s' % ('ranges', 'count', 'plain', 'zip', 'ratio'))
+    for nr in sorted(by_ranges):
+        c, a, b = by_ranges[nr]
+        print('%-8s %8d %10.1f %10.1f %6.1f%%' % (
+            'imu' if nr < 0 else nr, c, a/float(c), b/float(c), 100.0*b/a))
+    print('%-8s %8d %10.1f %10.1f %6.1f%%' % (
+        'all', n, plain/float(n), zipped/float(n), 100.0*zipped/plain))
+    if n_bad:
+        print('%d results did not survive the round trip' % n_bad)
+        sys.exit(1)
+
+if __name__ == "__main__":
+    main()
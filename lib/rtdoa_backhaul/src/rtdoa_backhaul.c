@@ -24,9 +24,11 @@
 #include <os/mynewt.h>
 #include <hal/hal_spi.h>
 #include <hal/hal_gpio.h>
+#include <console/console.h>
 #include "bsp/bsp.h"
 
 #include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
 #include "rtdoa/rtdoa.h"
 
 #include "sensor/sensor.h"
@@ -52,14 +54,17 @@ STATS_SECT_START(tag_stats)
     STATS_SECT_ENTRY(rx_error)
     STATS_SECT_ENTRY(relay_ok)
     STATS_SECT_ENTRY(relay_err)
-    STATS_SECT_ENTRY(a00_range)
-    STATS_SECT_ENTRY(a00_rssi)
-    STATS_SECT_ENTRY(a01_range)
-    STATS_SECT_ENTRY(a01_rssi)
-    STATS_SECT_ENTRY(a02_range)
-    STATS_SECT_ENTRY(a02_rssi)
-    STATS_SECT_ENTRY(a03_range)
-    STATS_SECT_ENTRY(a03_rssi)
+    STATS_SECT_ENTRY(fmt_err)
+    STATS_SECT_ENTRY(ring_hwm)
+    STATS_SECT_ENTRY(ring_ovf)
+    STATS_SECT_ENTRY(agg_txrec)
+    STATS_SECT_ENTRY(agg_rxrec)
+    STATS_SECT_ENTRY(agg_drop)
+    STATS_SECT_ENTRY(zip_saved)
+    STATS_SECT_ENTRY(pkg_short)
+    STATS_SECT_ENTRY(pkg_hwm)
+    STATS_SECT_ENTRY(range_drop)
+    STATS_SECT_ENTRY(imu_drop)
 STATS_SECT_END
 
 /* Global variable used to hold stats data */
@@ -75,14 +80,17 @@ STATS_NAME_START(tag_stats)
     STATS_NAME(tag_stats, rx_error)
     STATS_NAME(tag_stats, relay_ok)
     STATS_NAME(tag_stats, relay_err)
-    STATS_NAME(tag_stats, a00_range)
-    STATS_NAME(tag_stats, a00_rssi)
-    STATS_NAME(tag_stats, a01_range)
-    STATS_NAME(tag_stats, a01_rssi)
-    STATS_NAME(tag_stats, a02_range)
-    STATS_NAME(tag_stats, a02_rssi)
-    STATS_NAME(tag_stats, a03_range)
-    STATS_NAME(tag_stats, a03_rssi)
+    STATS_NAME(tag_stats, fmt_err)
+    STATS_NAME(tag_stats, ring_hwm)
+    STATS_NAME(tag_stats, ring_ovf)
+    STATS_NAME(tag_stats, agg_txrec)
+    STATS_NAME(tag_stats, agg_rxrec)
+    STATS_NAME(tag_stats, agg_drop)
+    STATS_NAME(tag_stats, zip_saved)
+    STATS_NAME(tag_stats, pkg_short)
+    STATS_NAME(tag_stats, pkg_hwm)
+    STATS_NAME(tag_stats, range_drop)
+    STATS_NAME(tag_stats, imu_drop)
 STATS_NAME_END(tag_stats)
 
 #define RTDOABH_STATS_INC(x) STATS_INC(g_tag_stats,x)
@@ -95,14 +103,19 @@ STATS_NAME_END(tag_stats)
 #define RTDOABH_STATS_CLEAR(x) {}
 #endif
 
-#if MYNEWT_VAL(RTDOABH_USE_PROTOBUF)
 #include "rtdoa_pb.h"
+
+#if MYNEWT_VAL(RTDOABH_USE_PROTOBUF) && (MYNEWT_VAL(RTDOABH_ZIP) || MYNEWT_VAL(RTDOABH_AGGREGATE))
+#error "RTDOABH_USE_PROTOBUF can't be combined with RTDOABH_ZIP or RTDOABH_AGGREGATE"
 #endif
 
 /* Incoming messages mempool and queue */
 struct rtdoabh_msg_hdr {
     uint16_t dlen:15;
     uint16_t is_pb:1;
+    uint8_t is_agg:1;       /**< Aggregate frame, unpacked on output */
+    uint8_t is_remote:1;    /**< Received over the air, subject to dedup */
+    uint8_t is_relay:1;     /**< Wrapped by a relay, unwrapped on output */
 }__attribute__((packed, aligned(1)));
 
 #define MBUF_PKTHDR_OVERHEAD    sizeof(struct os_mbuf_pkthdr) + sizeof(struct rtdoabh_msg_hdr)
@@ -117,48 +130,54 @@ struct rtdoabh_msg_hdr {
 static struct os_mbuf_pool g_mbuf_pool;
 static struct os_mempool g_mbuf_mempool;
 static os_membuf_t g_mbuf_buffer[MBUF_MEMPOOL_SIZE];
-static struct os_mqueue rxpkt_q;
+
+/* Packages queue by class, range results are output before imu only
+ * packages and can keep mbufs the imu class may not touch */
+enum rtdoabh_class {
+    RTDOABH_CLASS_RANGE = 0,
+    RTDOABH_CLASS_IMU,
+    RTDOABH_CLASS_NUM
+};
+
+static const struct {
+    uint16_t reserve;       /**< Mbufs only this class may take */
+    uint8_t drop_oldest;    /**< Make room by dropping the oldest package */
+} g_class_cfg[RTDOABH_CLASS_NUM] = {
+    [RTDOABH_CLASS_RANGE] = {MYNEWT_VAL(RTDOABH_RANGE_RESERVE),
+                             MYNEWT_VAL(RTDOABH_RANGE_DROP_OLDEST)},
+    [RTDOABH_CLASS_IMU] = {MYNEWT_VAL(RTDOABH_IMU_RESERVE),
+                           MYNEWT_VAL(RTDOABH_IMU_DROP_OLDEST)},
+};
+
+#if MYNEWT_VAL(RTDOABH_RANGE_RESERVE) + MYNEWT_VAL(RTDOABH_IMU_RESERVE) >= MYNEWT_VAL(RTDOABH_NUM_MBUFS)
+#error "RTDOABH_RANGE_RESERVE and RTDOABH_IMU_RESERVE must leave mbufs to share"
+#endif
+
+static struct os_mqueue rxpkt_q[RTDOABH_CLASS_NUM];
 static struct os_sem g_sem;
 
-static uint32_t g_msg_id = 0;
 static rtdoa_backhaul_role_t g_role = RTDOABH_ROLE_INVALID;
 static uint64_t g_to_dx_time = 0; /* When the current listen for backhaul expires */
+static struct os_event *g_listen_ev = 0; /* Posted when an async listen ends */
+static uint32_t g_drained = 0; /* Packages taken off the queue so far */
 
-static struct rtdoabh_tag_results_pkg g_result_pkg = {
-    .head = {
-        .fctrl = FCNTL_IEEE_RTDOABH,
-        .seq_num = 0,
-        .PANID = 0xDECA,
-        .dst_address = 0xffff,
-        .src_address = 0x0000,
-        .code = DWT_RTDOABH_CODE,
-    },
-    .sensors = {0,0},
-    .num_ranges = 0,
-    .ranges = {{0}}
-};
-
-static struct rtdoabh_tag_results_pkg g_result_pkg_imu = {
-    .head = {
-        .fctrl = FCNTL_IEEE_RTDOABH,
-        .seq_num = 0,
-        .PANID = 0xDECA,
-        .dst_address = 0xffff,
-        .src_address = 0x0000,
-        .code = DWT_RTDOABH_CODE,
-    },
-    .sensors = {0,0},
-    .num_ranges = 0,
-    .ranges = {{0}}
-};
+/* Packages being filled, from the pool in rtdoabh_pkg.c. The senders
+ * swap in a fresh one before sending, see rtdoabh_pkg_swap */
+static struct rtdoabh_tag_results_pkg *g_result_pkg;
+static struct rtdoabh_tag_results_pkg *g_result_pkg_imu;
+static uint8_t g_result_seq = 0;
+static uint8_t g_result_imu_seq = 0;
 
 static bool tx_complete_cb(struct uwb_dev * inst, struct uwb_mac_interface * cbs);
 static bool rx_complete_cb(struct uwb_dev * inst, struct uwb_mac_interface * cbs);
+static bool rx_end_cb(struct uwb_dev * inst, struct uwb_mac_interface * cbs);
 
 static struct uwb_mac_interface g_cbs = {
     .id = UWBEXT_RTDOA_BH,
     .rx_complete_cb = rx_complete_cb,
     .tx_complete_cb = tx_complete_cb,
+    .rx_timeout_cb = rx_end_cb,
+    .rx_error_cb = rx_end_cb,
     .reset_cb = 0
 };
 
@@ -176,164 +195,314 @@ create_mbuf_pool(void)
     assert(rc == 0);
 }
 
-#if MYNEWT_VAL(RTDOABH_STATS)
+/**
+ * Class of a plain package or frame of length len, fcs or not. Anything
+ * shorter than a result with no ranges is an imu only package.
+ */
+static int
+pkg_class(int len)
+{
+    return (len < (int)offsetof(struct rtdoabh_tag_results_pkg, ranges)) ?
+        RTDOABH_CLASS_IMU : RTDOABH_CLASS_RANGE;
+}
+
 static void
-update_range_stats(int anchor, int32_t range, float rssi)
-{
-    switch (anchor)
-    {
-    case(0):
-        RTDOABH_STATS_CLEAR(a00_range);
-        RTDOABH_STATS_INCN(a00_range, range);
-        RTDOABH_STATS_CLEAR(a00_rssi);
-        RTDOABH_STATS_INCN(a00_rssi, abs(floor(rssi)));
-        break;
-    case(1):
-        RTDOABH_STATS_CLEAR(a01_range);
-        RTDOABH_STATS_INCN(a01_range, range);
-        RTDOABH_STATS_CLEAR(a01_rssi);
-        RTDOABH_STATS_INCN(a01_rssi, abs(floor(rssi)));
-        break;
-    case(2):
-        RTDOABH_STATS_CLEAR(a02_range);
-        RTDOABH_STATS_INCN(a02_range, range);
-        RTDOABH_STATS_CLEAR(a02_rssi);
-        RTDOABH_STATS_INCN(a02_rssi, abs(floor(rssi)));
-        break;
-    case(3):
-        RTDOABH_STATS_CLEAR(a03_range);
-        RTDOABH_STATS_INCN(a03_range, range);
-        RTDOABH_STATS_CLEAR(a03_rssi);
-        RTDOABH_STATS_INCN(a03_rssi, abs(floor(rssi)));
-        break;
-    default:
-        break;
+class_drop(int c)
+{
+    if (c == RTDOABH_CLASS_RANGE) {
+        RTDOABH_STATS_INC(range_drop);
+    } else {
+        RTDOABH_STATS_INC(imu_drop);
     }
 }
-#endif
 
-void
-rtdoa_backhaul_print(struct rtdoabh_tag_results_pkg *p, bool tight)
+/* Pool blocks a chain of len bytes takes, at least the packet header */
+static int
+mbuf_blocks(int len)
 {
-    struct rtdoabh_sensor_data *d = &p->sensors;
-    printf("{\"id\":\"0x%04x\"", p->head.src_address);
+    return (len > MBUF_BUF_SIZE) ? (len + MBUF_BUF_SIZE - 1) / MBUF_BUF_SIZE : 1;
+}
 
-    if(d->is_anchor_data) {
-        printf(",\"mode\":\"anchor\"");
+/* Packet header mbuf for len bytes of class c, if the free blocks cover
+ * all of them on top of the reserves of the other classes */
+static struct os_mbuf *
+class_try_get(int c, int len)
+{
+    int others = MYNEWT_VAL(RTDOABH_RANGE_RESERVE) +
+        MYNEWT_VAL(RTDOABH_IMU_RESERVE) - g_class_cfg[c].reserve;
+
+    if (g_mbuf_mempool.mp_num_free < others + mbuf_blocks(len)) {
+        return NULL;
     }
-    if (d->ts) {
-        double ts = uwb_dwt_usecs_to_usecs(d->ts);
-        uint64_t ts_s  = (uint64_t)(ts/1000000);
-        uint32_t ts_tms = (ts-ts_s*1000000)/100.0;
-        printf(",\"ts\":\"%llu.%04lu\"", ts_s, ts_tms);
+    return os_mbuf_get_pkthdr(&g_mbuf_pool, sizeof(struct rtdoabh_msg_hdr));
+}
+
+/**
+ * Get an mbuf to queue a package of class c and len bytes in, leaving
+ * the reserves of the other classes alone. When there is no room and
+ * the class drops the oldest, the oldest queued packages of the class
+ * make room. Callable from the rx callback.
+ *
+ * @return The mbuf or NULL, counted as a drop of the class
+ */
+static struct os_mbuf *
+class_get(int c, int len)
+{
+    struct os_mbuf *om = class_try_get(c, len);
+
+    while (!om && g_class_cfg[c].drop_oldest) {
+        om = os_mqueue_get(&rxpkt_q[c]);
+        if (!om) {
+            break;
+        }
+        class_drop(c);
+        os_mbuf_free_chain(om);
+        om = class_try_get(c, len);
     }
-    printf(",\"mid\":%ld", g_msg_id++); /**< OBSERVE: This is from the local node */
-    if (d->sensors_valid&GPS_LAT_LONG_ENABLED) {
-        printf(",\"gps\":[\"%d.%d\"", (int)d->gps_lat,
-           abs((int)((d->gps_lat -(int)d->gps_lat)*1000000)));
-        printf(",\"%d.%d\"]", (int)d->gps_long,
-               abs((int)((d->gps_long - (int)d->gps_long)*1000000)));
+    if (!om) {
+        class_drop(c);
     }
+    return om;
+}
+
+/* Queue om in class c, om is freed and counted as a drop on failure */
+static int
+class_put(int c, struct os_mbuf *om)
+{
+    int rc = os_mqueue_put(&rxpkt_q[c], os_eventq_dflt_get(), om);
 
-    if (d->sensors_valid&BATTERY_LEVELS_ENABLED) {
-        float f = (float)d->battery_voltage*5.0f/128;
-        printf(",\"vbat\":\"%d.%02d\"",
-               (int)f, abs((int)(100*(f-(int)f)))
-            );
-        printf(",\"usb\":%d", d->has_usb_power);
+    if (rc != 0) {
+        os_mbuf_free_chain(om);
+        class_drop(c);
     }
+    return rc;
+}
 
-    if (d->sensors_valid&ACCELEROMETER_ENABLED) {
-        printf(",\"a\":\"[");
-        for (int i=0;i<3;i++) {
-            float f = (float)d->acceleration[i]/1000;
-            printf("%s%d.%d",(i==0)?"":",",
-                   (int)f, abs((int)(1000*(f-(int)f))));
-        }
-        printf("]\"");
-    }
-    if (d->sensors_valid&GYRO_ENABLED) {
-        printf(",\"g\":\"[");
-        for (int i=0;i<3;i++) {
-            float f = (float)d->gyro[i]/10;
-            printf("%s%d.%d",(i==0)?"":",",
-                   (int)f, abs((int)(10*(f-(int)f))));
-        }
-        printf("]\"");
+/* Next package to output, higher classes first */
+static struct os_mbuf *
+queue_get(void)
+{
+    struct os_mbuf *om = NULL;
+
+    for (int c = 0; c < RTDOABH_CLASS_NUM && !om; c++) {
+        om = os_mqueue_get(&rxpkt_q[c]);
     }
-    if (d->sensors_valid&COMPASS_ENABLED) {
-        printf(",\"m\":[%d,%d,%d]", d->compass[0], d->compass[1], d->compass[2]);
+    return om;
+}
+
+void
+rtdoabh_print_view(const struct rtdoabh_pkg_view *v, bool tight)
+{
+    static char buf[MYNEWT_VAL(RTDOABH_JSON_BUF_SIZE)];
+    int len;
+
+    len = rtdoabh_format_view(v, tight, buf, sizeof(buf));
+    if (len < 0) {
+        RTDOABH_STATS_INC(fmt_err);
+        return;
     }
-    if (d->sensors_valid&PRESSURE_ENABLED) {
-        printf(",\"p\":%ld", ((int32_t)d->pressure)+101300);
+    rtdoabh_out_write(buf, len);
+    rtdoabh_out_end();
+}
+
+void
+rtdoa_backhaul_print(struct rtdoabh_tag_results_pkg *p, bool tight)
+{
+    struct rtdoabh_pkg_view v;
+
+    rtdoabh_view_init_flat(&v, p, sizeof(*p));
+    rtdoabh_print_view(&v, tight);
+}
+
+static void
+output_flat(const uint8_t *data, int len)
+{
+#if MYNEWT_VAL(RTDOABH_BINARY_OUTPUT)
+    struct rtdoabh_slip slip;
+
+    rtdoabh_slip_start(&slip, RTDOABH_FRAME_TAG_RESULTS, len);
+    rtdoabh_slip_append(&slip, data, len);
+    rtdoabh_slip_finish(&slip);
+#else
+    struct rtdoabh_pkg_view view;
+
+    if (rtdoabh_view_init_flat(&view, data, len)) {
+        RTDOABH_STATS_INC(rx_error);
+        return;
     }
+    rtdoabh_print_view(&view, true);
+#endif
+}
+
+/* Output a package received over the air unless it has been seen before */
+static void
+process_rx_pkg(const uint8_t *data, int len)
+{
+    const struct _ieee_rng_request_frame_t *head = (const void*)data;
 
-#if MYNEWT_VAL(RTDOABH_COMPACT_MEAS)
-    if (!p->num_ranges) {
-        goto early_close;
+    if (rtdoabh_dedup_check(head->src_address, head->seq_num)) {
+        RTDOABH_STATS_INC(rx_drop);
+        return;
     }
-    printf(",\"meas\":{");
-    printf("\"ref\":\"%x\",", p->ref_anchor_addr);
-    const char* key[4]={"a","dd","rs","qf"};
+    output_flat(data, len);
+}
 
-    for (int j=0;j<4;j++) {
-        printf("\"%s\":[",key[j]);
-        for (int i=0;i<p->num_ranges;i++) {
-            struct rtdoabh_range_data *r = &p->ranges[i];
-            int is_last = (i+1<p->num_ranges);
-            switch (j){
-            case (0): {
-                printf("\"%x\"%s", r->anchor_addr, (is_last)?",":"");
-                break;
-            }
-            case 1: {
-                int sign = (r->diff_dist_mm > 0);
-                int ddist_m  = r->diff_dist_mm/1000;
-                int ddist_mm = abs(r->diff_dist_mm - ddist_m*1000);
-                printf("%s%d.%03d%s", (sign)?"":"-", abs(ddist_m), ddist_mm, (is_last)?",":"");
-                break;
-            }
-            case 2: {
-                float rssif = (float)r->rssi/10;
-                int rssi_frac = abs((int)(10*(rssif-(int)rssif)));
-                printf("%d.%d%s", (int)rssif, rssi_frac, (is_last)?",":"");
-                break;
-            }
-            case 3: {
-                printf("%x%s", r->quality, (is_last)?",":"");
-                break;
-            }
-            } /* End switch(j) */
+/* Output a frame received over the air, expanding it if compressed */
+static void
+process_rx_frame(const uint8_t *data, int len)
+{
+    static struct rtdoabh_tag_results_pkg pkg;
+    const struct _ieee_rng_request_frame_t *head = (const void*)data;
+
+    if (head->code == DWT_RTDOABH_ZIP_CODE) {
+        len = rtdoabh_zip_decode(data, len, &pkg);
+        if (len < 0) {
+            RTDOABH_STATS_INC(rx_error);
+            return;
         }
-        printf("]%s", (j==3)?"}":",");
+        data = (const uint8_t*)&pkg;
     }
-early_close:
-    printf("}\n");
+    process_rx_pkg(data, len);
+}
+
+/**
+ * Output a protobuf result. The chain holds the ieee header followed by
+ * the length prefixed TagResult message, which is forwarded as is in
+ * binary mode.
+ */
+static void
+process_rx_pb(struct os_mbuf *om, bool remote)
+{
+    struct _ieee_rng_request_frame_t head;
+    int off = sizeof(head);
+    int len = 0, shift = 0;
+    uint8_t c;
+#if MYNEWT_VAL(RTDOABH_BINARY_OUTPUT)
+    struct rtdoabh_slip slip;
 #else
-    printf(",\"ref_anchor\":\"%x\"", p->ref_anchor_addr);
-    printf(",\"meas\":[%s", (tight || p->num_ranges==0)?"":"\n ");
-
-    for (int i=0;i<p->num_ranges;i++) {
-        struct rtdoabh_range_data *r = &p->ranges[i];
-        float rssif = (float)r->rssi/10;
-        int dist_m  = r->diff_dist_mm/1000;
-        int dist_mm = abs(r->diff_dist_mm - dist_m*1000);
-        dist_m = abs(dist_m);
-        printf("{\"addr\":\"%x\",\"ddist\":\"%s%d.%03d\",\"tqf\":%d,\"rssi\":\"%d.%d\"}%s%s",
-               r->anchor_addr,
-               (r->diff_dist_mm < 0)?"-":"", dist_m, dist_mm,
-               r->quality,
-               (int)rssif, abs((int)(10*(rssif-(int)rssif))),
-               (i+1<p->num_ranges)?",":"]",
-               (tight)?"":"\n  "
-            );
-    }
-    printf("]}\n");
+    static struct rtdoabh_tag_results_pkg pkg;
 #endif
 
+    if (os_mbuf_copydata(om, 0, sizeof(head), &head)) {
+        goto err;
+    }
+    do {
+        if (os_mbuf_copydata(om, off++, 1, &c)) {
+            goto err;
+        }
+        len |= (c & 0x7f) << shift;
+        shift += 7;
+    } while ((c & 0x80) && shift < 21);
+    if (off + len > OS_MBUF_PKTLEN(om)) {
+        goto err;
+    }
+    if (remote && rtdoabh_dedup_check(head.src_address, head.seq_num)) {
+        RTDOABH_STATS_INC(rx_drop);
+        return;
+    }
 
+#if MYNEWT_VAL(RTDOABH_BINARY_OUTPUT)
+    rtdoabh_slip_start(&slip, RTDOABH_FRAME_TAG_RESULTS_PB, len);
+    rtdoabh_slip_append_mbuf(&slip, om, off, len);
+    rtdoabh_slip_finish(&slip);
+#else
+    len = rtdoa_pb_decode(om, off, len, &pkg);
+    if (len < 0) {
+        goto err;
+    }
+    output_flat((const uint8_t*)&pkg, len);
+#endif
+    return;
+err:
+    RTDOABH_STATS_INC(rx_error);
 }
 
+/* Output one frame held in om, which stays the caller's */
+static void
+process_rx_om(struct os_mbuf *om)
+{
+    struct rtdoabh_msg_hdr *hdr = (struct rtdoabh_msg_hdr*)(OS_MBUF_USRHDR(om));
+    struct _ieee_rng_request_frame_t head;
+    int payload_len;
+    int rc;
+#if MYNEWT_VAL(RTDOABH_BINARY_OUTPUT)
+    struct rtdoabh_slip slip;
+#else
+    struct rtdoabh_pkg_view view;
+#endif
+
+    payload_len = OS_MBUF_PKTLEN(om);
+    payload_len = (payload_len > sizeof(struct rtdoabh_tag_results_pkg)) ?
+        sizeof(struct rtdoabh_tag_results_pkg) : payload_len;
+
+    if (hdr->is_pb) {
+        process_rx_pb(om, hdr->is_remote);
+        return;
+    }
+    if (hdr->is_agg) {
+        rc = rtdoabh_agg_unpack(om, process_rx_pkg);
+        RTDOABH_STATS_INCN(agg_rxrec, rc);
+        return;
+    }
+    if (hdr->is_remote) {
+        rc = os_mbuf_copydata(om, 0, sizeof(head), &head);
+        if (rc == 0 && head.code == DWT_RTDOABH_ZIP_CODE) {
+            static uint8_t zbuf[sizeof(struct rtdoabh_tag_results_pkg)];
+            os_mbuf_copydata(om, 0, payload_len, zbuf);
+            process_rx_frame(zbuf, payload_len);
+            return;
+        }
+        if (rc || rtdoabh_dedup_check(head.src_address, head.seq_num)) {
+            RTDOABH_STATS_INC(rx_drop);
+            return;
+        }
+    }
+
+#if MYNEWT_VAL(RTDOABH_BINARY_OUTPUT)
+    rtdoabh_slip_start(&slip, RTDOABH_FRAME_TAG_RESULTS, payload_len);
+    rtdoabh_slip_append_mbuf(&slip, om, 0, payload_len);
+    /* Always terminate the frame, the crc will reject it if short */
+    rtdoabh_slip_finish(&slip);
+#else
+    /* Parsed in place, nothing is copied out of the chain
+     * unless a range entry straddles two mbufs */
+    rc = rtdoabh_view_init_mbuf(&view, om);
+    if (rc) {
+        RTDOABH_STATS_INC(rx_error);
+        return;
+    }
+    rtdoabh_print_view(&view, true);
+#endif
+}
+
+/* Output one of the frames a relay frame carries, see rtdoabh_relay_unpack */
+static void
+process_rx_relayed(struct os_mbuf *om, int off, int len)
+{
+    struct _ieee_rng_request_frame_t head;
+    struct rtdoabh_msg_hdr *hdr;
+    struct os_mbuf *m;
+
+    if (os_mbuf_copydata(om, off, sizeof(head), &head)) {
+        return;
+    }
+    m = class_try_get(RTDOABH_CLASS_RANGE, len);
+    if (!m || os_mbuf_appendfrom(m, om, off, len)) {
+        if (m) {
+            os_mbuf_free_chain(m);
+        }
+        RTDOABH_STATS_INC(rx_drop);
+        return;
+    }
+    hdr = (struct rtdoabh_msg_hdr*)(OS_MBUF_USRHDR(m));
+    hdr->dlen = len;
+    hdr->is_pb = (head.code == DWT_RTDOABH_PB_CODE);
+    hdr->is_agg = (head.code == DWT_RTDOABH_AGG_CODE);
+    hdr->is_remote = 1;
+    hdr->is_relay = 0;
+    process_rx_om(m);
+    os_mbuf_free_chain(m);
+}
 
 static void
 process_rx_data_queue(struct os_event *ev)
@@ -341,29 +510,61 @@ process_rx_data_queue(struct os_event *ev)
     int rc;
     struct os_mbuf *om;
     struct rtdoabh_msg_hdr *hdr;
-    int payload_len;
-    struct rtdoabh_tag_results_pkg pkg;
 
-    while ((om = os_mqueue_get(&rxpkt_q)) != NULL) {
+    while ((om = queue_get()) != NULL) {
         hdr = (struct rtdoabh_msg_hdr*)(OS_MBUF_USRHDR(om));
-        hdr->dlen = hdr->dlen;
-
-        payload_len = OS_MBUF_PKTLEN(om);
-        payload_len = (payload_len > sizeof(pkg)) ? sizeof(pkg) : payload_len;
-        memset(&pkg, 0, sizeof(pkg));
 
-        if (g_role == RTDOABH_ROLE_BRIDGE) {
-            rc = os_mbuf_copydata(om, 0, payload_len, &pkg);
-            if (rc) {
-                goto end_msg;
+        if (g_role == RTDOABH_ROLE_RELAY && hdr->is_remote) {
+            rc = rtdoabh_relay_push(om);
+            if (rc == 0) {
+                /* Held until the relay slot */
+                g_drained++;
+                continue;
+            }
+            if (rc == 1) {
+                RTDOABH_STATS_INC(rx_drop);
+            } else {
+                RTDOABH_STATS_INC(relay_err);
+            }
+            goto end_msg;
+        }
+        if (g_role != RTDOABH_ROLE_BRIDGE) {
+            goto end_msg;
+        }
+        if (hdr->is_relay) {
+            if (rtdoabh_relay_unpack(om, process_rx_relayed) == 0) {
+                RTDOABH_STATS_INC(rx_error);
             }
-            rtdoa_backhaul_print(&pkg, true);
+            goto end_msg;
         }
+        process_rx_om(om);
     end_msg:
         os_mbuf_free_chain(om);
+        g_drained++;
+    }
+    rtdoabh_out_flush();
+}
+
+#if MYNEWT_VAL(RTDOABH_RING)
+static void
+process_rx_ring(struct os_event *ev)
+{
+    int n;
+
+    while ((n = rtdoabh_ring_drain(process_rx_frame)) != 0) {
+        g_drained += n;
     }
+    rtdoabh_out_flush();
+    RTDOABH_STATS_CLEAR(ring_hwm);
+    RTDOABH_STATS_INCN(ring_hwm, rtdoabh_ring_hwm());
+    RTDOABH_STATS_CLEAR(ring_ovf);
+    RTDOABH_STATS_INCN(ring_ovf, rtdoabh_ring_overflow());
 }
 
+static struct os_event g_ring_ev = {
+    .ev_cb = process_rx_ring,
+};
+#endif
 
 /**
  * Listen for data
@@ -397,6 +598,64 @@ rtdoa_backhaul_listen(struct uwb_dev * inst, uint64_t dx_time, uint16_t timeout_
     return inst->status;
 }
 
+/**
+ * Listen for data without blocking. Same as rtdoa_backhaul_listen but
+ * returns as soon as the receiver is armed. done_ev is put on the
+ * default eventq when the listen ends, i.e. on the first backhaul frame,
+ * rx timeout or rx error; inst->status then holds the outcome.
+ *
+ * @param inst        Pointer to struct uwb_dev.
+ * @param dx_time     Delayed start of the receiver
+ * @param timeout_uus Length of the listen window
+ * @param done_ev     Event to post on completion
+ *
+ * @return 0 if the receiver was started, OS_EBUSY if a send or listen
+ *         is still in progress, OS_ERROR if the receiver failed to start
+ */
+int
+rtdoa_backhaul_listen_async(struct uwb_dev * inst, uint64_t dx_time, uint16_t timeout_uus,
+                            struct os_event *done_ev)
+{
+    os_error_t err = os_sem_pend(&g_sem, 0);
+    if (err != OS_OK) {
+        return OS_EBUSY;
+    }
+
+    g_listen_ev = done_ev;
+    g_to_dx_time = dx_time + (((uint64_t)timeout_uus)<<16);
+    uwb_set_delay_start(inst, dx_time);
+    uwb_set_rx_timeout(inst, timeout_uus);
+
+    if(uwb_start_rx(inst).start_rx_error){
+        g_listen_ev = 0;
+        g_to_dx_time = 0;
+        err = os_sem_release(&g_sem);
+        assert(err == OS_OK);
+        RTDOABH_STATS_INC(rx_error);
+        return OS_ERROR;
+    }
+    return 0;
+}
+
+/* End of a listen window or of a send, wakes up whoever is waiting */
+static void
+listen_release(void)
+{
+    struct os_event *ev = g_listen_ev;
+
+    if (ev) {
+        g_listen_ev = 0;
+        g_to_dx_time = 0;
+    }
+    if(os_sem_get_count(&g_sem) == 0) {
+        os_error_t err = os_sem_release(&g_sem);
+        assert(err == OS_OK);
+    }
+    if (ev) {
+        os_eventq_put(os_eventq_dflt_get(), ev);
+    }
+}
+
 static bool
 tx_complete_cb(struct uwb_dev * inst, struct uwb_mac_interface * cbs)
 {
@@ -414,14 +673,71 @@ tx_complete_cb(struct uwb_dev * inst, struct uwb_mac_interface * cbs)
     return true;
 }
 
-static bool
-rx_complete_cb(struct uwb_dev * inst, struct uwb_mac_interface * cbs)
+/**
+ * Hand a received frame to the backhaul event, through the ring or an
+ * mbuf. Duplicates are filtered on the event side, where aggregate
+ * frames are unpacked.
+ *
+ * @return 0 if queued, OS_EINVAL if too short, OS_ENOMEM if dropped
+ */
+static int
+rx_queue_frame(const uint8_t *buf, uint16_t len)
 {
-    static uint16_t last_address = 0;
-    static uint8_t last_seq_num = 0;
-    int rc;
+    const ieee_rng_request_frame_t *frame = (const ieee_rng_request_frame_t*)buf;
     struct os_mbuf *om;
+    int rc, c;
+
+    if (len < sizeof(struct rtdoabh_sensor_data)) {
+        return OS_EINVAL;
+    }
+    RTDOABH_STATS_INC(rx_ok);
+#if MYNEWT_VAL(RTDOABH_RING)
+    /* Aggregates and relayed frames don't fit a ring slot,
+     * protobuf is decoded from mbufs and relays keep the mbufs
+     * until their slot, all take the mbuf path */
+    if (frame->code != DWT_RTDOABH_AGG_CODE &&
+        frame->code != DWT_RTDOABH_PB_CODE &&
+        frame->code != DWT_RTDOABH_RELAY_CODE &&
+        g_role != RTDOABH_ROLE_RELAY) {
+        if (rtdoabh_ring_push(buf, len)) {
+            RTDOABH_STATS_INC(rx_drop);
+            return OS_ENOMEM;
+        }
+        return 0;
+    }
+#endif
+    /* Only plain frames are classified, the others are range results or
+     * can't be told apart without decoding them */
+    c = (frame->code == DWT_RTDOABH_CODE) ? pkg_class(len) : RTDOABH_CLASS_RANGE;
+    om = class_get(c, len);
+    if (!om) {
+        /* Not enough memory to handle incoming packet, drop it */
+        RTDOABH_STATS_INC(rx_drop);
+        return OS_ENOMEM;
+    }
+
+    struct rtdoabh_msg_hdr *hdr = (struct rtdoabh_msg_hdr*)OS_MBUF_USRHDR(om);
+    hdr->dlen = len;
+    hdr->is_pb = (frame->code == DWT_RTDOABH_PB_CODE);
+    hdr->is_agg = (frame->code == DWT_RTDOABH_AGG_CODE);
+    hdr->is_remote = 1;
+    hdr->is_relay = (frame->code == DWT_RTDOABH_RELAY_CODE);
+
+    rc = os_mbuf_copyinto(om, 0, buf, hdr->dlen);
+    if (rc != 0) {
+        os_mbuf_free_chain(om);
+        class_drop(c);
+    }
+    if (rc != 0 || class_put(c, om) != 0) {
+        RTDOABH_STATS_INC(rx_drop);
+        return OS_ENOMEM;
+    }
+    return 0;
+}
 
+static bool
+rx_complete_cb(struct uwb_dev * inst, struct uwb_mac_interface * cbs)
+{
     if (g_to_dx_time) {
         uint16_t timeout_uus = (g_to_dx_time - inst->rxtimestamp) >> 16;
         uwb_set_rx_timeout(inst, timeout_uus);
@@ -436,54 +752,48 @@ rx_complete_cb(struct uwb_dev * inst, struct uwb_mac_interface * cbs)
         return false;
     }
 
-    if ((frame->dst_address != inst->my_short_address &&
-        frame->dst_address != UWB_BROADCAST_ADDRESS) ||
-        g_role == RTDOABH_ROLE_INVALID || g_role == RTDOABH_ROLE_PRODUCER) {
-
-        if(os_sem_get_count(&g_sem) == 0) {
-            os_error_t err = os_sem_release(&g_sem);
-            assert(err == OS_OK);
-        }
-        return true;
+    if ((frame->dst_address == inst->my_short_address ||
+         frame->dst_address == UWB_BROADCAST_ADDRESS) &&
+        (g_role == RTDOABH_ROLE_BRIDGE || g_role == RTDOABH_ROLE_RELAY)) {
+        rx_queue_frame(inst->rxbuf, inst->frame_len);
     }
+    listen_release();
+    return true;
+}
 
-    struct rtdoabh_tag_results_pkg *pkg = (struct rtdoabh_tag_results_pkg *)inst->rxbuf;
+/**
+ * Feed a frame into the receive path as if it had been heard over the
+ * air, for replaying captures without a radio. Must not be called
+ * concurrently with the radio receiving frames. The destination address
+ * is not checked.
+ *
+ * @param buf Frame starting with the ieee header
+ * @param len Length of buf
+ *
+ * @return 0 if queued, OS_EINVAL if not a backhaul frame for this role,
+ *         OS_ENOMEM if dropped for lack of buffers
+ */
+int
+rtdoa_backhaul_inject(const uint8_t *buf, int len)
+{
+    const ieee_rng_request_frame_t *frame = (const ieee_rng_request_frame_t*)buf;
 
-    if (inst->frame_len >= sizeof(struct rtdoabh_sensor_data)) {
-        if (pkg->head.src_address == last_address && pkg->head.seq_num == last_seq_num) {
-            RTDOABH_STATS_INC(rx_drop);
-            return true;
-        }
-        last_address = pkg->head.src_address;
-        last_seq_num = pkg->head.seq_num;
-
-        RTDOABH_STATS_INC(rx_ok);
-        om = os_mbuf_get_pkthdr(&g_mbuf_pool,
-                                sizeof(struct rtdoabh_msg_hdr));
-        if (om) {
-            struct rtdoabh_msg_hdr *hdr = (struct rtdoabh_msg_hdr*)OS_MBUF_USRHDR(om);
-            hdr->dlen = inst->frame_len;
-
-            rc = os_mbuf_copyinto(om, 0, inst->rxbuf, hdr->dlen);
-            if (rc != 0) {
-                return true;
-            }
-            rc = os_mqueue_put(&rxpkt_q, os_eventq_dflt_get(), om);
-            if (rc != 0) {
-                return true;
-            }
-        } else {
-            /* Not enough memory to handle incoming packet, drop it */
-            RTDOABH_STATS_INC(rx_drop);
-        }
+    if (len < sizeof(*frame) || len > UINT16_MAX ||
+        frame->fctrl != FCNTL_IEEE_RTDOABH || frame->code < DWT_RTDOABH_CODE ||
+        (g_role != RTDOABH_ROLE_BRIDGE && g_role != RTDOABH_ROLE_RELAY)) {
+        return OS_EINVAL;
     }
+    return rx_queue_frame(buf, len);
+}
 
-    if(os_sem_get_count(&g_sem) == 0) {
-        os_error_t err = os_sem_release(&g_sem);
-        assert(err == OS_OK);
+/* Rx timeout or error, ends a listen window if one is open */
+static bool
+rx_end_cb(struct uwb_dev * inst, struct uwb_mac_interface * cbs)
+{
+    if (g_to_dx_time) {
+        listen_release();
     }
-
-    return true;
+    return false;
 }
 
 void
@@ -495,9 +805,64 @@ rtdoa_backhaul_set_role(struct uwb_dev * inst, rtdoa_backhaul_role_t role)
 void
 rtdoa_backhaul_set_a2a(struct uwb_dev * inst)
 {
-    g_result_pkg.sensors.is_anchor_data = 1;
+    g_result_pkg->sensors.is_anchor_data = 1;
+}
+
+/* Sums of the samples since the last imu package */
+struct imu_mean {
+    int32_t sum[3];
+    uint16_t n;
+};
+
+#if MYNEWT_VAL(RTDOABH_IMU_MEAN)
+static struct imu_mean g_imu_accel;
+static struct imu_mean g_imu_gyro;
+static struct imu_mean g_imu_mag;
+#define IMU_MEAN(x) (&(x))
+#else
+#define IMU_MEAN(x) NULL
+#endif
+
+/* Record a sample, either as the value to send or into the running mean */
+static void
+imu_store(struct imu_mean *m, void *out, int16_t v0, int16_t v1, int16_t v2)
+{
+#if MYNEWT_VAL(RTDOABH_IMU_MEAN)
+    /* Keeps the sums within int32 */
+    if (m->n >= 0x8000) {
+        return;
+    }
+    m->sum[0] += v0;
+    m->sum[1] += v1;
+    m->sum[2] += v2;
+    m->n++;
+#else
+    int16_t v[3] = {v0, v1, v2};
+    memcpy(out, v, sizeof(v));
+#endif
 }
 
+#if MYNEWT_VAL(RTDOABH_IMU_MEAN)
+/* Write the rounded mean to out and start over */
+static bool
+imu_mean_take(struct imu_mean *m, void *out)
+{
+    int16_t v[3];
+    int i;
+
+    if (!m->n) {
+        return false;
+    }
+    for (i = 0; i < 3; i++) {
+        int32_t half = (m->sum[i] < 0) ? -(m->n/2) : m->n/2;
+        v[i] = (m->sum[i] + half) / m->n;
+    }
+    memcpy(out, v, sizeof(v));
+    memset(m, 0, sizeof(*m));
+    return true;
+}
+#endif
+
 int
 rtdoa_backhaul_sensor_data_cb(struct sensor* sensor, void *arg, void *data, sensor_type_t type)
 {
@@ -505,8 +870,15 @@ rtdoa_backhaul_sensor_data_cb(struct sensor* sensor, void *arg, void *data, sens
     struct sensor_mag_data *smd;
     struct sensor_gyro_data *sgd;
     struct sensor_press_data *spd;
+    struct rtdoabh_tag_results_pkg *p;
+    struct imu_mean *m = NULL;
+    size_t off = 0;
+    uint16_t valid = 0;
+    int16_t v[3];
     float conv;
+    os_sr_t sr;
 
+    /* Convert first, interrupts are only held off while storing */
     if (type == SENSOR_TYPE_ACCELEROMETER ||
         type == SENSOR_TYPE_LINEAR_ACCEL  ||
         type == SENSOR_TYPE_GRAVITY) {
@@ -514,43 +886,57 @@ rtdoa_backhaul_sensor_data_cb(struct sensor* sensor, void *arg, void *data, sens
         conv = 1000;
         sad = (struct sensor_accel_data *) data;
         if (sad->sad_x_is_valid && sad->sad_y_is_valid && sad->sad_z_is_valid) {
-            g_result_pkg_imu.sensors.acceleration[2] = (int16_t)roundf(conv*sad->sad_x);
-            g_result_pkg_imu.sensors.acceleration[0] = (int16_t)roundf(conv*sad->sad_y);
-            g_result_pkg_imu.sensors.acceleration[1] = (int16_t)roundf(conv*sad->sad_z);
-            g_result_pkg_imu.sensors.sensors_valid |= ACCELEROMETER_ENABLED;
+            v[0] = (int16_t)roundf(conv*sad->sad_y);
+            v[1] = (int16_t)roundf(conv*sad->sad_z);
+            v[2] = (int16_t)roundf(conv*sad->sad_x);
+            m = IMU_MEAN(g_imu_accel);
+            off = offsetof(struct rtdoabh_tag_results_pkg, sensors.acceleration);
+            valid = ACCELEROMETER_ENABLED;
         }
-    }
-
-    if (type == SENSOR_TYPE_MAGNETIC_FIELD) {
+    } else if (type == SENSOR_TYPE_MAGNETIC_FIELD) {
         smd = (struct sensor_mag_data *) data;
         if (smd->smd_x_is_valid && smd->smd_y_is_valid && smd->smd_z_is_valid) {
             /* uT */
-            g_result_pkg_imu.sensors.compass[2] = (int16_t)(smd->smd_x);
-            g_result_pkg_imu.sensors.compass[1] = (int16_t)(smd->smd_y);
-            g_result_pkg_imu.sensors.compass[0] = (int16_t)(smd->smd_z);
-            g_result_pkg_imu.sensors.sensors_valid |= COMPASS_ENABLED;
+            v[0] = (int16_t)(smd->smd_z);
+            v[1] = (int16_t)(smd->smd_y);
+            v[2] = (int16_t)(smd->smd_x);
+            m = IMU_MEAN(g_imu_mag);
+            off = offsetof(struct rtdoabh_tag_results_pkg, sensors.compass);
+            valid = COMPASS_ENABLED;
         }
-    }
-
-    if (type == SENSOR_TYPE_GYROSCOPE) {
+    } else if (type == SENSOR_TYPE_GYROSCOPE) {
         sgd = (struct sensor_gyro_data *) data;
 
         conv = 10.0;            /* For [-2000,2000] dps sensor range */
         if (sgd->sgd_x_is_valid && sgd->sgd_y_is_valid && sgd->sgd_z_is_valid) {
-            g_result_pkg_imu.sensors.gyro[2] = (int16_t)roundf(conv*sgd->sgd_x);
-            g_result_pkg_imu.sensors.gyro[0] = (int16_t)roundf(conv*sgd->sgd_y);
-            g_result_pkg_imu.sensors.gyro[1] = (int16_t)roundf(conv*sgd->sgd_z);
-            g_result_pkg_imu.sensors.sensors_valid |= GYRO_ENABLED;
+            v[0] = (int16_t)roundf(conv*sgd->sgd_y);
+            v[1] = (int16_t)roundf(conv*sgd->sgd_z);
+            v[2] = (int16_t)roundf(conv*sgd->sgd_x);
+            m = IMU_MEAN(g_imu_gyro);
+            off = offsetof(struct rtdoabh_tag_results_pkg, sensors.gyro);
+            valid = GYRO_ENABLED;
         }
-    }
-
-    if (type == SENSOR_TYPE_PRESSURE) {
+    } else if (type == SENSOR_TYPE_PRESSURE) {
         spd = (struct sensor_press_data *) data;
         if (spd->spd_press_is_valid) {
-            g_result_pkg_imu.sensors.pressure = (int16_t)(spd->spd_press-101300);
-            g_result_pkg_imu.sensors.sensors_valid |= PRESSURE_ENABLED;
+            v[0] = (int16_t)(spd->spd_press-101300);
+            valid = PRESSURE_ENABLED;
         }
     }
+    if (!valid) {
+        return (0);
+    }
+
+    /* Keep the package from being handed to the sender half written */
+    OS_ENTER_CRITICAL(sr);
+    p = g_result_pkg_imu;
+    if (valid == PRESSURE_ENABLED) {
+        p->sensors.pressure = v[0];
+    } else {
+        imu_store(m, (uint8_t *)p + off, v[0], v[1], v[2]);
+    }
+    p->sensors.sensors_valid |= valid;
+    OS_EXIT_CRITICAL(sr);
 
     return (0);
 }
@@ -558,152 +944,450 @@ rtdoa_backhaul_sensor_data_cb(struct sensor* sensor, void *arg, void *data, sens
 void
 rtdoa_backhaul_battery_cb(float battery_volt)
 {
-    g_result_pkg_imu.sensors.battery_voltage = (int8_t)(battery_volt*128/5.0);
-    g_result_pkg_imu.sensors.sensors_valid |= BATTERY_LEVELS_ENABLED;
+    os_sr_t sr;
+
+    OS_ENTER_CRITICAL(sr);
+    g_result_pkg_imu->sensors.battery_voltage = (int8_t)(battery_volt*128/5.0);
+    g_result_pkg_imu->sensors.sensors_valid |= BATTERY_LEVELS_ENABLED;
+    OS_EXIT_CRITICAL(sr);
 }
 
 void
 rtdoa_backhaul_usb_cb(float usb_volt)
 {
-    g_result_pkg_imu.sensors.has_usb_power = usb_volt > 3.0;
+    os_sr_t sr;
+
+    OS_ENTER_CRITICAL(sr);
+    g_result_pkg_imu->sensors.has_usb_power = usb_volt > 3.0;
+    OS_EXIT_CRITICAL(sr);
 }
 
 void
 rtdoa_backhaul_set_ts(uint64_t sensor_time)
 {
-    g_result_pkg.sensors.ts = sensor_time;
+    g_result_pkg->sensors.ts = sensor_time;
 }
 
+#if !MYNEWT_VAL(RTDOABH_USE_PROTOBUF)
 static int
 rtdoa_local_send(uint8_t *buf, int dlen)
 {
     int rc;
+    int c = pkg_class(dlen);
     struct os_mbuf *om;
-    om = os_mbuf_get_pkthdr(&g_mbuf_pool,
-                            sizeof(struct rtdoabh_msg_hdr));
+    om = class_get(c, dlen);
     if (!om) {
         return OS_ENOMEM;
     }
 
     struct rtdoabh_msg_hdr *hdr = (struct rtdoabh_msg_hdr*)OS_MBUF_USRHDR(om);
     hdr->dlen = dlen;
+    hdr->is_pb = 0;
+    hdr->is_agg = 0;
+    hdr->is_remote = 0;
+    hdr->is_relay = 0;
     rc = os_mbuf_copyinto(om, 0, buf, hdr->dlen);
     if (rc != 0) {
-        goto exit_err;
+        os_mbuf_free_chain(om);
+        class_drop(c);
+        return rc;
     }
-    rc = os_mqueue_put(&rxpkt_q, os_eventq_dflt_get(), om);
-    if (rc != 0) {
-        goto exit_err;
+    return class_put(c, om);
+}
+#else
+/* Length of p as a protobuf frame, see pb_build */
+static int
+pb_frame_len(const struct rtdoabh_tag_results_pkg *p, int dlen)
+{
+    int len = rtdoa_pb_encoded_size(p, dlen);
+
+    return sizeof(struct _ieee_rng_request_frame_t) + len +
+        ((len > 0x3fff) ? 3 : (len > 0x7f) ? 2 : 1);
+}
+
+/**
+ * Encode p into om, an empty packet header mbuf, as the ieee header, with
+ * the pb code, followed by the length prefixed TagResult message. om is
+ * freed on failure, NULL is passed through.
+ */
+static struct os_mbuf *
+pb_build(const struct rtdoabh_tag_results_pkg *p, int dlen, struct os_mbuf *om)
+{
+    struct _ieee_rng_request_frame_t head = p->head;
+    struct rtdoabh_msg_hdr *hdr;
+    uint8_t prefix[3];
+    int len, n = 0;
+
+    if (!om) {
+        return NULL;
     }
+    len = rtdoa_pb_encoded_size(p, dlen);
+    do {
+        prefix[n++] = (len & 0x7f) | ((len > 0x7f) ? 0x80 : 0);
+        len >>= 7;
+    } while (len);
+    head.code = DWT_RTDOABH_PB_CODE;
+
+    if (os_mbuf_append(om, &head, sizeof(head)) ||
+        os_mbuf_append(om, prefix, n) ||
+        rtdoa_pb_encode(om, p, dlen) < 0) {
+        os_mbuf_free_chain(om);
+        return NULL;
+    }
+    hdr = (struct rtdoabh_msg_hdr*)OS_MBUF_USRHDR(om);
+    hdr->dlen = OS_MBUF_PKTLEN(om);
+    hdr->is_pb = 1;
+    hdr->is_agg = 0;
+    hdr->is_remote = 0;
+    hdr->is_relay = 0;
+    return om;
+}
 
-    return 0;
-exit_err:
+/* Write the protobuf encoded result segment by segment */
+static void
+pb_write_tx(struct uwb_dev * inst, const struct rtdoabh_tag_results_pkg *p, int dlen)
+{
+    struct os_mbuf *om = pb_build(p, dlen, class_try_get(pkg_class(dlen),
+                                                         pb_frame_len(p, dlen)));
+    struct os_mbuf *m;
+    int off = 0;
+
+    if (!om) {
+        /* Out of mbufs, send the packed struct instead */
+        uwb_write_tx_fctrl(inst, dlen, 0);
+        uwb_write_tx(inst, (uint8_t*)p, 0, dlen);
+        return;
+    }
+    uwb_write_tx_fctrl(inst, OS_MBUF_PKTLEN(om), 0);
+    for (m = om; m; m = SLIST_NEXT(m, om_next)) {
+        uwb_write_tx(inst, m->om_data, off, m->om_len);
+        off += m->om_len;
+    }
     os_mbuf_free_chain(om);
-    return rc;
+}
+#endif
+
+/* Queue a locally produced result for output */
+static int
+rtdoa_local_send_pkg(struct rtdoabh_tag_results_pkg *p, int dlen)
+{
+#if MYNEWT_VAL(RTDOABH_USE_PROTOBUF)
+    int c = pkg_class(dlen);
+    struct os_mbuf *om = pb_build(p, dlen, class_get(c, pb_frame_len(p, dlen)));
+
+    if (!om) {
+        return OS_ENOMEM;
+    }
+    return class_put(c, om);
+#else
+    return rtdoa_local_send((uint8_t*)p, dlen);
+#endif
 }
 
 int
 rtdoa_backhaul_queue_size()
 {
     int queued = g_mbuf_mempool.mp_num_blocks - g_mbuf_mempool.mp_num_free;
+#if MYNEWT_VAL(RTDOABH_RING)
+    queued += rtdoabh_ring_used();
+#endif
     return queued;
 }
 
+/**
+ * Number of packages taken off the queue since init, output or not.
+ * Sampled twice it gives the rate at which the queue drains.
+ */
+uint32_t
+rtdoa_backhaul_queue_drained(void)
+{
+    return g_drained;
+}
+
 void
 rtdoa_backhaul_send_imu_only(uint64_t ts)
 {
-    g_result_pkg_imu.head.seq_num++;
-    g_result_pkg_imu.sensors.ts = ts;
-    rtdoa_local_send((uint8_t*)&g_result_pkg_imu, sizeof(struct _ieee_rng_request_frame_t) + sizeof(struct rtdoabh_sensor_data));
-    memset(&g_result_pkg_imu.sensors, 0, sizeof(struct rtdoabh_sensor_data));
+    struct rtdoabh_tag_results_pkg *p;
+#if MYNEWT_VAL(RTDOABH_IMU_MEAN)
+    os_sr_t sr;
+
+    /* Samples arriving after this go into the next package */
+    OS_ENTER_CRITICAL(sr);
+    p = g_result_pkg_imu;
+    if (imu_mean_take(&g_imu_accel, p->sensors.acceleration)) {
+        p->sensors.sensors_valid |= ACCELEROMETER_ENABLED;
+    }
+    if (imu_mean_take(&g_imu_gyro, p->sensors.gyro)) {
+        p->sensors.sensors_valid |= GYRO_ENABLED;
+    }
+    if (imu_mean_take(&g_imu_mag, p->sensors.compass)) {
+        p->sensors.sensors_valid |= COMPASS_ENABLED;
+    }
+    OS_EXIT_CRITICAL(sr);
+#endif
+
+    p = rtdoabh_pkg_swap(&g_result_pkg_imu);
+    if (!p) {
+        /* Keep filling the current one, it goes out next time */
+        RTDOABH_STATS_INC(pkg_short);
+        return;
+    }
+    p->head.seq_num = ++g_result_imu_seq;
+    p->sensors.ts = ts;
+    rtdoa_local_send_pkg(p, sizeof(struct _ieee_rng_request_frame_t) + sizeof(struct rtdoabh_sensor_data));
+    rtdoabh_pkg_free(p);
+}
+
+#if MYNEWT_VAL(RTDOABH_AGGREGATE)
+/**
+ * Add the current result to the pending aggregate and transmit the
+ * aggregate in this slot if it is due or the result did not fit. Without
+ * a dx_time the result is only added, to go out in the next uplink slot.
+ */
+static void
+agg_send(struct uwb_dev * inst, const struct rtdoabh_tag_results_pkg *p,
+         uint64_t dx_time, int dlen)
+{
+    const uint8_t *frame;
+    int rc, len, count;
+
+    rc = rtdoabh_agg_add(p, dlen);
+    if (!dx_time) {
+        if (rc) {
+            /* Full, and it can't go out before our slot */
+            RTDOABH_STATS_INC(agg_drop);
+        }
+        return;
+    }
+    if (rc == 0 && !rtdoabh_agg_due()) {
+        return;
+    }
+    frame = rtdoabh_agg_take(&len, &count);
+    if (frame == NULL) {
+        if (rc) {
+            RTDOABH_STATS_INC(agg_drop);
+        }
+        return;
+    }
+
+    uwb_set_delay_start(inst, dx_time);
+    uwb_write_tx_fctrl(inst, len, 0);
+    uwb_write_tx(inst, (uint8_t*)frame, 0, len);
+    if (uwb_start_tx(inst).start_tx_error) {
+        RTDOABH_STATS_INC(tx_err);
+    } else {
+        RTDOABH_STATS_INC(tx_ok);
+        RTDOABH_STATS_INCN(agg_txrec, count);
+    }
+
+    if (rc == OS_ENOMEM) {
+        /* The frame is in the radio now, start the next aggregate */
+        rc = rtdoabh_agg_add(p, dlen);
+    }
+    if (rc) {
+        RTDOABH_STATS_INC(agg_drop);
+    }
+}
+#endif
+
+#if MYNEWT_VAL(RTDOABH_ZIP) && !MYNEWT_VAL(RTDOABH_AGGREGATE)
+/* Write the compressed result, or the plain one if that is shorter */
+static void
+zip_write_tx(struct uwb_dev * inst, const struct rtdoabh_tag_results_pkg *p, int dlen)
+{
+    static uint8_t buf[sizeof(struct rtdoabh_tag_results_pkg)];
+    int len;
+
+    len = rtdoabh_zip_encode(p, dlen, buf, sizeof(buf));
+    if (len < 0 || len >= dlen) {
+        uwb_write_tx_fctrl(inst, dlen, 0);
+        uwb_write_tx(inst, (uint8_t*)p, 0, dlen);
+        return;
+    }
+    RTDOABH_STATS_INCN(zip_saved, dlen - len);
+    uwb_write_tx_fctrl(inst, len, 0);
+    uwb_write_tx(inst, buf, 0, len);
+}
+#endif
+
+/**
+ * Send a relay frame: own, if given, followed by as many queued frames
+ * as fit, see rtdoabh_relay.c.
+ *
+ * @return 0 if a frame was sent, OS_ENOENT if there was nothing to send,
+ *         OS_ERROR if the transmission failed to start
+ */
+static int
+relay_send(struct uwb_dev * inst, const struct rtdoabh_tag_results_pkg *own,
+           int own_len, uint64_t dx_time)
+{
+    const uint8_t *frame;
+    int len, count;
+#if MYNEWT_VAL(RTDOABH_ZIP)
+    static uint8_t zbuf[sizeof(struct rtdoabh_tag_results_pkg)];
+
+    if (own) {
+        len = rtdoabh_zip_encode(own, own_len, zbuf, sizeof(zbuf));
+        if (len > 0 && len < own_len) {
+            RTDOABH_STATS_INCN(zip_saved, own_len - len);
+            own = (const struct rtdoabh_tag_results_pkg *)zbuf;
+            own_len = len;
+        }
+    }
+#endif
+
+    frame = rtdoabh_relay_take(own, own_len, &len, &count);
+    if (!frame) {
+        return OS_ENOENT;
+    }
+    uwb_set_delay_start(inst, dx_time);
+    uwb_write_tx_fctrl(inst, len, 0);
+    uwb_write_tx(inst, (uint8_t*)frame, 0, len);
+    if (uwb_start_tx(inst).start_tx_error) {
+        if (own) {
+            RTDOABH_STATS_INC(tx_err);
+        }
+        RTDOABH_STATS_INCN(relay_err, count);
+        return OS_ERROR;
+    }
+    if (own) {
+        RTDOABH_STATS_INC(tx_ok);
+    }
+    RTDOABH_STATS_INCN(relay_ok, count);
+    return 0;
 }
 
 struct uwb_dev_status
 rtdoa_backhaul_send(struct uwb_dev * inst, struct rtdoa_instance *rtdoa,
                     uint64_t dx_time)
 {
-    g_result_pkg.head.seq_num++;
-    g_result_pkg.num_ranges = 0;
+    /* From here on p is ours, the next result is built in a fresh
+     * package while this one is sent */
+    struct rtdoabh_tag_results_pkg *p = rtdoabh_pkg_swap(&g_result_pkg);
+
+    if (!p) {
+        RTDOABH_STATS_INC(pkg_short);
+        return inst->status;
+    }
+    p->head.seq_num = ++g_result_seq;
+    p->num_ranges = 0;
 
-    g_result_pkg.head.code = DWT_RTDOABH_CODE;
     /* Write sensorinformation part of packet */
     int dlen = sizeof(struct rtdoabh_tag_results_pkg);
+#if !MYNEWT_VAL(RTDOABH_AGGREGATE)
     int split_at = offsetof(struct rtdoabh_tag_results_pkg, num_ranges);
-    if (dx_time) {
-        uwb_write_tx(inst, (uint8_t*)&g_result_pkg, 0, split_at+1); /* +1 to write 0 to num rng */
-    }
-    g_result_pkg.ref_anchor_addr = rtdoa->req_frame->src_address;
-
-    for(int i = 0 ; i < rtdoa->nframes;i++)
-    {
-        /* TODO: Should we skip ref_anchor in ranges? */
-        //if (g_result_pkg.ref_anchor_addr == rtdoa->frames[i]->src_address) {
-        //    continue;
-        //}
-        float diff = rtdoa_tdoa_between_frames(rtdoa, rtdoa->req_frame, rtdoa->frames[i]);
-        if (isnan(diff)) continue;
-
-        int32_t diff_mm = (int32_t)(diff*1000.0f + 0.5f);
-        g_result_pkg.ranges[g_result_pkg.num_ranges].diff_dist_mm = diff_mm;
-        if (rtdoa->frames[i]->src_address == 0) {
-            continue;
-        }
-        float rssi = uwb_calc_rssi(inst, &rtdoa->frames[i]->diag);
-        float fppl = uwb_calc_fppl(inst, &rtdoa->frames[i]->diag);
-#if MYNEWT_VAL(RTDOABH_STATS)
-        RTDOABH_STATS_INC(num_ranges);
-        update_range_stats(i, diff_mm, rssi);
-#endif
-        g_result_pkg.ranges[g_result_pkg.num_ranges].anchor_addr = rtdoa->frames[i]->src_address;
-        g_result_pkg.ranges[g_result_pkg.num_ranges].rssi = rssi*10;
-        g_result_pkg.ranges[g_result_pkg.num_ranges].quality = (int)uwb_estimate_los(inst, rssi,fppl);
-        g_result_pkg.num_ranges++;
+#if !MYNEWT_VAL(RTDOABH_ZIP) && !MYNEWT_VAL(RTDOABH_USE_PROTOBUF)
+    if (dx_time && g_role != RTDOABH_ROLE_RELAY) {
+        uwb_write_tx(inst, (uint8_t*)p, 0, split_at+1); /* +1 to write 0 to num rng */
     }
+#endif
+#endif
+    p->ref_anchor_addr = rtdoa->req_frame->src_address;
+
+    rtdoabh_collect_ranges(inst, rtdoa, p);
+    RTDOABH_STATS_INCN(num_ranges, p->num_ranges);
 
     /* Removed unused slots from packet to send */
-    dlen -= sizeof(struct rtdoabh_range_data)*(sizeof(g_result_pkg.ranges)/sizeof(g_result_pkg.ranges[0]) -
-                                          g_result_pkg.num_ranges);
+    dlen -= sizeof(struct rtdoabh_range_data)*(sizeof(p->ranges)/sizeof(p->ranges[0]) -
+                                          p->num_ranges);
 
+    if (g_role == RTDOABH_ROLE_RELAY) {
+        /* The relay frame carries our result ahead of the queued ones */
+        if (dx_time) {
+            relay_send(inst, p, dlen, dx_time);
+        }
+        goto exit_err;
+    }
+#if MYNEWT_VAL(RTDOABH_AGGREGATE)
+    /* Producers only get an uplink slot every so often, keep the
+     * results from the slots in between */
+    if (dx_time || g_role == RTDOABH_ROLE_PRODUCER) {
+        agg_send(inst, p, dx_time, dlen);
+    }
+#else
     if (dx_time) {
         uwb_set_delay_start(inst, dx_time);
+#if MYNEWT_VAL(RTDOABH_USE_PROTOBUF)
+        pb_write_tx(inst, p, dlen);
+#elif MYNEWT_VAL(RTDOABH_ZIP)
+        zip_write_tx(inst, p, dlen);
+#else
         uwb_write_tx_fctrl(inst, dlen, 0);
-        uwb_write_tx(inst, ((uint8_t*)&g_result_pkg)+split_at, split_at, dlen-split_at);
+        uwb_write_tx(inst, ((uint8_t*)p)+split_at, split_at, dlen-split_at);
+#endif
         if (uwb_start_tx(inst).start_tx_error) {
             RTDOABH_STATS_INC(tx_err);
-            uint32_t utime = os_cputime_ticks_to_usecs(os_cputime_get32());
-            printf("{\"utime\": %lu,\"msg\": \"rtdoabh_start_tx_error(res)\"}\n",utime);
             goto exit_err;
         } else if (dlen-split_at > 1) {
             RTDOABH_STATS_INC(tx_ok);
         }
     }
+#endif
     /* If we're a local bridge */
     if (g_role == RTDOABH_ROLE_BRIDGE) {
-        int rc = rtdoa_local_send((uint8_t*)&g_result_pkg, dlen);
+        int rc = rtdoa_local_send_pkg(p, dlen);
         if (rc != 0) {
             goto exit_err;
         }
     }
 
 exit_err:
-    /* Clear buffers in anticipaction of the next round */
-    memset(&g_result_pkg.sensors, 0, sizeof(struct rtdoabh_sensor_data));
-    memset(&g_result_pkg.ranges, 0, MYNEWT_VAL(RTDOABH_MAXNUM_RANGES)*sizeof(struct rtdoabh_range_data));
+    /* Written to the radio or copied to the queue, back to the pool */
+    rtdoabh_pkg_free(p);
+    RTDOABH_STATS_CLEAR(pkg_hwm);
+    RTDOABH_STATS_INCN(pkg_hwm, rtdoabh_pkg_hwm());
     return inst->status;
 }
 
+/**
+ * Forward the frames a relay has queued, as many as fit in one frame,
+ * see RTDOABH_ROLE_RELAY. Call in the relay's own backhaul slot when
+ * there is no result of its own to send. rtdoa_backhaul_send on a relay
+ * forwards queued frames along with the result.
+ *
+ * @param inst    Pointer to struct uwb_dev.
+ * @param dx_time Delayed start of the transmission
+ *
+ * @return 0 if a frame was sent, OS_ENOENT if none is queued, OS_ERROR
+ *         if the transmission failed to start
+ */
+int
+rtdoa_backhaul_relay(struct uwb_dev * inst, uint64_t dx_time)
+{
+    return relay_send(inst, NULL, 0, dx_time);
+}
+
+/**
+ * Set up the backhaul on a radio. Without one, e.g. on sim, inst is
+ * NULL and frames only come in through rtdoa_backhaul_inject.
+ */
 void
 rtdoa_backhaul_init(struct uwb_dev * inst)
 {
-    assert(inst);
+    uint16_t addr = (inst) ? inst->my_short_address : 0;
 
     create_mbuf_pool();
-    os_mqueue_init(&rxpkt_q, process_rx_data_queue, NULL);
-
-    g_result_pkg.head.src_address = inst->my_short_address;
-    g_result_pkg_imu.head.src_address = inst->my_short_address;
+    for (int c = 0; c < RTDOABH_CLASS_NUM; c++) {
+        os_mqueue_init(&rxpkt_q[c], process_rx_data_queue, NULL);
+    }
+#if MYNEWT_VAL(RTDOABH_RING)
+    rtdoabh_ring_init(&g_ring_ev);
+#endif
+    rtdoabh_dedup_init();
+    rtdoabh_out_init();
+    rtdoabh_relay_init(addr);
+
+    rtdoabh_pkg_init(addr);
+    g_result_pkg = rtdoabh_pkg_alloc();
+    g_result_pkg_imu = rtdoabh_pkg_alloc();
+    assert(g_result_pkg && g_result_pkg_imu);
+#if MYNEWT_VAL(RTDOABH_AGGREGATE)
+    rtdoabh_agg_init(addr);
+#endif
 
-    uwb_mac_append_interface(inst, &g_cbs);
+    if (inst) {
+        uwb_mac_append_interface(inst, &g_cbs);
+    }
 }
 
 void
@@ -718,5 +1402,6 @@ rtdoa_backhaul_pkg_init(void)
         STATS_HDR(g_tag_stats), STATS_SIZE_INIT_PARMS(g_tag_stats,
         STATS_SIZE_32), STATS_NAME_INIT_PARMS(tag_stats), "rtdoabh");
     assert(rc == 0);
+    rtdoabh_astats_init();
 #endif
 }
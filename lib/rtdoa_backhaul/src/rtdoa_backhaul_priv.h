@@ -0,0 +1,142 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _RTDOA_BACKHAUL_PRIV_H_
+#define _RTDOA_BACKHAUL_PRIV_H_
+
+#include <inttypes.h>
+#include <os/mynewt.h>
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define RTDOABH_SLIP_BUF_SIZE   (64)
+
+/* SLIP encoder state, escaped bytes are staged in buf and written
+ * to the console when it fills up */
+struct rtdoabh_slip {
+    uint16_t crc;
+    uint16_t len;
+    uint8_t buf[RTDOABH_SLIP_BUF_SIZE];
+};
+
+void rtdoabh_slip_start(struct rtdoabh_slip *s, uint8_t type, uint16_t dlen);
+void rtdoabh_slip_append(struct rtdoabh_slip *s, const void *data, int len);
+int rtdoabh_slip_append_mbuf(struct rtdoabh_slip *s, struct os_mbuf *om, int off, int len);
+void rtdoabh_slip_finish(struct rtdoabh_slip *s);
+
+/* Record output, console or batched udp, see rtdoabh_out.c */
+void rtdoabh_out_init(void);
+void rtdoabh_out_write(const void *buf, int len);
+void rtdoabh_out_end(void);
+void rtdoabh_out_flush(void);
+
+/* Read only view of a received package, see rtdoabh_view.c */
+struct rtdoabh_pkg_view {
+    const struct _ieee_rng_request_frame_t *head;
+    const struct rtdoabh_sensor_data *sensors;
+    uint16_t ref_anchor_addr;
+    uint8_t num_ranges;         /**< Clamped to what the packet holds */
+    int len;
+    const struct os_mbuf *om;   /**< Source chain, NULL for flat buffers */
+    const uint8_t *flat;        /**< Source buffer if om is NULL */
+    struct {
+        struct _ieee_rng_request_frame_t head;
+        struct rtdoabh_sensor_data sensors;
+    } __attribute__((packed, aligned(1))) fixed; /**< Used if head+sensors not contiguous */
+};
+
+int rtdoabh_view_init_flat(struct rtdoabh_pkg_view *v, const void *buf, int len);
+int rtdoabh_view_init_mbuf(struct rtdoabh_pkg_view *v, struct os_mbuf *om);
+const struct rtdoabh_range_data *rtdoabh_view_range(const struct rtdoabh_pkg_view *v,
+                                                    int idx, struct rtdoabh_range_data *tmp);
+int rtdoabh_format_view(const struct rtdoabh_pkg_view *v, bool tight, char *buf, int size);
+void rtdoabh_print_view(const struct rtdoabh_pkg_view *v, bool tight);
+
+/* Rx ring, see rtdoabh_ring.c and RTDOABH_RING */
+struct rtdoabh_ring_slot {
+    uint16_t dlen;
+    uint8_t data[sizeof(struct rtdoabh_tag_results_pkg)];
+};
+
+void rtdoabh_ring_init(struct os_event *ev);
+int rtdoabh_ring_push(const void *data, int len);
+int rtdoabh_ring_drain(void (*cb)(const uint8_t *data, int len));
+int rtdoabh_ring_used(void);
+uint16_t rtdoabh_ring_hwm(void);
+uint32_t rtdoabh_ring_overflow(void);
+
+/* Result package pool, see rtdoabh_pkg.c */
+void rtdoabh_pkg_init(uint16_t src_address);
+struct rtdoabh_tag_results_pkg *rtdoabh_pkg_alloc(void);
+void rtdoabh_pkg_free(struct rtdoabh_tag_results_pkg *p);
+struct rtdoabh_tag_results_pkg *rtdoabh_pkg_swap(struct rtdoabh_tag_results_pkg **cur);
+uint8_t rtdoabh_pkg_hwm(void);
+
+void rtdoabh_agg_init(uint16_t src_address);
+int rtdoabh_agg_add(const struct rtdoabh_tag_results_pkg *p, int dlen);
+bool rtdoabh_agg_due(void);
+const uint8_t *rtdoabh_agg_take(int *len, int *count);
+int rtdoabh_agg_unpack(struct os_mbuf *om, void (*cb)(const uint8_t *data, int len));
+
+int rtdoabh_zip_encode(const struct rtdoabh_tag_results_pkg *p, int dlen,
+                       uint8_t *buf, int size);
+int rtdoabh_zip_decode(const uint8_t *buf, int len, struct rtdoabh_tag_results_pkg *p);
+
+/* Multi hop relaying, see rtdoabh_relay.c */
+void rtdoabh_relay_init(uint16_t src_address);
+int rtdoabh_relay_unpack(struct os_mbuf *om, void (*cb)(struct os_mbuf *om, int off, int len));
+int rtdoabh_relay_push(struct os_mbuf *om);
+const uint8_t *rtdoabh_relay_take(const void *own, int own_len, int *len, int *count);
+
+void rtdoabh_dedup_init(void);
+bool rtdoabh_dedup_check(uint16_t addr, uint8_t seq);
+
+struct uwb_dev;
+struct rtdoa_instance;
+int rtdoabh_collect_ranges(struct uwb_dev *inst, struct rtdoa_instance *rtdoa,
+                           struct rtdoabh_tag_results_pkg *p);
+
+void rtdoabh_astats_init(void);
+void rtdoabh_astats_update(uint16_t addr, int32_t dd_mm, int32_t rssi);
+
+/* Integer only json writer, output is silently cut at size and
+ * overflow set */
+struct rtdoabh_json {
+    char *buf;
+    int len;
+    int size;
+    int overflow;
+};
+
+void rtdoabh_json_init(struct rtdoabh_json *j, char *buf, int size);
+void rtdoabh_json_str(struct rtdoabh_json *j, const char *s);
+void rtdoabh_json_char(struct rtdoabh_json *j, char c);
+void rtdoabh_json_uint(struct rtdoabh_json *j, uint32_t v);
+void rtdoabh_json_int(struct rtdoabh_json *j, int32_t v);
+void rtdoabh_json_fixed(struct rtdoabh_json *j, int32_t v, int decimals);
+void rtdoabh_json_hex(struct rtdoabh_json *j, uint32_t v, int min_digits);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _RTDOA_BACKHAUL_PRIV_H_ */
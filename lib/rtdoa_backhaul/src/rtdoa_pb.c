@@ -0,0 +1,538 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Streaming protobuf encoder and decoder for TagResult messages of
+ * proto/rtdoa_backhaul.proto. Fields are written straight from a
+ * rtdoabh_tag_results_pkg into an mbuf chain through a small staging
+ * buffer, and read back by walking the chain, so there is no generated
+ * message struct in between. Zero valued scalars are left out as
+ * proto3 does, nested Range lengths are computed from the field values
+ * up front.
+ */
+
+#include <string.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+#include "rtdoa_pb.h"
+
+#define PB_WT_VARINT    0
+#define PB_WT_64BIT     1
+#define PB_WT_LEN       2
+#define PB_WT_32BIT     5
+
+#define PB_SENSORS_END  offsetof(struct rtdoabh_tag_results_pkg, ref_anchor_addr)
+#define PB_RANGES_OFF   offsetof(struct rtdoabh_tag_results_pkg, ranges)
+
+struct pb_out {
+    struct os_mbuf *om;     /**< NULL when only counting */
+    int len;
+    int err;
+    uint8_t n;
+    uint8_t buf[32];
+};
+
+static void
+pb_flush(struct pb_out *o)
+{
+    if (o->n && o->om && os_mbuf_append(o->om, o->buf, o->n)) {
+        o->err = 1;
+    }
+    o->n = 0;
+}
+
+static inline void
+pb_byte(struct pb_out *o, uint8_t c)
+{
+    if (o->n == sizeof(o->buf)) {
+        pb_flush(o);
+    }
+    o->buf[o->n++] = c;
+    o->len++;
+}
+
+static void
+pb_varint(struct pb_out *o, uint64_t v)
+{
+    while (v >= 0x80) {
+        pb_byte(o, (v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    pb_byte(o, v);
+}
+
+static int
+pb_varint_size(uint64_t v)
+{
+    int n = 1;
+
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static inline uint32_t
+pb_zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t
+pb_unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static inline void
+pb_key(struct pb_out *o, int field, int wt)
+{
+    pb_varint(o, (field << 3) | wt);
+}
+
+static void
+pb_uint(struct pb_out *o, int field, uint64_t v)
+{
+    if (v) {
+        pb_key(o, field, PB_WT_VARINT);
+        pb_varint(o, v);
+    }
+}
+
+static void
+pb_sint(struct pb_out *o, int field, int32_t v)
+{
+    pb_uint(o, field, pb_zigzag(v));
+}
+
+static void
+pb_float(struct pb_out *o, int field, float f)
+{
+    uint32_t v;
+
+    memcpy(&v, &f, sizeof(v));
+    if (v) {
+        pb_key(o, field, PB_WT_32BIT);
+        pb_byte(o, v);
+        pb_byte(o, v >> 8);
+        pb_byte(o, v >> 16);
+        pb_byte(o, v >> 24);
+    }
+}
+
+/* Packed repeated sint32 of three values */
+static void
+pb_xyz(struct pb_out *o, int field, const void *xyz)
+{
+    int16_t v[3];
+    int i, len = 0;
+
+    memcpy(v, xyz, sizeof(v));
+    for (i = 0; i < 3; i++) {
+        len += pb_varint_size(pb_zigzag(v[i]));
+    }
+    pb_key(o, field, PB_WT_LEN);
+    pb_varint(o, len);
+    for (i = 0; i < 3; i++) {
+        pb_varint(o, pb_zigzag(v[i]));
+    }
+}
+
+/* Encoded size of a varint field, 0 if it is left out */
+static int
+pb_uint_size(int field, uint64_t v)
+{
+    return (v) ? pb_varint_size(field << 3) + pb_varint_size(v) : 0;
+}
+
+static int
+pb_range_size(const struct rtdoabh_range_data *r)
+{
+    return pb_uint_size(RTDOA_PB_RANGE_ANCHOR_ADDR, r->anchor_addr) +
+        pb_uint_size(RTDOA_PB_RANGE_DIFF_DIST_MM, pb_zigzag(r->diff_dist_mm)) +
+        pb_uint_size(RTDOA_PB_RANGE_RSSI, pb_zigzag(r->rssi)) +
+        pb_uint_size(RTDOA_PB_RANGE_QUALITY, pb_zigzag(r->quality));
+}
+
+static void
+pb_range(struct pb_out *o, const struct rtdoabh_range_data *r)
+{
+    pb_uint(o, RTDOA_PB_RANGE_ANCHOR_ADDR, r->anchor_addr);
+    pb_sint(o, RTDOA_PB_RANGE_DIFF_DIST_MM, r->diff_dist_mm);
+    pb_sint(o, RTDOA_PB_RANGE_RSSI, r->rssi);
+    pb_sint(o, RTDOA_PB_RANGE_QUALITY, r->quality);
+}
+
+static void
+pb_encode_pkg(struct pb_out *o, const struct rtdoabh_tag_results_pkg *p, int dlen)
+{
+    const struct rtdoabh_sensor_data *d = &p->sensors;
+    uint32_t valid = d->sensors_valid | (d->has_usb_power << 14) | (d->is_anchor_data << 15);
+    int i, n;
+
+    pb_uint(o, RTDOA_PB_TAG_SRC_ADDRESS, p->head.src_address);
+    pb_uint(o, RTDOA_PB_TAG_SEQ_NUM, p->head.seq_num);
+    pb_uint(o, RTDOA_PB_TAG_TS, d->ts);
+    pb_uint(o, RTDOA_PB_TAG_SENSORS_VALID, valid);
+
+    if (valid & GPS_LAT_LONG_ENABLED) {
+        pb_float(o, RTDOA_PB_TAG_GPS_LAT, d->gps_lat);
+        pb_float(o, RTDOA_PB_TAG_GPS_LONG, d->gps_long);
+    }
+    if (valid & BATTERY_LEVELS_ENABLED) {
+        pb_sint(o, RTDOA_PB_TAG_BATTERY_VOLTAGE, d->battery_voltage);
+    }
+    if (valid & PRESSURE_ENABLED) {
+        pb_sint(o, RTDOA_PB_TAG_PRESSURE, d->pressure);
+    }
+    if (valid & COMPASS_ENABLED) {
+        pb_xyz(o, RTDOA_PB_TAG_COMPASS, d->compass);
+    }
+    if (valid & ACCELEROMETER_ENABLED) {
+        pb_xyz(o, RTDOA_PB_TAG_ACCELERATION, d->acceleration);
+    }
+    if (valid & GYRO_ENABLED) {
+        pb_xyz(o, RTDOA_PB_TAG_GYRO, d->gyro);
+    }
+
+    if (dlen < PB_RANGES_OFF) {
+        return;
+    }
+    /* Always sent when there is a range block, marks it as present */
+    pb_key(o, RTDOA_PB_TAG_REF_ANCHOR_ADDR, PB_WT_VARINT);
+    pb_varint(o, p->ref_anchor_addr);
+
+    n = (dlen - PB_RANGES_OFF) / sizeof(struct rtdoabh_range_data);
+    n = (n > p->num_ranges) ? p->num_ranges : n;
+    for (i = 0; i < n; i++) {
+        pb_key(o, RTDOA_PB_TAG_RANGES, PB_WT_LEN);
+        pb_varint(o, pb_range_size(&p->ranges[i]));
+        pb_range(o, &p->ranges[i]);
+    }
+}
+
+/**
+ * @return Number of bytes rtdoa_pb_encode would append
+ */
+int
+rtdoa_pb_encoded_size(const struct rtdoabh_tag_results_pkg *p, int dlen)
+{
+    struct pb_out o = {0};
+
+    pb_encode_pkg(&o, p, dlen);
+    return o.len;
+}
+
+/**
+ * Append p as a TagResult message to an mbuf chain, growing the chain
+ * from its own pool as needed.
+ *
+ * @param om   Chain to append to
+ * @param p    Package to encode
+ * @param dlen Length of p as it would be sent as a packed struct
+ *
+ * @return Number of bytes appended, or -1 if the pool ran dry
+ */
+int
+rtdoa_pb_encode(struct os_mbuf *om, const struct rtdoabh_tag_results_pkg *p, int dlen)
+{
+    struct pb_out o = {0};
+
+    o.om = om;
+    pb_encode_pkg(&o, p, dlen);
+    pb_flush(&o);
+    return (o.err) ? -1 : o.len;
+}
+
+/* Wire type of each TagResult field, repeated sint32 accept both */
+static const uint8_t g_tag_wt[] = {
+    [RTDOA_PB_TAG_SRC_ADDRESS] = PB_WT_VARINT,
+    [RTDOA_PB_TAG_SEQ_NUM] = PB_WT_VARINT,
+    [RTDOA_PB_TAG_TS] = PB_WT_VARINT,
+    [RTDOA_PB_TAG_SENSORS_VALID] = PB_WT_VARINT,
+    [RTDOA_PB_TAG_GPS_LAT] = PB_WT_32BIT,
+    [RTDOA_PB_TAG_GPS_LONG] = PB_WT_32BIT,
+    [RTDOA_PB_TAG_BATTERY_VOLTAGE] = PB_WT_VARINT,
+    [RTDOA_PB_TAG_PRESSURE] = PB_WT_VARINT,
+    [RTDOA_PB_TAG_COMPASS] = PB_WT_LEN,
+    [RTDOA_PB_TAG_ACCELERATION] = PB_WT_LEN,
+    [RTDOA_PB_TAG_GYRO] = PB_WT_LEN,
+    [RTDOA_PB_TAG_REF_ANCHOR_ADDR] = PB_WT_VARINT,
+    [RTDOA_PB_TAG_RANGES] = PB_WT_LEN,
+};
+
+struct pb_in {
+    const struct os_mbuf *om;
+    int off;                /**< Offset into om */
+    int left;               /**< Bytes left in the message */
+    int err;
+};
+
+static uint8_t
+pb_get(struct pb_in *in)
+{
+    if (in->left <= 0) {
+        in->err = 1;
+        return 0;
+    }
+    while (in->om && in->off >= in->om->om_len) {
+        in->off -= in->om->om_len;
+        in->om = SLIST_NEXT(in->om, om_next);
+    }
+    if (!in->om) {
+        in->err = 1;
+        return 0;
+    }
+    in->left--;
+    return in->om->om_data[in->off++];
+}
+
+static uint64_t
+pb_get_varint(struct pb_in *in)
+{
+    uint64_t v = 0;
+    uint8_t c;
+    int shift = 0;
+
+    do {
+        c = pb_get(in);
+        if (shift < 64) {
+            v |= (uint64_t)(c & 0x7f) << shift;
+        }
+        shift += 7;
+    } while ((c & 0x80) && !in->err);
+    return v;
+}
+
+static uint32_t
+pb_get_fixed32(struct pb_in *in)
+{
+    uint32_t v = pb_get(in);
+
+    v |= (uint32_t)pb_get(in) << 8;
+    v |= (uint32_t)pb_get(in) << 16;
+    v |= (uint32_t)pb_get(in) << 24;
+    return v;
+}
+
+/* Length of a nested field, which must fit in what is left */
+static int
+pb_get_len(struct pb_in *in)
+{
+    uint64_t n = pb_get_varint(in);
+
+    if (n > in->left) {
+        in->err = 1;
+        return 0;
+    }
+    return n;
+}
+
+static void
+pb_skip(struct pb_in *in, int wt)
+{
+    int n;
+
+    switch (wt) {
+    case PB_WT_VARINT:
+        pb_get_varint(in);
+        return;
+    case PB_WT_64BIT:
+        n = 8;
+        break;
+    case PB_WT_LEN:
+        n = pb_get_len(in);
+        break;
+    case PB_WT_32BIT:
+        n = 4;
+        break;
+    default:
+        in->err = 1;
+        return;
+    }
+    while (n-- > 0 && !in->err) {
+        pb_get(in);
+    }
+}
+
+/* Packed or unpacked repeated sint32, extra elements are dropped */
+static void
+pb_get_xyz(struct pb_in *in, int wt, void *xyz, int *idx)
+{
+    int16_t v[3];
+    int end;
+
+    memcpy(v, xyz, sizeof(v));
+    if (wt == PB_WT_VARINT) {
+        end = in->left - 1;
+    } else if (wt == PB_WT_LEN) {
+        end = pb_get_len(in);
+        end = in->left - end;
+    } else {
+        pb_skip(in, wt);
+        return;
+    }
+    do {
+        int32_t s = pb_unzigzag(pb_get_varint(in));
+        if (*idx < 3) {
+            v[(*idx)++] = s;
+        }
+    } while (in->left > end && !in->err);
+    memcpy(xyz, v, sizeof(v));
+}
+
+static void
+pb_get_range(struct pb_in *in, struct rtdoabh_range_data *r)
+{
+    int end = pb_get_len(in);
+
+    end = in->left - end;
+    memset(r, 0, sizeof(*r));
+    while (in->left > end && !in->err) {
+        uint32_t key = pb_get_varint(in);
+        if ((key & 7) != PB_WT_VARINT) {
+            pb_skip(in, key & 7);
+            continue;
+        }
+        uint64_t v = pb_get_varint(in);
+        switch (key >> 3) {
+        case RTDOA_PB_RANGE_ANCHOR_ADDR:
+            r->anchor_addr = v;
+            break;
+        case RTDOA_PB_RANGE_DIFF_DIST_MM:
+            r->diff_dist_mm = pb_unzigzag(v);
+            break;
+        case RTDOA_PB_RANGE_RSSI:
+            r->rssi = pb_unzigzag(v);
+            break;
+        case RTDOA_PB_RANGE_QUALITY:
+            r->quality = pb_unzigzag(v);
+            break;
+        }
+    }
+    if (in->left != end) {
+        in->err = 1;
+    }
+}
+
+/**
+ * Decode a TagResult message held in an mbuf chain into a packed
+ * package, the counterpart of rtdoa_pb_encode.
+ *
+ * @param om  Chain holding the message
+ * @param off Offset of the message in the chain
+ * @param len Length of the message
+ * @param p   Output package, fully overwritten
+ *
+ * @return Equivalent packed package length, or -1 if the message is
+ *         malformed
+ */
+int
+rtdoa_pb_decode(const struct os_mbuf *om, int off, int len,
+                struct rtdoabh_tag_results_pkg *p)
+{
+    struct rtdoabh_sensor_data *d = &p->sensors;
+    struct rtdoabh_range_data tmp;
+    struct pb_in in = {om, off, len, 0};
+    int ci = 0, ai = 0, gi = 0;
+    bool has_ranges = false;
+    uint32_t valid = 0;
+
+    memset(p, 0, sizeof(*p));
+    p->head.fctrl = FCNTL_IEEE_RTDOABH;
+    p->head.PANID = 0xDECA;
+    p->head.dst_address = 0xffff;
+    p->head.code = DWT_RTDOABH_CODE;
+
+    while (in.left > 0 && !in.err) {
+        uint32_t key = pb_get_varint(&in);
+        uint32_t field = key >> 3;
+        int wt = key & 7;
+
+        if (field >= sizeof(g_tag_wt) || field == 0 ||
+            (wt != g_tag_wt[field] && !(wt == PB_WT_VARINT &&
+             field >= RTDOA_PB_TAG_COMPASS && field <= RTDOA_PB_TAG_GYRO))) {
+            pb_skip(&in, wt);
+            continue;
+        }
+        switch (field) {
+        case RTDOA_PB_TAG_SRC_ADDRESS:
+            p->head.src_address = pb_get_varint(&in);
+            break;
+        case RTDOA_PB_TAG_SEQ_NUM:
+            p->head.seq_num = pb_get_varint(&in);
+            break;
+        case RTDOA_PB_TAG_TS:
+            d->ts = pb_get_varint(&in);
+            break;
+        case RTDOA_PB_TAG_SENSORS_VALID:
+            valid = pb_get_varint(&in);
+            break;
+        case RTDOA_PB_TAG_GPS_LAT:
+        case RTDOA_PB_TAG_GPS_LONG: {
+            uint32_t v = pb_get_fixed32(&in);
+            memcpy((field == RTDOA_PB_TAG_GPS_LAT) ? &d->gps_lat : &d->gps_long,
+                   &v, sizeof(v));
+            break;
+        }
+        case RTDOA_PB_TAG_BATTERY_VOLTAGE:
+            d->battery_voltage = pb_unzigzag(pb_get_varint(&in));
+            break;
+        case RTDOA_PB_TAG_PRESSURE:
+            d->pressure = pb_unzigzag(pb_get_varint(&in));
+            break;
+        case RTDOA_PB_TAG_COMPASS:
+            pb_get_xyz(&in, wt, d->compass, &ci);
+            break;
+        case RTDOA_PB_TAG_ACCELERATION:
+            pb_get_xyz(&in, wt, d->acceleration, &ai);
+            break;
+        case RTDOA_PB_TAG_GYRO:
+            pb_get_xyz(&in, wt, d->gyro, &gi);
+            break;
+        case RTDOA_PB_TAG_REF_ANCHOR_ADDR:
+            p->ref_anchor_addr = pb_get_varint(&in);
+            has_ranges = true;
+            break;
+        case RTDOA_PB_TAG_RANGES:
+            has_ranges = true;
+            if (p->num_ranges < MYNEWT_VAL(RTDOABH_MAXNUM_RANGES)) {
+                pb_get_range(&in, &tmp);
+                memcpy(&p->ranges[p->num_ranges++], &tmp, sizeof(tmp));
+            } else {
+                pb_skip(&in, wt);
+            }
+            break;
+        }
+    }
+    if (in.err) {
+        return -1;
+    }
+
+    d->sensors_valid = valid & 0x3fff;
+    d->has_usb_power = (valid >> 14) & 1;
+    d->is_anchor_data = (valid >> 15) & 1;
+    if (!has_ranges) {
+        return PB_SENSORS_END;
+    }
+    return PB_RANGES_OFF + p->num_ranges * sizeof(struct rtdoabh_range_data);
+}
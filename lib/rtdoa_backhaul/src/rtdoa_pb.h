@@ -0,0 +1,60 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _RTDOA_PB_H_
+#define _RTDOA_PB_H_
+
+#include <inttypes.h>
+#include <os/mynewt.h>
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Field numbers of proto/rtdoa_backhaul.proto */
+#define RTDOA_PB_TAG_SRC_ADDRESS        1
+#define RTDOA_PB_TAG_SEQ_NUM            2
+#define RTDOA_PB_TAG_TS                 3
+#define RTDOA_PB_TAG_SENSORS_VALID      4
+#define RTDOA_PB_TAG_GPS_LAT            5
+#define RTDOA_PB_TAG_GPS_LONG           6
+#define RTDOA_PB_TAG_BATTERY_VOLTAGE    7
+#define RTDOA_PB_TAG_PRESSURE           8
+#define RTDOA_PB_TAG_COMPASS            9
+#define RTDOA_PB_TAG_ACCELERATION       10
+#define RTDOA_PB_TAG_GYRO               11
+#define RTDOA_PB_TAG_REF_ANCHOR_ADDR    12
+#define RTDOA_PB_TAG_RANGES             13
+
+#define RTDOA_PB_RANGE_ANCHOR_ADDR      1
+#define RTDOA_PB_RANGE_DIFF_DIST_MM     2
+#define RTDOA_PB_RANGE_RSSI             3
+#define RTDOA_PB_RANGE_QUALITY          4
+
+int rtdoa_pb_encoded_size(const struct rtdoabh_tag_results_pkg *p, int dlen);
+int rtdoa_pb_encode(struct os_mbuf *om, const struct rtdoabh_tag_results_pkg *p, int dlen);
+int rtdoa_pb_decode(const struct os_mbuf *om, int off, int len,
+                    struct rtdoabh_tag_results_pkg *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _RTDOA_PB_H_ */
@@ -0,0 +1,200 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Aggregate frames carry several results behind a single ieee header
+ * with code DWT_RTDOABH_AGG_CODE. Each result is stored as
+ *
+ *   len(1) | seq_num(1) | src_address(2, le) | body(len)
+ *
+ * where body is the rtdoabh_tag_results_pkg after its ieee header, cut
+ * after the last range as on air. The producer side collects results
+ * until the frame is full or the oldest one is RTDOABH_AGG_FLUSH_MS
+ * old, the bridge rebuilds a full package for each record.
+ */
+
+#include <string.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+
+#define AGG_MAX_LEN     MYNEWT_VAL(RTDOABH_AGG_MAX_LEN)
+#define AGG_HEAD_LEN    sizeof(struct _ieee_rng_request_frame_t)
+#define AGG_BODY_MIN    sizeof(struct rtdoabh_sensor_data)
+#define AGG_BODY_MAX    (sizeof(struct rtdoabh_tag_results_pkg) - AGG_HEAD_LEN)
+
+struct rtdoabh_agg_rec {
+    uint8_t len;
+    uint8_t seq_num;
+    uint16_t src_address;
+} __attribute__((packed, aligned(1)));
+
+/* The record length is one byte on air, which limits RTDOABH_MAXNUM_RANGES
+ * to 26 */
+_Static_assert(AGG_BODY_MAX <= UINT8_MAX,
+               "A full result must fit the one byte record length of an aggregate");
+
+#if MYNEWT_VAL(RTDOABH_AGGREGATE)
+
+_Static_assert(AGG_MAX_LEN >= AGG_HEAD_LEN + sizeof(struct rtdoabh_agg_rec) + AGG_BODY_MAX,
+               "RTDOABH_AGG_MAX_LEN must hold at least one full result");
+
+static union {
+    struct _ieee_rng_request_frame_t head;
+    uint8_t buf[AGG_MAX_LEN];
+} g_agg = {
+    .head = {
+        .fctrl = FCNTL_IEEE_RTDOABH,
+        .seq_num = 0,
+        .PANID = 0xDECA,
+        .dst_address = 0xffff,
+        .src_address = 0x0000,
+        .code = DWT_RTDOABH_AGG_CODE,
+    },
+};
+static uint16_t g_agg_len = AGG_HEAD_LEN;
+static uint8_t g_agg_count = 0;
+static uint32_t g_agg_first;    /**< cputime of the oldest record */
+
+void
+rtdoabh_agg_init(uint16_t src_address)
+{
+    g_agg.head.src_address = src_address;
+    g_agg_len = AGG_HEAD_LEN;
+    g_agg_count = 0;
+}
+
+/**
+ * Append a result to the pending aggregate.
+ *
+ * @param p    Result package, header included
+ * @param dlen Length of p as it would be sent on its own
+ *
+ * @return 0 on success, OS_ENOMEM if the aggregate is too full
+ */
+int
+rtdoabh_agg_add(const struct rtdoabh_tag_results_pkg *p, int dlen)
+{
+    struct rtdoabh_agg_rec rec;
+    int blen = dlen - AGG_HEAD_LEN;
+
+    if (blen < AGG_BODY_MIN || blen > AGG_BODY_MAX) {
+        return OS_EINVAL;
+    }
+    if (g_agg_len + sizeof(rec) + blen > AGG_MAX_LEN) {
+        return OS_ENOMEM;
+    }
+    if (g_agg_count == 0) {
+        g_agg_first = os_cputime_get32();
+    }
+
+    rec.len = blen;
+    rec.seq_num = p->head.seq_num;
+    rec.src_address = p->head.src_address;
+    memcpy(g_agg.buf + g_agg_len, &rec, sizeof(rec));
+    memcpy(g_agg.buf + g_agg_len + sizeof(rec), &p->sensors, blen);
+    g_agg_len += sizeof(rec) + blen;
+    g_agg_count++;
+    return 0;
+}
+
+/**
+ * @return true if the pending aggregate should go out in this slot,
+ *         either because the oldest record reached the flush deadline
+ *         or because a further full size result would not fit
+ */
+bool
+rtdoabh_agg_due(void)
+{
+    uint32_t age;
+
+    if (g_agg_count == 0) {
+        return false;
+    }
+    if (g_agg_len + sizeof(struct rtdoabh_agg_rec) + AGG_BODY_MAX > AGG_MAX_LEN) {
+        return true;
+    }
+    age = os_cputime_ticks_to_usecs(os_cputime_get32() - g_agg_first);
+    return age >= MYNEWT_VAL(RTDOABH_AGG_FLUSH_MS) * 1000UL;
+}
+
+/**
+ * Fetch the pending aggregate for transmission and start a new one.
+ * The returned buffer stays valid until the next rtdoabh_agg_add.
+ *
+ * @param len   Set to the frame length
+ * @param count Set to the number of records in the frame
+ *
+ * @return Frame, or NULL if nothing is pending
+ */
+const uint8_t *
+rtdoabh_agg_take(int *len, int *count)
+{
+    if (g_agg_count == 0) {
+        return NULL;
+    }
+    g_agg.head.seq_num++;
+    *len = g_agg_len;
+    *count = g_agg_count;
+    g_agg_len = AGG_HEAD_LEN;
+    g_agg_count = 0;
+    return g_agg.buf;
+}
+
+#endif /* RTDOABH_AGGREGATE */
+
+/**
+ * Split a received aggregate frame held in an mbuf chain and hand each
+ * record to cb as a full package with its original source address and
+ * sequence number restored. Unpacking works whether or not aggregation
+ * is enabled locally.
+ *
+ * @return Number of records handed to cb
+ */
+int
+rtdoabh_agg_unpack(struct os_mbuf *om, void (*cb)(const uint8_t *data, int len))
+{
+    static struct rtdoabh_tag_results_pkg pkg;
+    struct rtdoabh_agg_rec rec;
+    int len = OS_MBUF_PKTLEN(om);
+    int off = AGG_HEAD_LEN;
+    int n = 0;
+
+    if (os_mbuf_copydata(om, 0, AGG_HEAD_LEN, &pkg.head)) {
+        return 0;
+    }
+    pkg.head.code = DWT_RTDOABH_CODE;
+
+    while (off + sizeof(rec) <= len) {
+        os_mbuf_copydata(om, off, sizeof(rec), &rec);
+        off += sizeof(rec);
+        if (rec.len < AGG_BODY_MIN || rec.len > AGG_BODY_MAX || off + rec.len > len) {
+            /* Trailing fcs or a corrupt record, nothing more to find */
+            break;
+        }
+        pkg.head.seq_num = rec.seq_num;
+        pkg.head.src_address = rec.src_address;
+        os_mbuf_copydata(om, off, rec.len, &pkg.sensors);
+        off += rec.len;
+        cb((const uint8_t *)&pkg, AGG_HEAD_LEN + rec.len);
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,367 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Per anchor range and rssi statistics, one stats section per anchor
+ * named rtdoabh_aNN. Anchors are kept in an open addressed table of
+ * RTDOABH_MAXNUM_RANGES slots keyed by short address, the least
+ * recently heard anchor gives way when the table is full.
+ *
+ * Mean and variance follow Welford's update over all samples since the
+ * anchor was claimed. The 1/n weight is a Q32 reciprocal, taken from a
+ * table filled at init for small n and from two Newton steps on the
+ * previous one after that, so each sample costs a few multiplies and no
+ * division. The variance is the population one, M2/n. diff_dist is
+ * counted by |value| in log2 bins: bin 0 holds 0, bin n holds
+ * [2^(n-1), 2^n), the last bin everything above. Rssi is counted in
+ * linear bins of 6.4 dB from -110 dBm, the first and last bins also
+ * holding everything below and above.
+ *
+ * Units are mm for diff_dist and 0.1 dBm for rssi. Signed values are
+ * exported as two's complement in the 32 bit stats.
+ */
+
+#include <string.h>
+#include <assert.h>
+#include <stdio.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+
+#if MYNEWT_VAL(RTDOABH_STATS)
+#include <stats/stats.h>
+
+STATS_SECT_START(rtdoabh_anchor_stats)
+    STATS_SECT_ENTRY(addr)
+    STATS_SECT_ENTRY(n)
+    STATS_SECT_ENTRY(dd_mean)
+    STATS_SECT_ENTRY(dd_var)
+    STATS_SECT_ENTRY(dd_min)
+    STATS_SECT_ENTRY(dd_max)
+    STATS_SECT_ENTRY(rssi_mean)
+    STATS_SECT_ENTRY(rssi_var)
+    STATS_SECT_ENTRY(rssi_min)
+    STATS_SECT_ENTRY(rssi_max)
+    STATS_SECT_ENTRY(dd_h00)
+    STATS_SECT_ENTRY(dd_h01)
+    STATS_SECT_ENTRY(dd_h02)
+    STATS_SECT_ENTRY(dd_h03)
+    STATS_SECT_ENTRY(dd_h04)
+    STATS_SECT_ENTRY(dd_h05)
+    STATS_SECT_ENTRY(dd_h06)
+    STATS_SECT_ENTRY(dd_h07)
+    STATS_SECT_ENTRY(dd_h08)
+    STATS_SECT_ENTRY(dd_h09)
+    STATS_SECT_ENTRY(dd_h10)
+    STATS_SECT_ENTRY(dd_h11)
+    STATS_SECT_ENTRY(dd_h12)
+    STATS_SECT_ENTRY(dd_h13)
+    STATS_SECT_ENTRY(dd_h14)
+    STATS_SECT_ENTRY(dd_h15)
+    STATS_SECT_ENTRY(rssi_h00)
+    STATS_SECT_ENTRY(rssi_h01)
+    STATS_SECT_ENTRY(rssi_h02)
+    STATS_SECT_ENTRY(rssi_h03)
+    STATS_SECT_ENTRY(rssi_h04)
+    STATS_SECT_ENTRY(rssi_h05)
+    STATS_SECT_ENTRY(rssi_h06)
+    STATS_SECT_ENTRY(rssi_h07)
+    STATS_SECT_ENTRY(rssi_h08)
+    STATS_SECT_ENTRY(rssi_h09)
+    STATS_SECT_ENTRY(rssi_h10)
+    STATS_SECT_ENTRY(rssi_h11)
+STATS_SECT_END
+
+STATS_NAME_START(rtdoabh_anchor_stats)
+    STATS_NAME(rtdoabh_anchor_stats, addr)
+    STATS_NAME(rtdoabh_anchor_stats, n)
+    STATS_NAME(rtdoabh_anchor_stats, dd_mean)
+    STATS_NAME(rtdoabh_anchor_stats, dd_var)
+    STATS_NAME(rtdoabh_anchor_stats, dd_min)
+    STATS_NAME(rtdoabh_anchor_stats, dd_max)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_mean)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_var)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_min)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_max)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h00)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h01)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h02)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h03)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h04)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h05)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h06)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h07)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h08)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h09)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h10)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h11)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h12)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h13)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h14)
+    STATS_NAME(rtdoabh_anchor_stats, dd_h15)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_h00)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_h01)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_h02)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_h03)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_h04)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_h05)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_h06)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_h07)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_h08)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_h09)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_h10)
+    STATS_NAME(rtdoabh_anchor_stats, rssi_h11)
+STATS_NAME_END(rtdoabh_anchor_stats)
+
+#define ASTATS_NSLOTS       MYNEWT_VAL(RTDOABH_MAXNUM_RANGES)
+#define ASTATS_MAX_PROBE    (4)
+#define ASTATS_DD_BINS      (16)
+#define ASTATS_RSSI_BINS    (12)
+#define ASTATS_Q            (16)    /**< Fraction bits of the means */
+#define ASTATS_LIMIT        (1L << 22)  /**< Keeps the products in 64 bits */
+#define ASTATS_RECIP_N      (64)    /**< 1/n from the table up to here */
+#define ASTATS_RSSI_LO      (-1100) /**< Start of rssi bin 0, 0.1 dBm */
+#define ASTATS_RSSI_SHIFT   (6)     /**< 6.4 dB per rssi bin */
+
+/* The histogram bins are indexed from the first entry of each run */
+_Static_assert(offsetof(STATS_SECT_DECL(rtdoabh_anchor_stats), dd_h15) ==
+               offsetof(STATS_SECT_DECL(rtdoabh_anchor_stats), dd_h00) +
+               (ASTATS_DD_BINS - 1) * sizeof(uint32_t), "dd bins not contiguous");
+_Static_assert(offsetof(STATS_SECT_DECL(rtdoabh_anchor_stats), rssi_h11) ==
+               offsetof(STATS_SECT_DECL(rtdoabh_anchor_stats), rssi_h00) +
+               (ASTATS_RSSI_BINS - 1) * sizeof(uint32_t), "rssi bins not contiguous");
+
+struct astats_var {
+    int64_t mean;               /**< Q16 */
+    int64_t var;                /**< Population variance, not scaled */
+    int32_t min;
+    int32_t max;
+};
+
+struct rtdoabh_anchor {
+    uint16_t addr;
+    uint8_t in_use;
+    uint32_t n;
+    uint32_t recip;             /**< 1/n, Q32, from n=2 */
+    uint32_t last_used;
+    struct astats_var dd;
+    struct astats_var rssi;
+    STATS_SECT_DECL(rtdoabh_anchor_stats) stat;
+    char stat_name[16];
+};
+
+static struct rtdoabh_anchor g_anchor[ASTATS_NSLOTS];
+static uint32_t g_astats_clock = 0;
+static uint32_t g_recip[ASTATS_RECIP_N + 1];
+
+/* Multiplicative hash onto [0, ASTATS_NSLOTS) without a modulo */
+static inline int
+anchor_hash(uint16_t addr)
+{
+    return ((uint32_t)(uint16_t)(addr * 0x9e37) * ASTATS_NSLOTS) >> 16;
+}
+
+static inline int
+log2_bin(int32_t v, int nbins)
+{
+    uint32_t u = (v < 0) ? -(uint32_t)v : (uint32_t)v;
+    int bin = (u) ? 32 - __builtin_clz(u) : 0;
+
+    return (bin < nbins) ? bin : nbins - 1;
+}
+
+static inline int
+rssi_bin(int32_t rssi)
+{
+    int32_t bin = (rssi - ASTATS_RSSI_LO) >> ASTATS_RSSI_SHIFT;
+
+    return (bin < 0) ? 0 : ((bin < ASTATS_RSSI_BINS) ? bin : ASTATS_RSSI_BINS - 1);
+}
+
+/* a * r rounded, for a Q32 r, without a 64x64 bit product */
+static inline int64_t
+mul_q32(int64_t a, uint32_t r)
+{
+    int64_t hi = a >> 32;
+    uint32_t lo = (uint32_t)a;
+
+    return hi * r + (int64_t)(((uint64_t)lo * r + (1U << 31)) >> 32);
+}
+
+/* 1/n in Q32 for n >= 2, recip being 1/(n-1) */
+static inline uint32_t
+recip_next(uint32_t n, uint32_t recip)
+{
+    uint64_t r = recip;
+    int i;
+
+    if (n <= ASTATS_RECIP_N) {
+        return g_recip[n];
+    }
+    /* r' = r * (2 - n * r), the error squares with each step and starts
+     * at 1/(n-1) */
+    for (i = 0; i < 2; i++) {
+        r = (r * ((2ULL << 32) - n * r)) >> 32;
+    }
+    return (uint32_t)r;
+}
+
+static inline uint32_t
+clamp_u32(int64_t v)
+{
+    if (v < 0) {
+        return 0;
+    }
+    return (v > UINT32_MAX) ? UINT32_MAX : (uint32_t)v;
+}
+
+/**
+ * Welford step for the n-th sample, recip = 1/n:
+ *   mean += (x - mean) / n
+ *   var  += ((x - mean_old) * (x - mean_new) - var) / n
+ */
+static void
+astats_var_update(struct astats_var *s, int32_t x, uint32_t recip, bool first)
+{
+    int64_t xq, d1, d2;
+
+    if (first || x < s->min) {
+        s->min = x;
+    }
+    if (first || x > s->max) {
+        s->max = x;
+    }
+
+    x = (x > ASTATS_LIMIT) ? ASTATS_LIMIT : ((x < -ASTATS_LIMIT) ? -ASTATS_LIMIT : x);
+    xq = (int64_t)x * (1 << ASTATS_Q);
+    if (first) {
+        s->mean = xq;
+        s->var = 0;
+        return;
+    }
+    d1 = xq - s->mean;
+    s->mean += mul_q32(d1, recip);
+    d2 = xq - s->mean;
+    /* Drop half the fraction bits first to keep the product in 64 bits */
+    d1 >>= ASTATS_Q / 2;
+    d2 >>= ASTATS_Q / 2;
+    s->var += mul_q32(((d1 * d2) >> ASTATS_Q) - s->var, recip);
+}
+
+#define ASTATS_SET(_a, _f, _v)                  \
+    do {                                        \
+        STATS_CLEAR((_a)->stat, _f);            \
+        STATS_INCN((_a)->stat, _f, (_v));       \
+    } while (0)
+
+static void
+anchor_claim(struct rtdoabh_anchor *a, uint16_t addr)
+{
+    memset(&a->dd, 0, sizeof(a->dd));
+    memset(&a->rssi, 0, sizeof(a->rssi));
+    a->addr = addr;
+    a->in_use = 1;
+    a->n = 0;
+    a->recip = 0;
+    stats_reset(STATS_HDR(a->stat));
+    ASTATS_SET(a, addr, addr);
+}
+
+static struct rtdoabh_anchor *
+anchor_find(uint16_t addr)
+{
+    struct rtdoabh_anchor *a, *victim = NULL;
+    int idx = anchor_hash(addr);
+    int i;
+
+    for (i = 0; i < ASTATS_MAX_PROBE && i < ASTATS_NSLOTS; i++) {
+        a = &g_anchor[idx];
+        if (++idx == ASTATS_NSLOTS) {
+            idx = 0;
+        }
+        if (!a->in_use) {
+            victim = a;
+            break;
+        }
+        if (a->addr == addr) {
+            return a;
+        }
+        if (!victim || (int32_t)(a->last_used - victim->last_used) < 0) {
+            victim = a;
+        }
+    }
+    anchor_claim(victim, addr);
+    return victim;
+}
+
+/**
+ * Account one range.
+ *
+ * @param addr    Anchor short address
+ * @param dd_mm   Difference distance in mm
+ * @param rssi    Rssi in 0.1 dBm
+ */
+void
+rtdoabh_astats_update(uint16_t addr, int32_t dd_mm, int32_t rssi)
+{
+    struct rtdoabh_anchor *a = anchor_find(addr);
+
+    a->last_used = ++g_astats_clock;
+    a->n++;
+    if (a->n > 1) {
+        a->recip = recip_next(a->n, a->recip);
+    }
+
+    astats_var_update(&a->dd, dd_mm, a->recip, a->n == 1);
+    astats_var_update(&a->rssi, rssi, a->recip, a->n == 1);
+
+    STATS_INC(a->stat, n);
+    ASTATS_SET(a, dd_mean, (int32_t)(a->dd.mean >> ASTATS_Q));
+    ASTATS_SET(a, dd_var, clamp_u32(a->dd.var));
+    ASTATS_SET(a, dd_min, a->dd.min);
+    ASTATS_SET(a, dd_max, a->dd.max);
+    ASTATS_SET(a, rssi_mean, (int32_t)(a->rssi.mean >> ASTATS_Q));
+    ASTATS_SET(a, rssi_var, clamp_u32(a->rssi.var));
+    ASTATS_SET(a, rssi_min, a->rssi.min);
+    ASTATS_SET(a, rssi_max, a->rssi.max);
+    (&a->stat.dd_h00)[log2_bin(dd_mm, ASTATS_DD_BINS)]++;
+    (&a->stat.rssi_h00)[rssi_bin(rssi)]++;
+}
+
+void
+rtdoabh_astats_init(void)
+{
+    int i, rc;
+
+    memset(g_anchor, 0, sizeof(g_anchor));
+    for (i = 2; i <= ASTATS_RECIP_N; i++) {
+        g_recip[i] = (uint32_t)((1ULL << 32) / i);
+    }
+    for (i = 0; i < ASTATS_NSLOTS; i++) {
+        snprintf(g_anchor[i].stat_name, sizeof(g_anchor[i].stat_name), "rtdoabh_a%02d", i);
+        rc = stats_init_and_reg(
+            STATS_HDR(g_anchor[i].stat), STATS_SIZE_INIT_PARMS(g_anchor[i].stat,
+            STATS_SIZE_32), STATS_NAME_INIT_PARMS(rtdoabh_anchor_stats),
+            g_anchor[i].stat_name);
+        assert(rc == 0);
+    }
+}
+
+#endif /* RTDOABH_STATS */
@@ -0,0 +1,211 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Per source duplicate suppression. Sources are kept in a small open
+ * addressed table keyed by short address. Each entry remembers the
+ * newest sequence number seen and a bitmap of the 32 sequence numbers
+ * preceding it so that replays and relayed copies arriving out of
+ * order are caught too. Only called from the backhaul events on the
+ * default eventq.
+ *
+ * With RTDOABH_STATS every slot is a stats section named after the
+ * source it holds, rtdoabh_srcXXXX with the address in hex, so the
+ * counters always belong to one source. A slot that is taken over by
+ * a new source is renamed and its counters start from zero. Slots not
+ * used yet are named rtdoabh_freeNN.
+ */
+
+#include <string.h>
+#include <assert.h>
+#include <stdio.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+
+#if MYNEWT_VAL(RTDOABH_STATS)
+#include <stats/stats.h>
+STATS_SECT_START(rtdoabh_src_stats)
+    STATS_SECT_ENTRY(addr)
+    STATS_SECT_ENTRY(rx)
+    STATS_SECT_ENTRY(dup)
+STATS_SECT_END
+
+STATS_NAME_START(rtdoabh_src_stats)
+    STATS_NAME(rtdoabh_src_stats, addr)
+    STATS_NAME(rtdoabh_src_stats, rx)
+    STATS_NAME(rtdoabh_src_stats, dup)
+STATS_NAME_END(rtdoabh_src_stats)
+#endif
+
+#define DEDUP_NSLOTS    MYNEWT_VAL(RTDOABH_DEDUP_SLOTS)
+#define DEDUP_MAX_PROBE (4)
+#define DEDUP_WINDOW    (32)
+
+#if (DEDUP_NSLOTS & (DEDUP_NSLOTS - 1))
+#error "RTDOABH_DEDUP_SLOTS must be a power of two"
+#endif
+
+struct rtdoabh_src {
+    uint16_t addr;
+    uint8_t seq;
+    uint8_t in_use;
+    uint32_t window;            /**< Bit n set if seq-1-n has been seen */
+    uint32_t last_used;
+#if MYNEWT_VAL(RTDOABH_STATS)
+    STATS_SECT_DECL(rtdoabh_src_stats) stat;
+    char stat_name[16];
+#endif
+};
+
+static struct rtdoabh_src g_src[DEDUP_NSLOTS];
+static uint32_t g_dedup_clock = 0;
+
+#if MYNEWT_VAL(RTDOABH_STATS)
+/* Rename the stats section in place, stats keep a pointer to the name */
+static void
+src_stat_name(struct rtdoabh_src *s, uint16_t addr)
+{
+    static const char hex[] = "0123456789abcdef";
+    char *p = s->stat_name + sizeof("rtdoabh_src") - 1;
+
+    memcpy(s->stat_name, "rtdoabh_src", sizeof("rtdoabh_src") - 1);
+    p[0] = hex[(addr >> 12) & 0xf];
+    p[1] = hex[(addr >> 8) & 0xf];
+    p[2] = hex[(addr >> 4) & 0xf];
+    p[3] = hex[addr & 0xf];
+    p[4] = '\0';
+}
+#endif
+
+static inline uint16_t
+src_hash(uint16_t addr)
+{
+    return (addr ^ (addr >> 8)) & (DEDUP_NSLOTS - 1);
+}
+
+static void
+src_claim(struct rtdoabh_src *s, uint16_t addr, uint8_t seq)
+{
+    s->addr = addr;
+    s->seq = seq;
+    s->in_use = 1;
+    s->window = 0;
+#if MYNEWT_VAL(RTDOABH_STATS)
+    src_stat_name(s, addr);
+    STATS_CLEAR(s->stat, addr);
+    STATS_INCN(s->stat, addr, addr);
+    STATS_CLEAR(s->stat, rx);
+    STATS_CLEAR(s->stat, dup);
+#endif
+}
+
+/* Returns true if seq is new and records it in the window */
+static bool
+src_accept(struct rtdoabh_src *s, uint8_t seq)
+{
+    int d = (int8_t)(seq - s->seq);
+
+    if (d > 0) {
+        s->window = (d >= DEDUP_WINDOW) ? 0 : ((s->window << d) | (1UL << (d - 1)));
+        s->seq = seq;
+        return true;
+    }
+    if (d == 0) {
+        return false;
+    }
+    d = -d;
+    if (d > DEDUP_WINDOW) {
+        /* Too far behind to be a late copy, assume the source restarted */
+        s->window = 0;
+        s->seq = seq;
+        return true;
+    }
+    if (s->window & (1UL << (d - 1))) {
+        return false;
+    }
+    s->window |= (1UL << (d - 1));
+    return true;
+}
+
+/**
+ * Check if (addr, seq) has been seen before.
+ *
+ * @return true if the packet is a duplicate and should be dropped
+ */
+bool
+rtdoabh_dedup_check(uint16_t addr, uint8_t seq)
+{
+    struct rtdoabh_src *s, *victim = NULL;
+    uint16_t idx = src_hash(addr);
+    int i;
+
+    g_dedup_clock++;
+    for (i = 0; i < DEDUP_MAX_PROBE; i++) {
+        s = &g_src[(idx + i) & (DEDUP_NSLOTS - 1)];
+        if (!s->in_use) {
+            /* Never used slots end the probe sequence as nothing
+             * is ever removed from the table */
+            victim = s;
+            break;
+        }
+        if (s->addr == addr) {
+            s->last_used = g_dedup_clock;
+            if (!src_accept(s, seq)) {
+#if MYNEWT_VAL(RTDOABH_STATS)
+                STATS_INC(s->stat, dup);
+#endif
+                return true;
+            }
+#if MYNEWT_VAL(RTDOABH_STATS)
+            STATS_INC(s->stat, rx);
+#endif
+            return false;
+        }
+        if (!victim || (int32_t)(s->last_used - victim->last_used) < 0) {
+            victim = s;
+        }
+    }
+
+    /* New source, take the free or least recently heard slot */
+    src_claim(victim, addr, seq);
+    victim->last_used = g_dedup_clock;
+#if MYNEWT_VAL(RTDOABH_STATS)
+    STATS_INC(victim->stat, rx);
+#endif
+    return false;
+}
+
+void
+rtdoabh_dedup_init(void)
+{
+    memset(g_src, 0, sizeof(g_src));
+#if MYNEWT_VAL(RTDOABH_STATS)
+    int rc;
+    for (int i = 0; i < DEDUP_NSLOTS; i++) {
+        snprintf(g_src[i].stat_name, sizeof(g_src[i].stat_name), "rtdoabh_free%02d", i);
+        rc = stats_init_and_reg(
+            STATS_HDR(g_src[i].stat), STATS_SIZE_INIT_PARMS(g_src[i].stat,
+            STATS_SIZE_32), STATS_NAME_INIT_PARMS(rtdoabh_src_stats),
+            g_src[i].stat_name);
+        assert(rc == 0);
+    }
+#endif
+}
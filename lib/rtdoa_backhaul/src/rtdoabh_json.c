@@ -0,0 +1,366 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Json rendering of backhaul results into a caller supplied buffer
+ * using integer arithmetic only. Fixed point fields are printed from
+ * their on-air integer representation with table driven digit
+ * conversion instead of going through float and printf.
+ */
+
+#include <string.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+
+static uint32_t g_msg_id = 0;
+
+static const char g_hex[] = "0123456789abcdef";
+
+static const char g_digits2[] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint32_t g_pow10[] = {1, 10, 100, 1000, 10000, 100000, 1000000};
+
+void
+rtdoabh_json_init(struct rtdoabh_json *j, char *buf, int size)
+{
+    j->buf = buf;
+    j->len = 0;
+    j->size = size;
+    j->overflow = 0;
+}
+
+static char *
+json_reserve(struct rtdoabh_json *j, int n)
+{
+    char *p;
+
+    if (j->len + n > j->size) {
+        j->overflow = 1;
+        return NULL;
+    }
+    p = j->buf + j->len;
+    j->len += n;
+    return p;
+}
+
+void
+rtdoabh_json_str(struct rtdoabh_json *j, const char *s)
+{
+    int n = strlen(s);
+    char *p = json_reserve(j, n);
+
+    if (p) {
+        memcpy(p, s, n);
+    }
+}
+
+void
+rtdoabh_json_char(struct rtdoabh_json *j, char c)
+{
+    char *p = json_reserve(j, 1);
+
+    if (p) {
+        *p = c;
+    }
+}
+
+/* Write v with at least min_digits digits, zero padded */
+static void
+json_uint_pad(struct rtdoabh_json *j, uint32_t v, int min_digits)
+{
+    char tmp[10];
+    char *t = tmp + sizeof(tmp);
+    char *p;
+    int n;
+
+    while (v >= 100) {
+        uint32_t i = (v % 100) * 2;
+        v /= 100;
+        *--t = g_digits2[i + 1];
+        *--t = g_digits2[i];
+    }
+    if (v >= 10) {
+        *--t = g_digits2[v * 2 + 1];
+        *--t = g_digits2[v * 2];
+    } else {
+        *--t = '0' + v;
+    }
+    while (t > tmp && tmp + sizeof(tmp) - t < min_digits) {
+        *--t = '0';
+    }
+
+    n = tmp + sizeof(tmp) - t;
+    p = json_reserve(j, n);
+    if (p) {
+        memcpy(p, t, n);
+    }
+}
+
+void
+rtdoabh_json_uint(struct rtdoabh_json *j, uint32_t v)
+{
+    json_uint_pad(j, v, 1);
+}
+
+void
+rtdoabh_json_int(struct rtdoabh_json *j, int32_t v)
+{
+    if (v < 0) {
+        rtdoabh_json_char(j, '-');
+        json_uint_pad(j, -(uint32_t)v, 1);
+    } else {
+        json_uint_pad(j, v, 1);
+    }
+}
+
+/**
+ * Write v/10^decimals as a decimal number, i.e. v=-1234, decimals=3
+ * gives -1.234
+ */
+void
+rtdoabh_json_fixed(struct rtdoabh_json *j, int32_t v, int decimals)
+{
+    uint32_t u = (v < 0) ? -(uint32_t)v : v;
+    uint32_t div = g_pow10[decimals];
+
+    if (v < 0) {
+        rtdoabh_json_char(j, '-');
+    }
+    json_uint_pad(j, u / div, 1);
+    if (decimals) {
+        rtdoabh_json_char(j, '.');
+        json_uint_pad(j, u % div, decimals);
+    }
+}
+
+void
+rtdoabh_json_hex(struct rtdoabh_json *j, uint32_t v, int min_digits)
+{
+    char tmp[8];
+    char *t = tmp + sizeof(tmp);
+    char *p;
+    int n;
+
+    do {
+        *--t = g_hex[v & 0xf];
+        v >>= 4;
+    } while (v && t > tmp);
+    while (t > tmp && tmp + sizeof(tmp) - t < min_digits) {
+        *--t = '0';
+    }
+
+    n = tmp + sizeof(tmp) - t;
+    p = json_reserve(j, n);
+    if (p) {
+        memcpy(p, t, n);
+    }
+}
+
+/* Decimal degrees with 6 decimals. The integer part is split off before
+ * scaling so the fraction is printed from all of the float's precision,
+ * deg*1e6 on its own needs more than the 24 bit mantissa. */
+static void
+json_deg(struct rtdoabh_json *j, float deg)
+{
+    int32_t i = (int32_t)deg;
+    int32_t f = (int32_t)((deg - (float)i) * 1000000.0f);
+
+    rtdoabh_json_fixed(j, i * 1000000 + f, 6);
+}
+
+static void
+json_xyz(struct rtdoabh_json *j, const char *key, const void *xyz, int decimals)
+{
+    int16_t v[3];
+    int i;
+
+    /* Packed source, may be unaligned */
+    memcpy(v, xyz, sizeof(v));
+    rtdoabh_json_str(j, key);
+    for (i = 0; i < 3; i++) {
+        if (i) {
+            rtdoabh_json_char(j, ',');
+        }
+        rtdoabh_json_fixed(j, v[i], decimals);
+    }
+    rtdoabh_json_str(j, "]\"");
+}
+
+/**
+ * Render a result package as one line of json.
+ *
+ * @param v     View of the package to render
+ * @param tight Keep the verbose measurement list on a single line
+ * @param buf   Output buffer
+ * @param size  Size of output buffer
+ *
+ * @return Number of characters written, or -1 if buf was too small
+ */
+int
+rtdoabh_format_view(const struct rtdoabh_pkg_view *v, bool tight, char *buf, int size)
+{
+    const struct rtdoabh_sensor_data *d = v->sensors;
+    const struct rtdoabh_range_data *r;
+    struct rtdoabh_range_data tmp;
+    struct rtdoabh_json js;
+    struct rtdoabh_json *j = &js;
+    int i;
+
+    rtdoabh_json_init(j, buf, size);
+    rtdoabh_json_str(j, "{\"id\":\"0x");
+    rtdoabh_json_hex(j, v->head->src_address, 4);
+    rtdoabh_json_char(j, '"');
+
+    if (d->is_anchor_data) {
+        rtdoabh_json_str(j, ",\"mode\":\"anchor\"");
+    }
+    if (d->ts) {
+        /* dwt usecs are 65536/63897.6 = 40/39 usecs */
+        uint64_t us = d->ts * 40 / 39;
+        rtdoabh_json_str(j, ",\"ts\":\"");
+        rtdoabh_json_uint(j, (uint32_t)(us / 1000000));
+        rtdoabh_json_char(j, '.');
+        json_uint_pad(j, (uint32_t)(us % 1000000) / 100, 4);
+        rtdoabh_json_char(j, '"');
+    }
+    /* OBSERVE: mid is from the local node */
+    rtdoabh_json_str(j, ",\"mid\":");
+    rtdoabh_json_uint(j, g_msg_id++);
+
+    if (d->sensors_valid&GPS_LAT_LONG_ENABLED) {
+        rtdoabh_json_str(j, ",\"gps\":[\"");
+        json_deg(j, d->gps_lat);
+        rtdoabh_json_str(j, "\",\"");
+        json_deg(j, d->gps_long);
+        rtdoabh_json_str(j, "\"]");
+    }
+    if (d->sensors_valid&BATTERY_LEVELS_ENABLED) {
+        /* steps of 5/128V, printed in 10mV */
+        rtdoabh_json_str(j, ",\"vbat\":\"");
+        rtdoabh_json_fixed(j, (int32_t)d->battery_voltage * 500 / 128, 2);
+        rtdoabh_json_str(j, "\",\"usb\":");
+        rtdoabh_json_uint(j, d->has_usb_power);
+    }
+    if (d->sensors_valid&ACCELEROMETER_ENABLED) {
+        json_xyz(j, ",\"a\":\"[", d->acceleration, 3);
+    }
+    if (d->sensors_valid&GYRO_ENABLED) {
+        json_xyz(j, ",\"g\":\"[", d->gyro, 1);
+    }
+    if (d->sensors_valid&COMPASS_ENABLED) {
+        rtdoabh_json_str(j, ",\"m\":[");
+        for (i = 0; i < 3; i++) {
+            if (i) {
+                rtdoabh_json_char(j, ',');
+            }
+            rtdoabh_json_int(j, d->compass[i]);
+        }
+        rtdoabh_json_char(j, ']');
+    }
+    if (d->sensors_valid&PRESSURE_ENABLED) {
+        rtdoabh_json_str(j, ",\"p\":");
+        rtdoabh_json_int(j, (int32_t)d->pressure + 101300);
+    }
+
+#if MYNEWT_VAL(RTDOABH_COMPACT_MEAS)
+    if (v->num_ranges) {
+        rtdoabh_json_str(j, ",\"meas\":{\"ref\":\"");
+        rtdoabh_json_hex(j, v->ref_anchor_addr, 1);
+        rtdoabh_json_str(j, "\",\"a\":[");
+        for (i = 0; i < v->num_ranges; i++) {
+            rtdoabh_json_str(j, (i) ? ",\"" : "\"");
+            r = rtdoabh_view_range(v, i, &tmp);
+            rtdoabh_json_hex(j, r->anchor_addr, 1);
+            rtdoabh_json_char(j, '"');
+        }
+        rtdoabh_json_str(j, "],\"dd\":[");
+        for (i = 0; i < v->num_ranges; i++) {
+            if (i) {
+                rtdoabh_json_char(j, ',');
+            }
+            r = rtdoabh_view_range(v, i, &tmp);
+            rtdoabh_json_fixed(j, r->diff_dist_mm, 3);
+        }
+        rtdoabh_json_str(j, "],\"rs\":[");
+        for (i = 0; i < v->num_ranges; i++) {
+            if (i) {
+                rtdoabh_json_char(j, ',');
+            }
+            r = rtdoabh_view_range(v, i, &tmp);
+            rtdoabh_json_fixed(j, r->rssi, 1);
+        }
+        rtdoabh_json_str(j, "],\"qf\":[");
+        for (i = 0; i < v->num_ranges; i++) {
+            if (i) {
+                rtdoabh_json_char(j, ',');
+            }
+            r = rtdoabh_view_range(v, i, &tmp);
+            rtdoabh_json_hex(j, r->quality & 0x3, 1);
+        }
+        rtdoabh_json_str(j, "]}");
+    }
+    rtdoabh_json_str(j, "}\n");
+#else
+    rtdoabh_json_str(j, ",\"ref_anchor\":\"");
+    rtdoabh_json_hex(j, v->ref_anchor_addr, 1);
+    rtdoabh_json_str(j, (tight || v->num_ranges == 0) ? "\",\"meas\":[" : "\",\"meas\":[\n ");
+    for (i = 0; i < v->num_ranges; i++) {
+        r = rtdoabh_view_range(v, i, &tmp);
+        rtdoabh_json_str(j, "{\"addr\":\"");
+        rtdoabh_json_hex(j, r->anchor_addr, 1);
+        rtdoabh_json_str(j, "\",\"ddist\":\"");
+        rtdoabh_json_fixed(j, r->diff_dist_mm, 3);
+        rtdoabh_json_str(j, "\",\"tqf\":");
+        rtdoabh_json_int(j, r->quality);
+        rtdoabh_json_str(j, ",\"rssi\":\"");
+        rtdoabh_json_fixed(j, r->rssi, 1);
+        rtdoabh_json_str(j, (i + 1 < v->num_ranges) ? "\"}," : "\"}");
+        if (!tight) {
+            rtdoabh_json_str(j, "\n  ");
+        }
+    }
+    rtdoabh_json_str(j, "]}\n");
+#endif
+
+    return (j->overflow) ? -1 : j->len;
+}
+
+/**
+ * Render a package held in a flat buffer, see rtdoabh_format_view.
+ */
+int
+rtdoa_backhaul_format(struct rtdoabh_tag_results_pkg *p, bool tight, char *buf, int size)
+{
+    struct rtdoabh_pkg_view v;
+
+    rtdoabh_view_init_flat(&v, p, sizeof(*p));
+    return rtdoabh_format_view(&v, tight, buf, size);
+}
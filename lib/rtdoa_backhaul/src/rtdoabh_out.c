@@ -0,0 +1,334 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Output of the records a bridge produces. Without RTDOABH_UDP everything
+ * goes to the console. With it, whole records are collected into one
+ * datagram for rtdoabh/udp_addr:udp_port. The datagram is sent once it
+ * holds RTDOABH_UDP_BATCH bytes, or when the backhaul queue has been
+ * drained. With RTDOABH_UDP_FLUSH_MS a drained queue doesn't send it,
+ * it goes when its first record is that old. A datagram that can't be
+ * sent is written to the console instead. Setting udp_addr to 0.0.0.0
+ * turns udp off. Only called from the backhaul events and the flush
+ * callout on the default eventq.
+ */
+
+#include <string.h>
+#include <assert.h>
+#include <os/mynewt.h>
+#include <console/console.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+
+#if MYNEWT_VAL(RTDOABH_UDP)
+#include <mn_socket/mn_socket.h>
+#include <config/config.h>
+#include <stats/stats.h>
+
+#define UDP_FLUSH_TICKS ((MYNEWT_VAL(RTDOABH_UDP_FLUSH_MS) * OS_TICKS_PER_SEC + 999) / 1000)
+
+STATS_SECT_START(rtdoabh_udp_stats)
+    STATS_SECT_ENTRY(tx)
+    STATS_SECT_ENTRY(tx_err)
+    STATS_SECT_ENTRY(tx_timeout)
+    STATS_SECT_ENTRY(rec)
+    STATS_SECT_ENTRY(rec_drop)
+    STATS_SECT_ENTRY(console)
+STATS_SECT_END
+
+STATS_NAME_START(rtdoabh_udp_stats)
+    STATS_NAME(rtdoabh_udp_stats, tx)
+    STATS_NAME(rtdoabh_udp_stats, tx_err)
+    STATS_NAME(rtdoabh_udp_stats, tx_timeout)
+    STATS_NAME(rtdoabh_udp_stats, rec)
+    STATS_NAME(rtdoabh_udp_stats, rec_drop)
+    STATS_NAME(rtdoabh_udp_stats, console)
+STATS_NAME_END(rtdoabh_udp_stats)
+
+static STATS_SECT_DECL(rtdoabh_udp_stats) g_udp_stats;
+
+static struct mn_socket *g_udp_socket = NULL;
+static struct mn_sockaddr_in g_udp_dest;
+static struct os_mbuf *g_udp_om = NULL;  /* Datagram being collected */
+static int g_udp_rec_off = 0;            /* Where the current record starts in it */
+#if MYNEWT_VAL(RTDOABH_UDP_FLUSH_MS)
+static struct os_callout g_udp_callout;
+#endif
+
+/* Where the rest of the current record goes */
+static enum {
+    REC_START,      /**< Nothing written yet */
+    REC_UDP,
+    REC_CONSOLE,    /**< No mbuf at the start of the record */
+    REC_DROP,       /**< Ran out of mbufs halfway */
+} g_udp_rec = REC_START;
+
+static struct {
+    char addr[16];
+    char port[8];
+} g_udp_conf = {
+    .addr = MYNEWT_VAL(RTDOABH_UDP_ADDR),
+    .port = MYNEWT_VAL(RTDOABH_UDP_PORT),
+};
+
+static char *
+udp_conf_get(int argc, char **argv, char *val, int val_len_max)
+{
+    if (argc == 1) {
+        if (!strcmp(argv[0], "udp_addr"))  return g_udp_conf.addr;
+        if (!strcmp(argv[0], "udp_port"))  return g_udp_conf.port;
+    }
+    return NULL;
+}
+
+static int
+udp_conf_set(int argc, char **argv, char *val)
+{
+    if (argc == 1) {
+        if (!strcmp(argv[0], "udp_addr")) {
+            return CONF_VALUE_SET(val, CONF_STRING, g_udp_conf.addr);
+        }
+        if (!strcmp(argv[0], "udp_port")) {
+            return CONF_VALUE_SET(val, CONF_STRING, g_udp_conf.port);
+        }
+    }
+    return OS_ENOENT;
+}
+
+static int
+udp_conf_commit(void)
+{
+    uint32_t addr = 0;
+    uint16_t port = 0;
+
+    if (mn_inet_pton(MN_AF_INET, g_udp_conf.addr, &addr) != 1) {
+        console_printf("Invalid udp address %s\n", g_udp_conf.addr);
+        addr = 0;
+    }
+    conf_value_from_str(g_udp_conf.port, CONF_INT16, (void*)&port, 0);
+
+    memset(&g_udp_dest, 0, sizeof(g_udp_dest));
+    g_udp_dest.msin_len = sizeof(g_udp_dest);
+    g_udp_dest.msin_family = MN_AF_INET;
+    g_udp_dest.msin_port = htons(port);
+    g_udp_dest.msin_addr.s_addr = addr;
+    return 0;
+}
+
+static int
+udp_conf_export(void (*export_func)(char *name, char *val),
+                enum conf_export_tgt tgt)
+{
+    export_func("rtdoabh/udp_addr", g_udp_conf.addr);
+    export_func("rtdoabh/udp_port", g_udp_conf.port);
+    return 0;
+}
+
+static struct conf_handler g_udp_conf_handler = {
+    .ch_name = "rtdoabh",
+    .ch_get = udp_conf_get,
+    .ch_set = udp_conf_set,
+    .ch_commit = udp_conf_commit,
+    .ch_export = udp_conf_export,
+};
+
+static void
+udp_readable(void *arg, int err)
+{
+}
+
+static void
+udp_writable(void *arg, int err)
+{
+}
+
+static const union mn_socket_cb g_udp_cbs = {
+    .socket.readable = udp_readable,
+    .socket.writable = udp_writable
+};
+
+static bool
+udp_active(void)
+{
+    if (g_udp_dest.msin_addr.s_addr == 0) {
+        return false;
+    }
+    if (!g_udp_socket) {
+        if (mn_socket(&g_udp_socket, MN_PF_INET, MN_SOCK_DGRAM, 0) != 0) {
+            g_udp_socket = NULL;
+            return false;
+        }
+        mn_socket_set_cbs(g_udp_socket, NULL, &g_udp_cbs);
+    }
+    return true;
+}
+
+/* Write a datagram that couldn't be sent to the console */
+static void
+udp_to_console(struct os_mbuf *om)
+{
+    struct os_mbuf *m;
+
+    for (m = om; m; m = SLIST_NEXT(m, om_next)) {
+        console_write((const char*)m->om_data, m->om_len);
+    }
+}
+
+/* Send the datagram being collected, if any */
+static void
+udp_send(void)
+{
+    struct os_mbuf *om = g_udp_om;
+
+#if MYNEWT_VAL(RTDOABH_UDP_FLUSH_MS)
+    os_callout_stop(&g_udp_callout);
+#endif
+    if (!om) {
+        return;
+    }
+    g_udp_om = NULL;
+    g_udp_rec_off = 0;
+    if (OS_MBUF_PKTLEN(om) == 0) {
+        os_mbuf_free_chain(om);
+        return;
+    }
+    if (mn_sendto(g_udp_socket, om, (struct mn_sockaddr *)&g_udp_dest) == 0) {
+        STATS_INC(g_udp_stats, tx);
+        return;
+    }
+    STATS_INC(g_udp_stats, tx_err);
+    udp_to_console(om);
+    os_mbuf_free_chain(om);
+}
+
+#if MYNEWT_VAL(RTDOABH_UDP_FLUSH_MS)
+static void
+udp_timeout_cb(struct os_event *ev)
+{
+    if (g_udp_om) {
+        STATS_INC(g_udp_stats, tx_timeout);
+    }
+    udp_send();
+}
+#endif
+#endif
+
+/**
+ * Write part of the current record.
+ */
+void
+rtdoabh_out_write(const void *buf, int len)
+{
+#if MYNEWT_VAL(RTDOABH_UDP)
+    if (g_udp_rec == REC_START) {
+        g_udp_rec = REC_CONSOLE;
+        if (udp_active()) {
+            if (!g_udp_om) {
+                g_udp_om = os_msys_get_pkthdr(0, 0);
+                g_udp_rec_off = 0;
+#if MYNEWT_VAL(RTDOABH_UDP_FLUSH_MS)
+                if (g_udp_om) {
+                    os_callout_reset(&g_udp_callout, UDP_FLUSH_TICKS);
+                }
+#endif
+            }
+            if (g_udp_om) {
+                g_udp_rec = REC_UDP;
+            }
+        }
+    }
+    if (g_udp_rec == REC_UDP) {
+        if (os_mbuf_append(g_udp_om, buf, len) != 0) {
+            /* Take the partial record back out again */
+            os_mbuf_adj(g_udp_om, g_udp_rec_off - OS_MBUF_PKTLEN(g_udp_om));
+            g_udp_rec = REC_DROP;
+        }
+        return;
+    }
+    if (g_udp_rec == REC_DROP) {
+        return;
+    }
+#endif
+    console_write(buf, len);
+}
+
+/**
+ * End of a record, send the datagram if it is full.
+ */
+void
+rtdoabh_out_end(void)
+{
+#if MYNEWT_VAL(RTDOABH_UDP)
+    switch (g_udp_rec) {
+    case REC_UDP:
+        STATS_INC(g_udp_stats, rec);
+        break;
+    case REC_CONSOLE:
+        if (g_udp_dest.msin_addr.s_addr != 0) {
+            STATS_INC(g_udp_stats, console);
+        }
+        break;
+    case REC_DROP:
+        STATS_INC(g_udp_stats, rec_drop);
+        break;
+    default:
+        break;
+    }
+    g_udp_rec = REC_START;
+    if (g_udp_om) {
+        g_udp_rec_off = OS_MBUF_PKTLEN(g_udp_om);
+        if (g_udp_rec_off >= MYNEWT_VAL(RTDOABH_UDP_BATCH)) {
+            udp_send();
+        }
+    }
+#endif
+}
+
+/**
+ * The queue is empty, send whatever has been collected so nothing waits
+ * for the next record. Left to the flush callout with
+ * RTDOABH_UDP_FLUSH_MS.
+ */
+void
+rtdoabh_out_flush(void)
+{
+#if MYNEWT_VAL(RTDOABH_UDP) && !MYNEWT_VAL(RTDOABH_UDP_FLUSH_MS)
+    udp_send();
+#endif
+}
+
+void
+rtdoabh_out_init(void)
+{
+#if MYNEWT_VAL(RTDOABH_UDP)
+    int rc;
+
+    rc = conf_register(&g_udp_conf_handler);
+    assert(rc == 0);
+    udp_conf_commit();
+#if MYNEWT_VAL(RTDOABH_UDP_FLUSH_MS)
+    os_callout_init(&g_udp_callout, os_eventq_dflt_get(), udp_timeout_cb, NULL);
+#endif
+    rc = stats_init_and_reg(
+        STATS_HDR(g_udp_stats), STATS_SIZE_INIT_PARMS(g_udp_stats,
+        STATS_SIZE_32), STATS_NAME_INIT_PARMS(rtdoabh_udp_stats), "rtdoabh_udp");
+    assert(rc == 0);
+#endif
+}
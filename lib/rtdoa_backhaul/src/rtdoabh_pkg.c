@@ -0,0 +1,135 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Pool of result packages. A package is owned by exactly one party at a
+ * time: the sensor callbacks or ranging code filling it, or the sender
+ * writing it to the radio or the local queue. The filling side swaps in
+ * a fresh package before handing the filled one over, so it can carry
+ * on while the previous one is still being sent. Alloc and free are
+ * safe to call from any task.
+ */
+
+#include <string.h>
+#include <assert.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+
+#define PKG_NBUFS   MYNEWT_VAL(RTDOABH_PKG_BUFS)
+
+#if PKG_NBUFS < 3 || PKG_NBUFS > 32
+#error "RTDOABH_PKG_BUFS must be between 3 and 32"
+#endif
+
+static struct rtdoabh_tag_results_pkg g_pkgs[PKG_NBUFS];
+static uint32_t g_pkg_free;
+static uint16_t g_pkg_src_address;
+static uint8_t g_pkg_in_use_hwm;
+
+void
+rtdoabh_pkg_init(uint16_t src_address)
+{
+    g_pkg_src_address = src_address;
+    g_pkg_free = (PKG_NBUFS == 32) ? 0xffffffff : (1UL << PKG_NBUFS) - 1;
+    g_pkg_in_use_hwm = 0;
+}
+
+/**
+ * Take a package from the pool, cleared and with the header filled in.
+ *
+ * @return The package, or NULL if all are in use
+ */
+struct rtdoabh_tag_results_pkg *
+rtdoabh_pkg_alloc(void)
+{
+    struct rtdoabh_tag_results_pkg *p;
+    uint8_t in_use;
+    os_sr_t sr;
+    int i;
+
+    OS_ENTER_CRITICAL(sr);
+    if (!g_pkg_free) {
+        OS_EXIT_CRITICAL(sr);
+        return NULL;
+    }
+    i = __builtin_ctz(g_pkg_free);
+    g_pkg_free &= ~(1UL << i);
+    in_use = PKG_NBUFS - __builtin_popcount(g_pkg_free);
+    if (in_use > g_pkg_in_use_hwm) {
+        g_pkg_in_use_hwm = in_use;
+    }
+    OS_EXIT_CRITICAL(sr);
+
+    p = &g_pkgs[i];
+    memset(p, 0, sizeof(*p));
+    p->head.fctrl = FCNTL_IEEE_RTDOABH;
+    p->head.PANID = 0xDECA;
+    p->head.dst_address = 0xffff;
+    p->head.src_address = g_pkg_src_address;
+    p->head.code = DWT_RTDOABH_CODE;
+    return p;
+}
+
+void
+rtdoabh_pkg_free(struct rtdoabh_tag_results_pkg *p)
+{
+    int i = p - g_pkgs;
+    os_sr_t sr;
+
+    assert(i >= 0 && i < PKG_NBUFS);
+    OS_ENTER_CRITICAL(sr);
+    assert(!(g_pkg_free & (1UL << i)));
+    g_pkg_free |= (1UL << i);
+    OS_EXIT_CRITICAL(sr);
+}
+
+/**
+ * Hand the package being filled at *cur over to the caller and put a
+ * fresh one in its place.
+ *
+ * @param cur Pointer to the package being filled
+ *
+ * @return The filled package, to be freed by the caller, or NULL if the
+ *         pool is empty. *cur is then left as it is.
+ */
+struct rtdoabh_tag_results_pkg *
+rtdoabh_pkg_swap(struct rtdoabh_tag_results_pkg **cur)
+{
+    struct rtdoabh_tag_results_pkg *p, *next;
+    os_sr_t sr;
+
+    next = rtdoabh_pkg_alloc();
+    if (!next) {
+        return NULL;
+    }
+    OS_ENTER_CRITICAL(sr);
+    p = *cur;
+    *cur = next;
+    OS_EXIT_CRITICAL(sr);
+    return p;
+}
+
+/* Highest number of packages in use at once since init */
+uint8_t
+rtdoabh_pkg_hwm(void)
+{
+    return g_pkg_in_use_hwm;
+}
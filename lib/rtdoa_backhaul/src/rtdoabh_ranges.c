@@ -0,0 +1,74 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Ranges of one rtdoa slot. Kept apart from rtdoa_backhaul.c so that
+ * host/bench_ranges can time it against stand-ins for the uwb-core
+ * maths.
+ *
+ * The frame of the reference anchor is not skipped. Its difference is 0,
+ * but its entry is the only place the reference's rssi and line of
+ * sight estimate are reported.
+ */
+
+#include <math.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+#include "rtdoa/rtdoa.h"
+#include <uwb/uwb.h>
+
+/**
+ * Fill in the ranges of p from the frames of one slot. Frames without a
+ * source address are dropped before any maths is done, and at most
+ * RTDOABH_MAXNUM_RANGES are kept.
+ *
+ * @return Number of ranges, also set in p
+ */
+int
+rtdoabh_collect_ranges(struct uwb_dev * inst, struct rtdoa_instance *rtdoa,
+                       struct rtdoabh_tag_results_pkg *p)
+{
+    int i, n = 0;
+
+    for (i = 0; i < rtdoa->nframes && n < MYNEWT_VAL(RTDOABH_MAXNUM_RANGES); i++) {
+        rtdoa_frame_t *f = rtdoa->frames[i];
+        if (f->src_address == 0) {
+            continue;
+        }
+        float diff = rtdoa_tdoa_between_frames(rtdoa, rtdoa->req_frame, f);
+        if (isnan(diff)) {
+            continue;
+        }
+        float rssi = uwb_calc_rssi(inst, &f->diag);
+        float fppl = uwb_calc_fppl(inst, &f->diag);
+
+        struct rtdoabh_range_data *r = &p->ranges[n++];
+        r->anchor_addr = f->src_address;
+        r->diff_dist_mm = (int32_t)(diff*1000.0f + 0.5f);
+        r->rssi = rssi*10;
+        r->quality = (int)uwb_estimate_los(inst, rssi, fppl);
+#if MYNEWT_VAL(RTDOABH_STATS)
+        rtdoabh_astats_update(r->anchor_addr, r->diff_dist_mm, r->rssi);
+#endif
+    }
+    p->num_ranges = n;
+    return n;
+}
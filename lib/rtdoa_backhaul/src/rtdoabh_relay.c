@@ -0,0 +1,333 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Multi hop relaying. A relay forwards the backhaul frames it hears in a
+ * frame with code DWT_RTDOABH_RELAY_CODE that carries several of them:
+ *
+ *   ieee header(11) | n * (hops(1) | len(2, le) | original frame(len))
+ *
+ * The outer header carries the address and sequence number of the last
+ * relay. Each original frame is sent without its fcs, with hops the
+ * number of relays it has passed including the sender. A relay's own
+ * result goes first with hops 0, so it gets out in every relay slot
+ * whatever is queued. A relay receiving a relay frame forwards its
+ * entries with hops incremented rather than wrapping it again, so a
+ * frame grows by one entry header once whatever the number of hops.
+ * Loops are broken by duplicate suppression on the original source and
+ * sequence number and by RTDOABH_RELAY_MAX_HOPS.
+ *
+ * Frames wait as received mbuf chains in a fifo of RTDOABH_RELAY_QUEUE
+ * until the relay slot comes up, with the fcs and, for relay frames, the
+ * outer header cut off. Entries that must not be forwarded are marked
+ * in place. They are pushed from the default eventq and taken from the
+ * slot callback, which packs as many entries as fit behind the relay's
+ * own result and leaves the rest for the next slot. Any entry fits
+ * next to a full size result, so the queue always moves.
+ */
+
+#include <string.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+
+#define RELAY_QUEUE     MYNEWT_VAL(RTDOABH_RELAY_QUEUE)
+#define RELAY_MAX_HOPS  MYNEWT_VAL(RTDOABH_RELAY_MAX_HOPS)
+#define RELAY_HEAD_LEN  sizeof(struct _ieee_rng_request_frame_t)
+#define RELAY_FCS_LEN   (2)
+/* Largest frame the radio sends, excluding fcs */
+#define RELAY_MAX_LEN   (1021)
+/* Largest frame forwarded, leaves room for a full result of our own */
+#define RELAY_ENT_MAX   (RELAY_MAX_LEN - RELAY_HEAD_LEN - 2 * sizeof(struct relay_ent) - \
+                         sizeof(struct rtdoabh_tag_results_pkg))
+/* hops of an entry that is not forwarded */
+#define RELAY_DEAD      (0xff)
+
+#if RELAY_MAX_HOPS < 1 || RELAY_MAX_HOPS > 254
+#error "RTDOABH_RELAY_MAX_HOPS must be between 1 and 254"
+#endif
+
+struct relay_ent {
+    uint8_t hops;
+    uint16_t len;
+} __attribute__((packed, aligned(1)));
+
+_Static_assert(RELAY_ENT_MAX >= sizeof(struct rtdoabh_tag_results_pkg),
+               "A relay frame must hold a forwarded result next to its own");
+
+struct relay_item {
+    struct os_mbuf *om;
+    uint16_t off;               /**< Entries before this have been sent */
+    bool plain;                 /**< A single frame heard from its source */
+};
+
+static struct relay_item g_relay_q[RELAY_QUEUE];
+static uint8_t g_relay_head;
+static uint8_t g_relay_count;
+static uint16_t g_relay_src_address;
+
+static union {
+    struct _ieee_rng_request_frame_t head;
+    uint8_t buf[RELAY_MAX_LEN];
+} g_relay = {
+    .head = {
+        .fctrl = FCNTL_IEEE_RTDOABH,
+        .PANID = 0xDECA,
+        .dst_address = 0xffff,
+        .code = DWT_RTDOABH_RELAY_CODE,
+    },
+};
+static uint16_t g_relay_len;
+
+void
+rtdoabh_relay_init(uint16_t src_address)
+{
+    g_relay_src_address = src_address;
+    g_relay.head.src_address = src_address;
+    g_relay_head = 0;
+    g_relay_count = 0;
+}
+
+/**
+ * Hand each frame carried by a received relay frame to cb. A trailing
+ * fcs or a corrupt entry ends the walk.
+ *
+ * @param om Received frame with code DWT_RTDOABH_RELAY_CODE
+ * @param cb Called with the chain and the offset and length of a frame
+ *
+ * @return Number of frames handed to cb
+ */
+int
+rtdoabh_relay_unpack(struct os_mbuf *om, void (*cb)(struct os_mbuf *om, int off, int len))
+{
+    struct relay_ent ent;
+    int len = OS_MBUF_PKTLEN(om);
+    int off = RELAY_HEAD_LEN;
+    int n = 0;
+
+    while (off + sizeof(ent) <= len) {
+        os_mbuf_copydata(om, off, sizeof(ent), &ent);
+        off += sizeof(ent);
+        if (ent.len < RELAY_HEAD_LEN || off + ent.len > len) {
+            break;
+        }
+        cb(om, off, ent.len);
+        off += ent.len;
+        n++;
+    }
+    return n;
+}
+
+/* 0 to forward the frame at off in om, 1 for a duplicate or a frame of
+ * our own, OS_EINVAL if it can't be forwarded */
+static int
+relay_check(struct os_mbuf *om, int off, int len, uint8_t hops)
+{
+    struct _ieee_rng_request_frame_t head;
+
+    if (len < RELAY_HEAD_LEN || os_mbuf_copydata(om, off, sizeof(head), &head)) {
+        return OS_EINVAL;
+    }
+    if (head.src_address == g_relay_src_address ||
+        rtdoabh_dedup_check(head.src_address, head.seq_num)) {
+        return 1;
+    }
+    if (hops >= RELAY_MAX_HOPS || len > RELAY_ENT_MAX) {
+        return OS_EINVAL;
+    }
+    return 0;
+}
+
+/* Mark the entries of a relay frame that are not to be forwarded.
+ * Returns the result of relay_check for the last entry dropped if none
+ * is left, 0 otherwise. */
+static int
+relay_mark(struct os_mbuf *om)
+{
+    static const uint8_t dead = RELAY_DEAD;
+    struct relay_ent ent;
+    int len = OS_MBUF_PKTLEN(om);
+    int off = 0;
+    int live = 0;
+    int rc = OS_EINVAL;
+
+    while (off < len) {
+        if (off + sizeof(ent) > len || os_mbuf_copydata(om, off, sizeof(ent), &ent) ||
+            off + sizeof(ent) + ent.len > len) {
+            return OS_EINVAL;
+        }
+        off += sizeof(ent);
+        rc = relay_check(om, off, ent.len, ent.hops);
+        if (rc) {
+            os_mbuf_copyinto(om, off - sizeof(ent), &dead, 1);
+        } else {
+            live++;
+        }
+        off += ent.len;
+    }
+    return (live) ? 0 : rc;
+}
+
+/**
+ * Queue a frame received over the air for forwarding. On success the
+ * relay owns om, otherwise the caller keeps it.
+ *
+ * @param om Received frame, fcs included, plain or from a relay
+ *
+ * @return 0 if queued, 1 for a duplicate or a frame of our own,
+ *         OS_EINVAL if the frame is malformed, too long or has reached
+ *         RTDOABH_RELAY_MAX_HOPS, OS_ENOMEM if the queue is full. A
+ *         relay frame is queued if any of its frames is to be forwarded.
+ */
+int
+rtdoabh_relay_push(struct os_mbuf *om)
+{
+    struct _ieee_rng_request_frame_t head;
+    bool plain;
+    os_sr_t sr;
+    int idx, rc;
+
+    if (OS_MBUF_PKTLEN(om) < RELAY_HEAD_LEN + RELAY_FCS_LEN ||
+        os_mbuf_copydata(om, 0, sizeof(head), &head)) {
+        return OS_EINVAL;
+    }
+    plain = (head.code != DWT_RTDOABH_RELAY_CODE);
+    if (plain) {
+        rc = relay_check(om, 0, OS_MBUF_PKTLEN(om) - RELAY_FCS_LEN, 0);
+        if (rc) {
+            return rc;
+        }
+        os_mbuf_adj(om, -RELAY_FCS_LEN);
+    } else {
+        os_mbuf_adj(om, -RELAY_FCS_LEN);
+        os_mbuf_adj(om, RELAY_HEAD_LEN);
+        rc = relay_mark(om);
+        if (rc) {
+            return rc;
+        }
+    }
+
+    OS_ENTER_CRITICAL(sr);
+    if (g_relay_count == RELAY_QUEUE) {
+        OS_EXIT_CRITICAL(sr);
+        return OS_ENOMEM;
+    }
+    idx = (g_relay_head + g_relay_count) % RELAY_QUEUE;
+    g_relay_q[idx].om = om;
+    g_relay_q[idx].off = 0;
+    g_relay_q[idx].plain = plain;
+    g_relay_count++;
+    OS_EXIT_CRITICAL(sr);
+    return 0;
+}
+
+/* Add an entry to the frame being built, the frame is in om at off or
+ * in buf when om is NULL. Returns false if it doesn't fit. */
+static bool
+relay_add(uint8_t hops, struct os_mbuf *om, int off, const void *buf, int len)
+{
+    struct relay_ent ent = {
+        .hops = hops,
+        .len = len,
+    };
+
+    if (g_relay_len + sizeof(ent) + len > RELAY_MAX_LEN) {
+        return false;
+    }
+    memcpy(g_relay.buf + g_relay_len, &ent, sizeof(ent));
+    if (om) {
+        os_mbuf_copydata(om, off, len, g_relay.buf + g_relay_len + sizeof(ent));
+    } else {
+        memcpy(g_relay.buf + g_relay_len + sizeof(ent), buf, len);
+    }
+    g_relay_len += sizeof(ent) + len;
+    return true;
+}
+
+/* Add what fits of a queued item, returns true when all of it is in */
+static bool
+relay_add_item(struct relay_item *it, int *count)
+{
+    struct relay_ent ent;
+    int len = OS_MBUF_PKTLEN(it->om);
+
+    if (it->plain) {
+        if (!relay_add(1, it->om, 0, NULL, len)) {
+            return false;
+        }
+        (*count)++;
+        return true;
+    }
+    while (it->off < len) {
+        os_mbuf_copydata(it->om, it->off, sizeof(ent), &ent);
+        if (ent.hops != RELAY_DEAD) {
+            if (!relay_add(ent.hops + 1, it->om, it->off + sizeof(ent), NULL, ent.len)) {
+                return false;
+            }
+            (*count)++;
+        }
+        it->off += sizeof(ent) + ent.len;
+    }
+    return true;
+}
+
+/**
+ * Build the relay frame for this slot: own, if given, followed by as
+ * many queued frames as fit. The returned buffer stays valid until the
+ * next call.
+ *
+ * @param own     Our own result as it would be sent on its own, or NULL
+ * @param own_len Length of own, at most a full rtdoabh_tag_results_pkg
+ * @param len     Set to the frame length
+ * @param count   Set to the number of forwarded frames in it
+ *
+ * @return Frame, or NULL if there is neither a result nor anything queued
+ */
+const uint8_t *
+rtdoabh_relay_take(const void *own, int own_len, int *len, int *count)
+{
+    struct relay_item *it;
+    os_sr_t sr;
+
+    *count = 0;
+    g_relay_len = RELAY_HEAD_LEN;
+    if (own) {
+        relay_add(0, NULL, 0, own, own_len);
+    }
+    while (1) {
+        OS_ENTER_CRITICAL(sr);
+        it = (g_relay_count) ? &g_relay_q[g_relay_head] : NULL;
+        OS_EXIT_CRITICAL(sr);
+        if (!it || !relay_add_item(it, count)) {
+            break;
+        }
+        os_mbuf_free_chain(it->om);
+        OS_ENTER_CRITICAL(sr);
+        g_relay_head = (g_relay_head + 1) % RELAY_QUEUE;
+        g_relay_count--;
+        OS_EXIT_CRITICAL(sr);
+    }
+    if (g_relay_len == RELAY_HEAD_LEN) {
+        return NULL;
+    }
+    g_relay.head.seq_num++;
+    *len = g_relay_len;
+    return g_relay.buf;
+}
@@ -0,0 +1,135 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Single producer / single consumer ring of fixed size slots between
+ * the mac rx callback and the backhaul event on the default eventq.
+ * Head is only written by the producer and tail only by the consumer,
+ * both are free running and masked on use, so neither side needs a
+ * critical section. The consumer event is only posted if it is not
+ * already queued.
+ */
+
+#include <string.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+
+#if MYNEWT_VAL(RTDOABH_RING)
+
+#define RING_NSLOTS     MYNEWT_VAL(RTDOABH_NUM_MBUFS)
+
+#if (RING_NSLOTS & (RING_NSLOTS - 1))
+#error "RTDOABH_NUM_MBUFS must be a power of two when RTDOABH_RING is enabled"
+#endif
+
+static struct rtdoabh_ring_slot g_slots[RING_NSLOTS];
+static uint32_t g_head;         /**< Next slot to write, producer owned */
+static uint32_t g_tail;         /**< Next slot to read, consumer owned */
+static uint32_t g_overflow;     /**< Pushes refused, producer owned */
+static uint16_t g_hwm;          /**< Most slots in use, producer owned */
+static struct os_event *g_ev;
+
+void
+rtdoabh_ring_init(struct os_event *ev)
+{
+    g_head = g_tail = 0;
+    g_overflow = 0;
+    g_hwm = 0;
+    g_ev = ev;
+}
+
+/**
+ * Copy a frame into the next free slot and wake the consumer. Must only
+ * be called from a single context.
+ *
+ * @return 0 on success, OS_ENOMEM if the ring is full
+ */
+int
+rtdoabh_ring_push(const void *data, int len)
+{
+    uint32_t head = g_head;
+    uint32_t used = head - __atomic_load_n(&g_tail, __ATOMIC_ACQUIRE);
+    struct rtdoabh_ring_slot *s;
+
+    if (used >= RING_NSLOTS) {
+        g_overflow++;
+        return OS_ENOMEM;
+    }
+    if (used + 1 > g_hwm) {
+        g_hwm = used + 1;
+    }
+
+    s = &g_slots[head & (RING_NSLOTS - 1)];
+    len = (len > sizeof(s->data)) ? sizeof(s->data) : len;
+    memcpy(s->data, data, len);
+    s->dlen = len;
+    __atomic_store_n(&g_head, head + 1, __ATOMIC_RELEASE);
+
+    /* The consumer clears ev_queued before it looks at head, so
+     * seeing it set here means this slot will be picked up */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (!g_ev->ev_queued) {
+        os_eventq_put(os_eventq_dflt_get(), g_ev);
+    }
+    return 0;
+}
+
+/**
+ * Hand every slot filled so far to cb, releasing each one back to the
+ * producer as soon as cb returns. Only called from the consumer event.
+ *
+ * @return Number of slots drained
+ */
+int
+rtdoabh_ring_drain(void (*cb)(const uint8_t *data, int len))
+{
+    uint32_t head = __atomic_load_n(&g_head, __ATOMIC_ACQUIRE);
+    uint32_t tail = g_tail;
+    int n = 0;
+
+    while (tail != head) {
+        struct rtdoabh_ring_slot *s = &g_slots[tail & (RING_NSLOTS - 1)];
+        cb(s->data, s->dlen);
+        __atomic_store_n(&g_tail, ++tail, __ATOMIC_RELEASE);
+        n++;
+    }
+    return n;
+}
+
+int
+rtdoabh_ring_used(void)
+{
+    return __atomic_load_n(&g_head, __ATOMIC_ACQUIRE) - g_tail;
+}
+
+uint16_t
+rtdoabh_ring_hwm(void)
+{
+    return g_hwm;
+}
+
+uint32_t
+rtdoabh_ring_overflow(void)
+{
+    return g_overflow;
+}
+
+#endif /* RTDOABH_RING */
@@ -0,0 +1,137 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * SLIP framing of binary backhaul output. A frame on the wire is:
+ *
+ *   END | type(1) | dlen(2, le) | payload(dlen) | crc16(2, le) | END
+ *
+ * with END and ESC bytes inside the frame escaped as per RFC1055. 0x0A
+ * and 0x0D are escaped too, as ESC 0xDE and ESC 0xDF, because the console
+ * puts a \r in front of every \n it writes. The crc is crc16-ccitt
+ * (initial value 0) over type, dlen and payload.
+ */
+
+#include <os/mynewt.h>
+#include <crc/crc16.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+
+static void
+slip_flush(struct rtdoabh_slip *s)
+{
+    if (s->len) {
+        rtdoabh_out_write(s->buf, s->len);
+        s->len = 0;
+    }
+}
+
+static void
+slip_put_raw(struct rtdoabh_slip *s, uint8_t c)
+{
+    if (s->len == sizeof(s->buf)) {
+        slip_flush(s);
+    }
+    s->buf[s->len++] = c;
+}
+
+static void
+slip_put(struct rtdoabh_slip *s, const uint8_t *data, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        switch (data[i]) {
+        case RTDOABH_SLIP_END:
+            slip_put_raw(s, RTDOABH_SLIP_ESC);
+            slip_put_raw(s, RTDOABH_SLIP_ESC_END);
+            break;
+        case RTDOABH_SLIP_ESC:
+            slip_put_raw(s, RTDOABH_SLIP_ESC);
+            slip_put_raw(s, RTDOABH_SLIP_ESC_ESC);
+            break;
+        case '\n':
+            slip_put_raw(s, RTDOABH_SLIP_ESC);
+            slip_put_raw(s, RTDOABH_SLIP_ESC_LF);
+            break;
+        case '\r':
+            slip_put_raw(s, RTDOABH_SLIP_ESC);
+            slip_put_raw(s, RTDOABH_SLIP_ESC_CR);
+            break;
+        default:
+            slip_put_raw(s, data[i]);
+        }
+    }
+}
+
+void
+rtdoabh_slip_start(struct rtdoabh_slip *s, uint8_t type, uint16_t dlen)
+{
+    uint8_t hdr[3] = {type, dlen & 0xff, dlen >> 8};
+
+    s->len = 0;
+    s->crc = crc16_ccitt(CRC16_INITIAL_CRC, hdr, sizeof(hdr));
+    slip_put_raw(s, RTDOABH_SLIP_END);
+    slip_put(s, hdr, sizeof(hdr));
+}
+
+void
+rtdoabh_slip_append(struct rtdoabh_slip *s, const void *data, int len)
+{
+    s->crc = crc16_ccitt(s->crc, data, len);
+    slip_put(s, data, len);
+}
+
+/**
+ * Append len bytes from offset off of an mbuf chain without
+ * first copying them out of the chain.
+ *
+ * @return 0 on success, OS_EINVAL if the chain is shorter than off+len
+ */
+int
+rtdoabh_slip_append_mbuf(struct rtdoabh_slip *s, struct os_mbuf *om, int off, int len)
+{
+    int n;
+
+    while (om && off >= om->om_len) {
+        off -= om->om_len;
+        om = SLIST_NEXT(om, om_next);
+    }
+    while (om && len > 0) {
+        n = om->om_len - off;
+        n = (n > len) ? len : n;
+        rtdoabh_slip_append(s, om->om_data + off, n);
+        len -= n;
+        off = 0;
+        om = SLIST_NEXT(om, om_next);
+    }
+    return (len > 0) ? OS_EINVAL : 0;
+}
+
+void
+rtdoabh_slip_finish(struct rtdoabh_slip *s)
+{
+    uint8_t crc[2] = {s->crc & 0xff, s->crc >> 8};
+
+    slip_put(s, crc, sizeof(crc));
+    slip_put_raw(s, RTDOABH_SLIP_END);
+    slip_flush(s);
+    rtdoabh_out_end();
+}
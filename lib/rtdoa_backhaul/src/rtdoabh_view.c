@@ -0,0 +1,158 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Read only view of a received rtdoabh_tag_results_pkg. The header and
+ * sensor block are referenced in place when they sit in the first mbuf
+ * of the chain, which is always the case with the default mbuf size.
+ * Range entries are looked up one at a time and only copied out when
+ * an entry straddles two mbufs.
+ */
+
+#include <string.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+
+#define VIEW_SENSORS_END   (offsetof(struct rtdoabh_tag_results_pkg, sensors) + \
+                            sizeof(struct rtdoabh_sensor_data))
+#define VIEW_RANGES_OFF    offsetof(struct rtdoabh_tag_results_pkg, ranges)
+
+static void
+view_set_ranges(struct rtdoabh_pkg_view *v, uint16_t ref, uint8_t num)
+{
+    int max = (v->len > VIEW_RANGES_OFF) ?
+        (v->len - VIEW_RANGES_OFF) / sizeof(struct rtdoabh_range_data) : 0;
+
+    max = (max > MYNEWT_VAL(RTDOABH_MAXNUM_RANGES)) ?
+        MYNEWT_VAL(RTDOABH_MAXNUM_RANGES) : max;
+    v->ref_anchor_addr = ref;
+    v->num_ranges = (num > max) ? max : num;
+}
+
+/**
+ * Set up a view of a package held in a flat buffer.
+ *
+ * @param v   View to initialise
+ * @param buf Start of the package
+ * @param len Number of valid bytes in buf
+ *
+ * @return 0 on success, OS_EINVAL if buf is too short to hold the
+ *         header and sensor block
+ */
+int
+rtdoabh_view_init_flat(struct rtdoabh_pkg_view *v, const void *buf, int len)
+{
+    const struct rtdoabh_tag_results_pkg *p = buf;
+
+    if (len < VIEW_SENSORS_END) {
+        return OS_EINVAL;
+    }
+    v->om = NULL;
+    v->flat = buf;
+    v->len = len;
+    v->head = &p->head;
+    v->sensors = &p->sensors;
+    if (len >= VIEW_RANGES_OFF) {
+        view_set_ranges(v, p->ref_anchor_addr, p->num_ranges);
+    } else {
+        view_set_ranges(v, 0, 0);
+    }
+    return 0;
+}
+
+/**
+ * Set up a view of a package held in an mbuf chain. The chain must
+ * outlive the view.
+ *
+ * @param v  View to initialise
+ * @param om Packet header mbuf, payload starting at offset 0
+ *
+ * @return 0 on success, OS_EINVAL if the packet is too short to hold
+ *         the header and sensor block
+ */
+int
+rtdoabh_view_init_mbuf(struct rtdoabh_pkg_view *v, struct os_mbuf *om)
+{
+    struct {
+        uint16_t ref;
+        uint8_t num;
+    } __attribute__((packed, aligned(1))) tail = {0, 0};
+    int len = OS_MBUF_PKTLEN(om);
+
+    if (len < VIEW_SENSORS_END) {
+        return OS_EINVAL;
+    }
+    if (len > sizeof(struct rtdoabh_tag_results_pkg)) {
+        len = sizeof(struct rtdoabh_tag_results_pkg);
+    }
+    v->om = om;
+    v->flat = NULL;
+    v->len = len;
+
+    if (om->om_len >= VIEW_SENSORS_END) {
+        const struct rtdoabh_tag_results_pkg *p = (void*)om->om_data;
+        v->head = &p->head;
+        v->sensors = &p->sensors;
+    } else {
+        /* Only with a very small RTDOABH_MBUF_SIZE */
+        os_mbuf_copydata(om, 0, VIEW_SENSORS_END, &v->fixed);
+        v->head = &v->fixed.head;
+        v->sensors = &v->fixed.sensors;
+    }
+
+    if (len >= VIEW_RANGES_OFF) {
+        os_mbuf_copydata(om, VIEW_SENSORS_END, sizeof(tail), &tail);
+    }
+    view_set_ranges(v, tail.ref, tail.num);
+    return 0;
+}
+
+/**
+ * Look up range entry idx.
+ *
+ * @param v   View
+ * @param idx Entry index, must be below v->num_ranges
+ * @param tmp Storage used if the entry is not contiguous in memory
+ *
+ * @return Pointer to the entry, either in place or tmp
+ */
+const struct rtdoabh_range_data *
+rtdoabh_view_range(const struct rtdoabh_pkg_view *v, int idx,
+                   struct rtdoabh_range_data *tmp)
+{
+    const struct os_mbuf *om = v->om;
+    int off = VIEW_RANGES_OFF + idx * sizeof(struct rtdoabh_range_data);
+
+    if (!om) {
+        return (const struct rtdoabh_range_data *)(v->flat + off);
+    }
+    while (om && off >= om->om_len) {
+        off -= om->om_len;
+        om = SLIST_NEXT(om, om_next);
+    }
+    if (om && om->om_len - off >= sizeof(struct rtdoabh_range_data)) {
+        return (const struct rtdoabh_range_data *)(om->om_data + off);
+    }
+    if (!om || os_mbuf_copydata(om, off, sizeof(*tmp), tmp)) {
+        memset(tmp, 0, sizeof(*tmp));
+    }
+    return tmp;
+}
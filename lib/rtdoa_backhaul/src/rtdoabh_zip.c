@@ -0,0 +1,316 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *  http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+/**
+ * Compressed encoding of rtdoabh_tag_results_pkg, frame code
+ * DWT_RTDOABH_ZIP_CODE. After the ieee header (11 bytes):
+ *
+ *   version(1) | flags(2, le) | ts(uvar)
+ *   [gps_lat(4) gps_long(4)]        if GPS_LAT_LONG_ENABLED
+ *   [battery_voltage(1)]            if BATTERY_LEVELS_ENABLED
+ *   [pressure(svar)]                if PRESSURE_ENABLED
+ *   [compass(3 x svar)]             if COMPASS_ENABLED
+ *   [acceleration(3 x svar)]        if ACCELEROMETER_ENABLED
+ *   [gyro(3 x svar)]                if GYRO_ENABLED
+ *   [ref_anchor_addr(uvar) | num_ranges(1) | num_ranges x range]
+ *
+ *   range: anchor_addr - ref_anchor_addr(svar) | diff_dist_mm(svar) |
+ *          (zigzag(rssi) << 2 | quality)(uvar)
+ *
+ * The low 7 bits of version hold RTDOABH_ZIP_VERSION, bit 7 is set if
+ * the range block is present. It is left out for imu only packages,
+ * exactly as the plain package is cut short. flags are sensors_valid
+ * with has_usb_power in bit 14 and is_anchor_data in bit 15, as in the
+ * plain package. uvar is an LEB128 varint, svar a zigzag encoded uvar.
+ * scripts/rtdoabh_zip.py implements the same format on the host.
+ */
+
+#include <string.h>
+#include <os/mynewt.h>
+
+#include "rtdoa_backhaul/rtdoa_backhaul.h"
+#include "rtdoa_backhaul_priv.h"
+
+#define ZIP_SENSORS_END offsetof(struct rtdoabh_tag_results_pkg, ref_anchor_addr)
+#define ZIP_RANGES_OFF  offsetof(struct rtdoabh_tag_results_pkg, ranges)
+
+struct zip_buf {
+    uint8_t *p;
+    const uint8_t *end;
+    int err;
+};
+
+static void
+put_u8(struct zip_buf *b, uint8_t v)
+{
+    if (b->p >= b->end) {
+        b->err = 1;
+        return;
+    }
+    *b->p++ = v;
+}
+
+static void
+put_raw(struct zip_buf *b, const void *v, int len)
+{
+    if (b->end - b->p < len) {
+        b->err = 1;
+        return;
+    }
+    memcpy(b->p, v, len);
+    b->p += len;
+}
+
+static void
+put_uvar(struct zip_buf *b, uint64_t v)
+{
+    while (v >= 0x80) {
+        put_u8(b, (v & 0x7f) | 0x80);
+        v >>= 7;
+    }
+    put_u8(b, v);
+}
+
+static inline uint32_t
+zigzag(int32_t v)
+{
+    return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t
+unzigzag(uint32_t v)
+{
+    return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static void
+put_svar(struct zip_buf *b, int32_t v)
+{
+    put_uvar(b, zigzag(v));
+}
+
+static void
+put_svar3(struct zip_buf *b, const void *xyz)
+{
+    int16_t v[3];
+
+    memcpy(v, xyz, sizeof(v));
+    put_svar(b, v[0]);
+    put_svar(b, v[1]);
+    put_svar(b, v[2]);
+}
+
+static uint8_t
+get_u8(struct zip_buf *b)
+{
+    if (b->p >= b->end) {
+        b->err = 1;
+        return 0;
+    }
+    return *b->p++;
+}
+
+static void
+get_raw(struct zip_buf *b, void *v, int len)
+{
+    if (b->end - b->p < len) {
+        b->err = 1;
+        return;
+    }
+    memcpy(v, b->p, len);
+    b->p += len;
+}
+
+static uint64_t
+get_uvar(struct zip_buf *b)
+{
+    uint64_t v = 0;
+    uint8_t c;
+    int shift = 0;
+
+    do {
+        c = get_u8(b);
+        if (shift < 64) {
+            v |= (uint64_t)(c & 0x7f) << shift;
+        }
+        shift += 7;
+    } while ((c & 0x80) && !b->err);
+    return v;
+}
+
+static int32_t
+get_svar(struct zip_buf *b)
+{
+    return unzigzag(get_uvar(b));
+}
+
+static void
+get_svar3(struct zip_buf *b, void *xyz)
+{
+    int16_t v[3];
+
+    v[0] = get_svar(b);
+    v[1] = get_svar(b);
+    v[2] = get_svar(b);
+    memcpy(xyz, v, sizeof(v));
+}
+
+/**
+ * Compress a result package.
+ *
+ * @param p    Package to encode
+ * @param dlen Length of p as it would be sent uncompressed
+ * @param buf  Output buffer, receives the complete frame
+ * @param size Size of buf
+ *
+ * @return Frame length, or -1 if buf is too small
+ */
+int
+rtdoabh_zip_encode(const struct rtdoabh_tag_results_pkg *p, int dlen,
+                   uint8_t *buf, int size)
+{
+    const struct rtdoabh_sensor_data *d = &p->sensors;
+    struct _ieee_rng_request_frame_t head = p->head;
+    struct zip_buf b = {buf, buf + size, 0};
+    bool has_ranges = (dlen >= ZIP_RANGES_OFF);
+    uint16_t flags;
+    int i, n;
+
+    head.code = DWT_RTDOABH_ZIP_CODE;
+    put_raw(&b, &head, sizeof(head));
+    put_u8(&b, RTDOABH_ZIP_VERSION | (has_ranges << 7));
+    flags = d->sensors_valid | (d->has_usb_power << 14) | (d->is_anchor_data << 15);
+    put_u8(&b, flags & 0xff);
+    put_u8(&b, flags >> 8);
+    put_uvar(&b, d->ts);
+
+    if (d->sensors_valid & GPS_LAT_LONG_ENABLED) {
+        put_raw(&b, &d->gps_lat, sizeof(d->gps_lat));
+        put_raw(&b, &d->gps_long, sizeof(d->gps_long));
+    }
+    if (d->sensors_valid & BATTERY_LEVELS_ENABLED) {
+        put_u8(&b, d->battery_voltage);
+    }
+    if (d->sensors_valid & PRESSURE_ENABLED) {
+        put_svar(&b, d->pressure);
+    }
+    if (d->sensors_valid & COMPASS_ENABLED) {
+        put_svar3(&b, d->compass);
+    }
+    if (d->sensors_valid & ACCELEROMETER_ENABLED) {
+        put_svar3(&b, d->acceleration);
+    }
+    if (d->sensors_valid & GYRO_ENABLED) {
+        put_svar3(&b, d->gyro);
+    }
+
+    if (has_ranges) {
+        n = (dlen - ZIP_RANGES_OFF) / sizeof(struct rtdoabh_range_data);
+        n = (n > p->num_ranges) ? p->num_ranges : n;
+        put_uvar(&b, p->ref_anchor_addr);
+        put_u8(&b, n);
+        for (i = 0; i < n; i++) {
+            const struct rtdoabh_range_data *r = &p->ranges[i];
+            put_svar(&b, (int16_t)(r->anchor_addr - p->ref_anchor_addr));
+            put_svar(&b, r->diff_dist_mm);
+            put_uvar(&b, (zigzag(r->rssi) << 2) | (r->quality & 0x3));
+        }
+    }
+
+    return (b.err) ? -1 : b.p - buf;
+}
+
+/**
+ * Expand a compressed frame into a plain package.
+ *
+ * @param buf Complete received frame, trailing bytes are ignored
+ * @param len Length of buf
+ * @param p   Output package, fully overwritten
+ *
+ * @return Equivalent plain package length, or -1 if the frame is
+ *         malformed or of an unknown version
+ */
+int
+rtdoabh_zip_decode(const uint8_t *buf, int len, struct rtdoabh_tag_results_pkg *p)
+{
+    struct rtdoabh_sensor_data *d = &p->sensors;
+    struct zip_buf b = {(uint8_t *)buf, buf + len, 0};
+    uint16_t flags;
+    uint8_t version;
+    int i;
+
+    memset(p, 0, sizeof(*p));
+    get_raw(&b, &p->head, sizeof(p->head));
+    version = get_u8(&b);
+    if ((version & 0x7f) != RTDOABH_ZIP_VERSION || b.err) {
+        return -1;
+    }
+    p->head.code = DWT_RTDOABH_CODE;
+    flags = get_u8(&b);
+    flags |= get_u8(&b) << 8;
+    d->sensors_valid = flags & 0x3fff;
+    d->has_usb_power = (flags >> 14) & 1;
+    d->is_anchor_data = (flags >> 15) & 1;
+    d->ts = get_uvar(&b);
+
+    if (flags & GPS_LAT_LONG_ENABLED) {
+        get_raw(&b, &d->gps_lat, sizeof(d->gps_lat));
+        get_raw(&b, &d->gps_long, sizeof(d->gps_long));
+    }
+    if (flags & BATTERY_LEVELS_ENABLED) {
+        d->battery_voltage = get_u8(&b);
+    }
+    if (flags & PRESSURE_ENABLED) {
+        d->pressure = get_svar(&b);
+    }
+    if (flags & COMPASS_ENABLED) {
+        get_svar3(&b, d->compass);
+    }
+    if (flags & ACCELEROMETER_ENABLED) {
+        get_svar3(&b, d->acceleration);
+    }
+    if (flags & GYRO_ENABLED) {
+        get_svar3(&b, d->gyro);
+    }
+    if (b.err) {
+        return -1;
+    }
+
+    if (!(version & 0x80)) {
+        return ZIP_SENSORS_END;
+    }
+    p->ref_anchor_addr = get_uvar(&b);
+    p->num_ranges = get_u8(&b);
+    if (p->num_ranges > MYNEWT_VAL(RTDOABH_MAXNUM_RANGES)) {
+        return -1;
+    }
+    for (i = 0; i < p->num_ranges; i++) {
+        struct rtdoabh_range_data *r = &p->ranges[i];
+        uint32_t rq;
+        r->anchor_addr = p->ref_anchor_addr + get_svar(&b);
+        r->diff_dist_mm = get_svar(&b);
+        rq = get_uvar(&b);
+        r->quality = rq & 0x3;
+        r->rssi = unzigzag(rq >> 2);
+    }
+    if (b.err) {
+        return -1;
+    }
+    return ZIP_RANGES_OFF + p->num_ranges * sizeof(struct rtdoabh_range_data);
+}